@@ -0,0 +1,322 @@
+/* json-bench, compares the jansson handlers with the pool backed JSON writer
+ *
+ * Builds the /api/serverinfo, /api/workers and /api/cache bodies with the
+ * serializers from apibody.c and with the jansson code they replaced, into
+ * a request sized pool, and prints allocations and latency per response in
+ * the same shape as bench-report, so its output can be merged into bench
+ * results. Fails when the two don't produce the same bytes.
+ */
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include <h2o.h>
+#include <h2o/version.h>
+#include <jansson.h>
+
+#include <apibody.h>
+#include <filecache.h>
+#include <jsonwriter.h>
+#include <meta.h>
+#include <worker.h>
+
+#define ITERATIONS 200000
+#define WARMUP 10000
+#define WORKERS 8
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static size_t allocations = 0;
+
+// counts every allocation in the process, shared libraries included
+void *malloc(size_t size) {
+  ++allocations;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  ++allocations;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  ++allocations;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) { __libc_free(ptr); }
+
+static const char *uptime = "0m 3d 04:05:06";
+static uptimeTemplate serverinfo_template;
+static workerCtx workers[WORKERS];
+static fileCacheStats stats[WORKERS];
+
+// what the handlers did before apibody.c, kept as the baseline
+static h2o_iovec_t dump_to_pool(h2o_mem_pool_t *pool, json_t *root) {
+  size_t size = json_dumpb(root, NULL, 0, JSON_INDENT(2));
+  char *buf = malloc(size);
+
+  (void)json_dumpb(root, buf, size, JSON_INDENT(2));
+  json_decref(root);
+
+  h2o_iovec_t body = h2o_strdup(pool, buf, size);
+  free(buf);
+  return body;
+}
+
+static h2o_iovec_t serverinfo_jansson(h2o_mem_pool_t *pool) {
+  json_t *root = json_object();
+  json_t *dependencies = json_object();
+  char *uptime_buf = malloc(48);
+
+  strcpy(uptime_buf, uptime);
+
+  json_object_set_new(root, "name", json_string(__NAME__));
+  json_object_set_new(root, "description", json_string(__DESCRIPTION__));
+  json_object_set_new(root, "version", json_string(__PROJ_VERSION__));
+  json_object_set_new(root, "uptime", json_string(uptime_buf));
+
+  json_object_set_new(dependencies, "jansson_version",
+                      json_string(JANSSON_VERSION));
+  json_object_set_new(dependencies, "libh2o_version",
+                      json_string(H2O_LIBRARY_VERSION));
+  json_object_set_new(dependencies, "libuv_version",
+                      json_string(uv_version_string()));
+  json_object_set_new(dependencies, "zlib_version", json_string(ZLIB_VERSION));
+  json_object_set_new(dependencies, "openssl_version",
+                      json_string(OpenSSL_version(OPENSSL_VERSION)));
+  json_object_set_new(root, "dependencies", dependencies);
+
+  free(uptime_buf);
+  return dump_to_pool(pool, root);
+}
+
+static h2o_iovec_t workers_jansson(h2o_mem_pool_t *pool) {
+  json_t *root = json_object();
+  json_t *worker_array = json_array();
+
+  for (unsigned int i = 0; i < WORKERS; ++i) {
+    json_t *worker = json_object();
+    json_object_set_new(worker, "index", json_integer(workers[i].index));
+    json_object_set_new(
+        worker, "accepted",
+        json_integer(atomic_load_explicit(&workers[i].accepted,
+                                          memory_order_relaxed)));
+    json_object_set_new(
+        worker, "requests",
+        json_integer(atomic_load_explicit(&workers[i].requests,
+                                          memory_order_relaxed)));
+    json_array_append_new(worker_array, worker);
+  }
+  json_object_set_new(root, "workers", worker_array);
+
+  return dump_to_pool(pool, root);
+}
+
+static h2o_iovec_t cache_jansson(h2o_mem_pool_t *pool) {
+  json_t *root = json_object();
+  json_t *cache_array = json_array();
+
+  for (size_t i = 0; i < WORKERS; ++i) {
+    json_t *cache = json_object();
+    json_object_set_new(cache, "entries", json_integer(stats[i].entries));
+    json_object_set_new(cache, "bytes", json_integer(stats[i].bytes));
+    json_object_set_new(cache, "hits", json_integer(stats[i].hits));
+    json_object_set_new(cache, "misses", json_integer(stats[i].misses));
+    json_object_set_new(cache, "evictions", json_integer(stats[i].evictions));
+    json_array_append_new(cache_array, cache);
+  }
+  json_object_set_new(root, "caches", cache_array);
+
+  return dump_to_pool(pool, root);
+}
+
+// the handler renders once per second and thread, this is every time
+static h2o_iovec_t serverinfo_writer(h2o_mem_pool_t *pool) {
+  size_t len;
+  char *body = render_uptime_body(&serverinfo_template, uptime, &len);
+
+  h2o_mem_link_shared(pool, body);
+  h2o_mem_release_shared(body);
+  return h2o_iovec_init(body, len);
+}
+
+static h2o_iovec_t workers_writer(h2o_mem_pool_t *pool) {
+  jsonWriter writer;
+
+  jw_init(&writer, pool, 64 + WORKERS * 80);
+  write_workers_body(&writer, workers, WORKERS);
+  return jw_finish(&writer);
+}
+
+static h2o_iovec_t cache_writer(h2o_mem_pool_t *pool) {
+  jsonWriter writer;
+
+  jw_init(&writer, pool, 64 + WORKERS * 128);
+  write_cache_body(&writer, stats, WORKERS);
+  return jw_finish(&writer);
+}
+
+// every control character, which jansson escapes its own way
+static h2o_iovec_t escapes_jansson(h2o_mem_pool_t *pool) {
+  json_t *root = json_object();
+  char value[32];
+
+  for (int i = 0; i < 32; ++i)
+    value[i] = i + 1;
+  value[31] = '\0';
+
+  json_object_set_new(root, "value", json_string(value));
+  return dump_to_pool(pool, root);
+}
+
+static h2o_iovec_t escapes_writer(h2o_mem_pool_t *pool) {
+  char value[32];
+  jsonWriter writer;
+
+  for (int i = 0; i < 32; ++i)
+    value[i] = i + 1;
+  value[31] = '\0';
+
+  jw_init(&writer, pool, 256);
+  jw_object_begin(&writer);
+  jw_key(&writer, "value");
+  jw_string(&writer, value);
+  jw_object_end(&writer);
+  return jw_finish(&writer);
+}
+
+typedef h2o_iovec_t (*buildBody)(h2o_mem_pool_t *pool);
+
+static bool same_body(const char *name, buildBody jansson, buildBody writer) {
+  h2o_mem_pool_t pool;
+  bool same;
+
+  h2o_mem_init_pool(&pool);
+  h2o_iovec_t expected = jansson(&pool), actual = writer(&pool);
+  same = h2o_memis(expected.base, expected.len, actual.base, actual.len);
+  if (!same)
+    fprintf(stderr, "json-bench: %s differs\n%.*s\n%.*s\n", name,
+            (int)expected.len, expected.base, (int)actual.len, actual.base);
+  h2o_mem_clear_pool(&pool);
+  return same;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_u64(const void *_a, const void *_b) {
+  uint64_t a = *(const uint64_t *)_a, b = *(const uint64_t *)_b;
+  return (a > b) - (a < b);
+}
+
+static double percentile_us(uint64_t *durations, double p) {
+  size_t rank = (size_t)ceil(p * ITERATIONS);
+  return durations[rank ? rank - 1 : 0] / 1e3;
+}
+
+static json_t *run(buildBody build, uint64_t *durations) {
+  json_t *summary = json_object();
+  json_t *latency = json_object();
+  uint64_t total = 0;
+  size_t counted;
+
+  // a request pool is set up and torn down around every response
+  for (int i = 0; i < WARMUP + ITERATIONS; ++i) {
+    h2o_mem_pool_t pool;
+    uint64_t start;
+
+    if (i == WARMUP)
+      allocations = 0;
+
+    start = now_ns();
+    h2o_mem_init_pool(&pool);
+    build(&pool);
+    h2o_mem_clear_pool(&pool);
+
+    if (i >= WARMUP)
+      total += durations[i - WARMUP] = now_ns() - start;
+  }
+  counted = allocations;
+
+  qsort(durations, ITERATIONS, sizeof(uint64_t), compare_u64);
+
+  json_object_set_new(summary, "requests", json_integer(ITERATIONS));
+  json_object_set_new(summary, "rps", json_real(ITERATIONS / (total / 1e9)));
+  json_object_set_new(summary, "allocations_per_op",
+                      json_real((double)counted / ITERATIONS));
+
+  json_object_set_new(latency, "p50",
+                      json_real(percentile_us(durations, 0.50)));
+  json_object_set_new(latency, "p99",
+                      json_real(percentile_us(durations, 0.99)));
+  json_object_set_new(latency, "p999",
+                      json_real(percentile_us(durations, 0.999)));
+  json_object_set_new(latency, "max",
+                      json_real(durations[ITERATIONS - 1] / 1e3));
+  json_object_set_new(summary, "latency_us", latency);
+
+  return summary;
+}
+
+int main(void) {
+  static const struct {
+    const char *name;
+    buildBody jansson, writer;
+  } cases[] = {
+      {"serverinfo", serverinfo_jansson, serverinfo_writer},
+      {"workers", workers_jansson, workers_writer},
+      {"cache", cache_jansson, cache_writer},
+  };
+  h2o_mem_pool_t template_pool;
+  uint64_t *durations;
+  json_t *root, *scenarios;
+  char name[64];
+  bool same = same_body("escapes", escapes_jansson, escapes_writer);
+
+  h2o_mem_init_pool(&template_pool);
+  build_serverinfo_template(&serverinfo_template, &template_pool);
+  for (unsigned int i = 0; i < WORKERS; ++i) {
+    workers[i].index = i;
+    atomic_store(&workers[i].accepted, 1000 + i * 37);
+    atomic_store(&workers[i].requests, 250000 + i * 4099);
+    stats[i] = (fileCacheStats){120 + i, 4 << 20, 90000 + i, 1200 + i, i};
+  }
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); ++i)
+    same = same_body(cases[i].name, cases[i].jansson, cases[i].writer) && same;
+  if (!same)
+    return 1;
+
+  durations = malloc(ITERATIONS * sizeof(uint64_t));
+  root = json_object();
+  scenarios = json_object();
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); ++i) {
+    snprintf(name, sizeof(name), "json/%s/jansson", cases[i].name);
+    json_object_set_new(scenarios, name, run(cases[i].jansson, durations));
+    snprintf(name, sizeof(name), "json/%s/jsonwriter", cases[i].name);
+    json_object_set_new(scenarios, name, run(cases[i].writer, durations));
+  }
+  json_object_set_new(root, "scenarios", scenarios);
+
+  json_dumpf(root, stdout, JSON_INDENT(2) | JSON_SORT_KEYS);
+  putchar('\n');
+
+  json_decref(root);
+  free(durations);
+  h2o_mem_clear_pool(&template_pool);
+  return 0;
+}
@@ -0,0 +1,246 @@
+/* bench-report, turns h2load request logs into JSON and compares runs
+ *
+ *   bench-report summarize <scenario>=<h2load log>|<results.json> [...]
+ *   bench-report compare <baseline.json> <results.json> [threshold %]
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jansson.h>
+
+#define DEFAULT_THRESHOLD 5.0
+
+typedef struct {
+  uint64_t *durations;
+  size_t size;
+  size_t capacity;
+  uint64_t first_start;
+  uint64_t last_end;
+  size_t status[6]; // failed, then 1xx to 5xx
+} requestLog;
+
+static int compare_u64(const void *_a, const void *_b) {
+  uint64_t a = *(const uint64_t *)_a, b = *(const uint64_t *)_b;
+  return (a > b) - (a < b);
+}
+
+static int read_log(const char *path, requestLog *log) {
+  FILE *file = fopen(path, "r");
+  uint64_t start, duration;
+  int status;
+
+  if (!file) {
+    fprintf(stderr, "bench-report: can't open %s\n", path);
+    return -1;
+  }
+
+  // h2load --log-file: start (us since epoch), status, duration (us)
+  while (fscanf(file, "%" SCNu64 "\t%d\t%" SCNu64 "\n", &start, &status,
+                &duration) == 3) {
+    if (log->size == log->capacity) {
+      size_t capacity = log->capacity ? log->capacity * 2 : 4096;
+      uint64_t *durations =
+          realloc(log->durations, capacity * sizeof(*durations));
+      if (!durations) {
+        fclose(file);
+        return -1;
+      }
+      log->durations = durations;
+      log->capacity = capacity;
+    }
+
+    log->durations[log->size++] = duration;
+    if (log->size == 1 || start < log->first_start)
+      log->first_start = start;
+    if (start + duration > log->last_end)
+      log->last_end = start + duration;
+    ++log->status[status >= 100 && status < 600 ? status / 100 : 0];
+  }
+
+  fclose(file);
+  return 0;
+}
+
+static uint64_t percentile(requestLog *log, double p) {
+  size_t rank = (size_t)ceil(p * log->size);
+  return log->durations[rank ? rank - 1 : 0];
+}
+
+static json_t *summarize_log(requestLog *log) {
+  json_t *summary = json_object();
+  json_t *latency = json_object();
+  json_t *status = json_object();
+  double seconds = (log->last_end - log->first_start) / 1e6;
+
+  qsort(log->durations, log->size, sizeof(uint64_t), compare_u64);
+
+  json_object_set_new(summary, "requests", json_integer(log->size));
+  json_object_set_new(summary, "rps",
+                      json_real(seconds > 0 ? log->size / seconds : 0));
+
+  json_object_set_new(latency, "p50", json_integer(percentile(log, 0.50)));
+  json_object_set_new(latency, "p99", json_integer(percentile(log, 0.99)));
+  json_object_set_new(latency, "p999", json_integer(percentile(log, 0.999)));
+  json_object_set_new(latency, "max",
+                      json_integer(log->durations[log->size - 1]));
+  json_object_set_new(summary, "latency_us", latency);
+
+  json_object_set_new(status, "failed", json_integer(log->status[0]));
+  json_object_set_new(status, "1xx", json_integer(log->status[1]));
+  json_object_set_new(status, "2xx", json_integer(log->status[2]));
+  json_object_set_new(status, "3xx", json_integer(log->status[3]));
+  json_object_set_new(status, "4xx", json_integer(log->status[4]));
+  json_object_set_new(status, "5xx", json_integer(log->status[5]));
+  json_object_set_new(summary, "status", status);
+
+  return summary;
+}
+
+// scenarios from another run, json-bench writes the same shape
+static int merge(json_t *scenarios, const char *path) {
+  json_error_t error;
+  json_t *other = json_load_file(path, 0, &error);
+
+  if (!other) {
+    fprintf(stderr, "bench-report: %s:%d: %s\n", error.source, error.line,
+            error.text);
+    return -1;
+  }
+
+  json_object_update(scenarios, json_object_get(other, "scenarios"));
+  json_decref(other);
+  return 0;
+}
+
+static int summarize(int argc, char **argv) {
+  json_t *root = json_object();
+  json_t *scenarios = json_object();
+
+  json_object_set_new(root, "scenarios", scenarios);
+
+  for (int i = 0; i < argc; ++i) {
+    char *separator = strchr(argv[i], '=');
+    size_t len = strlen(argv[i]);
+    requestLog log = {0};
+
+    if (!separator && len > 5 && strcmp(argv[i] + len - 5, ".json") == 0) {
+      if (merge(scenarios, argv[i]) != 0) {
+        json_decref(root);
+        return 1;
+      }
+      continue;
+    }
+
+    if (!separator) {
+      fprintf(stderr, "bench-report: expected <scenario>=<log>, got %s\n",
+              argv[i]);
+      json_decref(root);
+      return 1;
+    }
+
+    *separator = '\0';
+    if (read_log(separator + 1, &log) != 0) {
+      free(log.durations);
+      json_decref(root);
+      return 1;
+    }
+
+    if (log.size == 0) {
+      fprintf(stderr, "bench-report: no requests logged for %s\n", argv[i]);
+    } else {
+      json_object_set_new(scenarios, argv[i], summarize_log(&log));
+    }
+    free(log.durations);
+  }
+
+  json_dumpf(root, stdout, JSON_INDENT(2) | JSON_SORT_KEYS);
+  putchar('\n');
+  json_decref(root);
+  return 0;
+}
+
+static double change(double baseline, double current) {
+  return baseline > 0 ? (current - baseline) / baseline * 100 : 0;
+}
+
+static int compare(const char *baseline_path, const char *results_path,
+                   double threshold) {
+  json_error_t error;
+  json_t *baseline = json_load_file(baseline_path, 0, &error);
+  json_t *results = json_load_file(results_path, 0, &error);
+  json_t *current;
+  const char *name;
+  int regressions = 0;
+
+  if (!baseline || !results) {
+    fprintf(stderr, "bench-report: %s:%d: %s\n", error.source, error.line,
+            error.text);
+    json_decref(baseline);
+    json_decref(results);
+    return 2;
+  }
+
+  printf("%-24s %12s %9s %12s %9s\n", "scenario", "rps", "change", "p99 (us)",
+         "change");
+
+  json_object_foreach(json_object_get(results, "scenarios"), name, current) {
+    json_t *before =
+        json_object_get(json_object_get(baseline, "scenarios"), name);
+    double rps = json_number_value(json_object_get(current, "rps"));
+    double p99 = json_number_value(
+        json_object_get(json_object_get(current, "latency_us"), "p99"));
+    double rps_change, p99_change;
+    bool regressed;
+
+    if (!before) {
+      printf("%-24s %12.0f %9s %12.0f %9s\n", name, rps, "new", p99, "new");
+      continue;
+    }
+
+    rps_change = change(json_number_value(json_object_get(before, "rps")), rps);
+    p99_change = change(json_number_value(json_object_get(
+                            json_object_get(before, "latency_us"), "p99")),
+                        p99);
+    regressed = rps_change < -threshold || p99_change > threshold;
+    regressions += regressed;
+
+    printf("%-24s %12.0f %+8.1f%% %12.0f %+8.1f%%%s\n", name, rps, rps_change,
+           p99, p99_change, regressed ? "  REGRESSION" : "");
+  }
+
+  json_decref(baseline);
+  json_decref(results);
+
+  if (regressions) {
+    printf("\n%d scenario(s) regressed by more than %.1f%%\n", regressions,
+           threshold);
+    return 1;
+  }
+  return 0;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "USAGE: bench-report summarize <scenario>=<h2load log>|<results.json> "
+          "[...]\n"
+          "       bench-report compare <baseline.json> <results.json> "
+          "[threshold %%]\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc >= 3 && strcmp(argv[1], "summarize") == 0)
+    return summarize(argc - 2, argv + 2);
+
+  if ((argc == 4 || argc == 5) && strcmp(argv[1], "compare") == 0)
+    return compare(argv[2], argv[3],
+                   argc == 5 ? atof(argv[4]) : DEFAULT_THRESHOLD);
+
+  usage();
+  return 2;
+}
@@ -0,0 +1,150 @@
+#!/usr/bin/env bash
+# Runs every scenario against bin/toast with h2load and writes the summary to
+# bench/results/latest.json, then compares it to bench/baseline.json if saved.
+#
+#   BENCH_DURATION  seconds per run (10)
+#   BENCH_CLIENTS   concurrent clients (64)
+#   BENCH_STREAMS   max concurrent streams per client on h2 (10)
+#   BENCH_THREADS   h2load threads (half the CPUs)
+#   BENCH_THRESHOLD regression threshold in percent (5)
+
+set -euo pipefail
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+bench_dir="$root/bench"
+results_dir="$bench_dir/results"
+toast="$root/bin/toast"
+report="$root/bin/bench-report"
+json_bench="$root/bin/json-bench"
+
+duration=${BENCH_DURATION:-10}
+clients=${BENCH_CLIENTS:-64}
+streams=${BENCH_STREAMS:-10}
+threads=${BENCH_THREADS:-$(($(nproc) / 2 > 0 ? $(nproc) / 2 : 1))}
+threshold=${BENCH_THRESHOLD:-5}
+
+plain_port=18080
+tls_port=18443
+
+for tool in h2load openssl "$toast" "$report" "$json_bench"; do
+  if ! command -v "$tool" >/dev/null; then
+    echo "bench: $tool not found, run 'just build' and enter nix-shell" >&2
+    exit 1
+  fi
+done
+
+work=$(mktemp -d)
+pids=()
+
+cleanup() {
+  for pid in "${pids[@]}"; do
+    kill "$pid" 2>/dev/null || true
+  done
+  wait 2>/dev/null || true
+  rm -rf "$work"
+}
+trap cleanup EXIT
+
+# toast reads ./config/config.json and ./assets from where it is started
+prepare_instance() {
+  local dir=$1 port=$2 ssl=$3
+
+  mkdir -p "$dir/config" "$dir/assets/cvs"
+  cp -r "$bench_dir/site" "$dir/site"
+  head -c 262144 /dev/urandom | base64 >"$dir/site/large.txt"
+  head -c 65536 /dev/urandom >"$dir/assets/cvs/CV_-_English.pdf"
+
+  cat >"$dir/config/config.json" <<EOF
+{
+  "site_root": "$dir/site/",
+  "workers": 0,
+  "log_type": "console",
+  "network": { "ip": "127.0.0.1", "port": $port },
+  "compression": { "enabled": true, "quality": 6, "min_size": 150 },
+  "ssl": {
+    "enabled": $ssl,
+    "mem_cached": false,
+    "cert_path": "$work/cert.pem",
+    "key_path": "$work/key.pem"
+  }
+}
+EOF
+}
+
+start_instance() {
+  local dir=$1 port=$2
+
+  (cd "$dir" && exec "$toast" >/dev/null 2>"$dir/stderr.log") &
+  pids+=($!)
+
+  for _ in $(seq 50); do
+    if (exec 3<>"/dev/tcp/127.0.0.1/$port") 2>/dev/null; then
+      return 0
+    fi
+    sleep 0.1
+  done
+
+  echo "bench: toast didn't start on port $port" >&2
+  cat "$dir/stderr.log" >&2
+  exit 1
+}
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj "/CN=127.0.0.1" \
+  -keyout "$work/key.pem" -out "$work/cert.pem" 2>/dev/null
+
+prepare_instance "$work/plain" "$plain_port" false
+prepare_instance "$work/tls" "$tls_port" true
+start_instance "$work/plain" "$plain_port"
+start_instance "$work/tls" "$tls_port"
+
+declare -A paths=(
+  [static]="/ /style.css /app.js /data.json /large.txt"
+  [serverinfo]="/api/serverinfo"
+  [uptime]="/api/uptime"
+  [cv]="/api/cv"
+  [notfound]="/does-not-exist /missing/page.html"
+)
+
+# protocol name, base url, extra h2load flags
+protocols=(
+  "h1|http://127.0.0.1:$plain_port|--h1"
+  "h2c|http://127.0.0.1:$plain_port|-m $streams"
+  "h1-tls|https://127.0.0.1:$tls_port|--h1"
+  "h2-tls|https://127.0.0.1:$tls_port|-m $streams"
+)
+
+logs=()
+for scenario in static serverinfo uptime cv notfound; do
+  for protocol in "${protocols[@]}"; do
+    IFS='|' read -r name base flags <<<"$protocol"
+    urls=()
+    for path in ${paths[$scenario]}; do
+      urls+=("$base$path")
+    done
+
+    headers=()
+    [[ $scenario == cv ]] && headers=(-H "language: English")
+
+    echo "bench: $scenario/$name"
+    # shellcheck disable=SC2086
+    h2load $flags -c "$clients" -t "$threads" -D "$duration" \
+      --warm-up-time=1 "${headers[@]}" \
+      --log-file="$work/$scenario-$name.log" "${urls[@]}" >/dev/null
+    logs+=("$scenario/$name=$work/$scenario-$name.log")
+  done
+done
+
+echo "bench: json writer"
+"$json_bench" >"$work/json.json"
+logs+=("$work/json.json")
+
+mkdir -p "$results_dir"
+"$report" summarize "${logs[@]}" >"$results_dir/latest.json"
+echo "bench: results written to bench/results/latest.json"
+
+if [[ -f "$bench_dir/baseline.json" ]]; then
+  "$report" compare "$bench_dir/baseline.json" "$results_dir/latest.json" \
+    "$threshold"
+else
+  echo "bench: no baseline yet, save one with 'just bench-save'"
+fi
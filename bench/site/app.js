@@ -0,0 +1,13 @@
+"use strict";
+
+document.addEventListener("DOMContentLoaded", async () => {
+  const list = document.getElementById("items");
+  const response = await fetch("/data.json");
+  const data = await response.json();
+
+  for (const item of data.items) {
+    const entry = document.createElement("li");
+    entry.textContent = `${item.name}: ${item.description}`;
+    list.appendChild(entry);
+  }
+});
@@ -0,0 +1,26 @@
+#ifndef ACCESSLOG_H_IMPLEMENTATION
+#define ACCESSLOG_H_IMPLEMENTATION
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <h2o.h>
+
+#include <config.h>
+
+typedef struct {
+  size_t written;
+  size_t dropped; // lines lost to full rings
+} accessLogStats;
+
+/* lines are formatted on the worker into a per-thread ring and written out
+ * in batches by a single writer thread, which also rotates the log file */
+int start_access_log(void);
+// writes out every queued line and stops the writer, before exiting
+void stop_access_log(void);
+void set_access_log_target(Config *config);
+
+void register_access_log(h2o_pathconf_t *pathconf);
+void access_log_stats(accessLogStats *stats);
+
+#endif // !ACCESSLOG_H_IMPLEMENTATION
@@ -6,6 +6,10 @@
 int get_cv(h2o_handler_t *self, h2o_req_t *req);
 int get_uptime(h2o_handler_t *self, h2o_req_t *req);
 int get_server_info(h2o_handler_t *self, h2o_req_t *req);
-void init_start_date(void);
+int get_workers_info(h2o_handler_t *self, h2o_req_t *req);
+int get_cache_info(h2o_handler_t *self, h2o_req_t *req);
+int get_metrics(h2o_handler_t *self, h2o_req_t *req);
+int get_lag(h2o_handler_t *self, h2o_req_t *req);
+void init_static_responses(void);
 
 #endif // !API_H_IMPLEMENTATION
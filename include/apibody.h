@@ -0,0 +1,34 @@
+#ifndef APIBODY_H_IMPLEMENTATION
+#define APIBODY_H_IMPLEMENTATION
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <h2o.h>
+
+#include <filecache.h>
+#include <jsonwriter.h>
+#include <worker.h>
+
+// a body that only changes through its uptime string
+typedef struct {
+  h2o_iovec_t prefix; // up to and including the opening quote
+  h2o_iovec_t suffix; // from the closing quote on
+  uint64_t hash;
+} uptimeTemplate;
+
+// the /api/serverinfo and /api/uptime bodies, built once into pool
+void build_serverinfo_template(uptimeTemplate *template, h2o_mem_pool_t *pool);
+void build_uptime_template(uptimeTemplate *template, h2o_mem_pool_t *pool);
+
+/* the template with uptime in it, from h2o_mem_alloc_shared so requests
+ * still sending it can hold a reference */
+char *render_uptime_body(const uptimeTemplate *template, const char *uptime,
+                         size_t *len);
+
+void write_workers_body(jsonWriter *writer, workerCtx *workers,
+                        unsigned int count);
+void write_cache_body(jsonWriter *writer, const fileCacheStats *stats,
+                      size_t count);
+
+#endif // !APIBODY_H_IMPLEMENTATION
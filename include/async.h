@@ -0,0 +1,34 @@
+#ifndef ASYNC_H_IMPLEMENTATION
+#define ASYNC_H_IMPLEMENTATION
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <h2o.h>
+
+#include <metrics.h>
+
+typedef struct {
+  size_t queued; // waiting for a pool thread
+  size_t running;
+  size_t completed;
+  size_t abandoned; // finished after the client went away
+  size_t wait_sum_usec;
+  size_t wait[LATENCY_BUCKETS]; // time spent queued
+} asyncStats;
+
+// runs on a libuv pool thread, so it must not touch the request
+typedef void (*asyncWork)(void *data);
+
+/* back on the request's loop. req is NULL when the request was disposed
+ * while the work ran, done then only cleans up data */
+typedef void (*asyncDone)(h2o_req_t *req, void *data);
+
+/* moves blocking work off the loop, the handler returns 0 right after and
+ * done sends the response. the pool has UV_THREADPOOL_SIZE threads,
+ * 4 unless the environment says otherwise */
+int queue_work(h2o_req_t *req, asyncWork work, asyncDone done, void *data);
+
+void async_stats(asyncStats *stats);
+
+#endif // !ASYNC_H_IMPLEMENTATION
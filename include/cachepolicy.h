@@ -0,0 +1,21 @@
+#ifndef CACHEPOLICY_H_IMPLEMENTATION
+#define CACHEPOLICY_H_IMPLEMENTATION
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <h2o.h>
+
+#include <config.h>
+
+/* app.3f9a1c.js, main-3f9a1c2b.css or index-BfXk3j2a.js: a content hash
+ * between the stem and the extension of name, which has no slashes */
+bool is_fingerprinted(const char *name, size_t len);
+
+/* the Cache-Control for a request path, directories being their index.html.
+ * the first policy that matches wins, then fingerprinted names get
+ * immutable. len is 0 when nothing applies, the value is never copied */
+h2o_iovec_t cache_control_for(const Config *config, const char *path,
+                              size_t len);
+
+#endif // !CACHEPOLICY_H_IMPLEMENTATION
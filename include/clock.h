@@ -0,0 +1,31 @@
+#ifndef CLOCK_H_IMPLEMENTATION
+#define CLOCK_H_IMPLEMENTATION
+
+#include <stdint.h>
+#include <time.h>
+
+#include <h2o.h>
+
+typedef struct {
+  uint64_t mono_ms; // never jumps, only good for measuring intervals
+  time_t wall;
+  int year;
+  char log_date[H2O_TIMESTR_LOG_LEN + 1];
+} clockTime;
+
+// remembers when the process started, call once before any loop runs
+void init_clock(void);
+
+/* ties the calling thread's clock to loop, so it is only read again once
+ * libuv has moved the loop time on, i.e. at most once per iteration.
+ * threads without a loop read the clocks on every call */
+void start_clock(uv_loop_t *loop);
+
+// the log date and year are only formatted when the second changes
+const clockTime *clock_now(void);
+
+// measured on the monotonic clock, so wall clock jumps don't move it
+uint64_t uptime_ms(void);
+time_t started_at(void);
+
+#endif // !CLOCK_H_IMPLEMENTATION
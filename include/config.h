@@ -2,30 +2,97 @@
 #define CONFIG_H_IMPLEMENTATION
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_WORKERS 1024 // 0 asks for one per CPU
 
 typedef struct {
-  char *ip;
+  char *address; // IPv4 or IPv6, "::" takes both unless ipv6_only
   unsigned int port;
+  char *path;          // Unix domain socket instead of address and port
+  unsigned int mode;   // permissions of the socket file
+  char *owner;         // "user" or "user:group" for the socket file, or NULL
+  bool proxy_protocol; // peers send a PROXY protocol line first
+  unsigned int backlog;
+  unsigned int fastopen;     // TCP_FASTOPEN queue length, 0 is off
+  unsigned int defer_accept; // seconds to wait for the first bytes, 0 is off
+  bool nodelay;
+  bool ipv6_only;
+  unsigned int sndbuf;        // 0 keeps the kernel default
+  unsigned int notsent_lowat; // 0 keeps the kernel default
+} listenerConfig;
+
+typedef struct {
+  listenerConfig *listeners; // always at least one
+  size_t listener_count;
+  unsigned int max_connections; // per worker, 0 is unlimited
+  unsigned int drain_timeout;   // seconds an upgraded-away process waits
 } networkConfig;
 
 typedef struct {
   bool enabled;
   unsigned int quality;
   unsigned int min_size;
+  bool precompress;
 } compressionConfig;
 
+typedef struct {
+  bool enabled;
+  unsigned int max_bytes;         // per worker
+  unsigned int max_file_size;     // larger files are always read from disk
+  unsigned int not_found_entries; // per worker, paths remembered as 404s
+} cacheConfig;
+
 typedef struct {
   bool enabled;
   bool mem_cached;
+  bool session_tickets;
+  char *ticket_keyfile; // NULL keeps ticket keys in memory only
+  bool ktls;            // kernel TLS when the kernel and libh2o support it
   char *cert_path;
   char *key_path;
 } sslConfig;
 
+typedef struct {
+  char *match; // glob against the file name, or the path if it starts with /
+  char *cache_control; // "" sends none
+  size_t cache_control_len;
+} cachePolicy;
+
+typedef struct {
+  bool content_etags;           // strong ETags from hashing the bytes
+  bool immutable_fingerprinted; // for names like app.3f9a1c.js
+  cachePolicy *policies;        // in config order, the first match wins
+  size_t policy_count;
+} httpCacheConfig;
+
+typedef struct {
+  /* peers that may read /api/lag: an IP address, or "unix:" and the path of
+   * a Unix socket listener. empty keeps it closed to everyone */
+  char **lag_allow;
+  size_t lag_allow_count;
+} apiConfig;
+
+typedef struct {
+  char *extension; // lowercase, without the dot
+  char *type;
+  size_t type_len;
+} mimeOverride;
+
 typedef struct {
   char *site_root;
+  unsigned int workers;
   enum { File, Console, Both } log_type;
+  bool log_compress; // zstd rotated log files
+  unsigned int slow_handler_ms; // handlers taking longer are traced, 0 is off
+  char *pack; // file built by toast --pack to serve from, or NULL
+  mimeOverride *mime_types; // sorted by extension, ahead of the built-in table
+  size_t mime_type_count;
   networkConfig network;
   compressionConfig compression;
+  cacheConfig cache;
+  httpCacheConfig http_cache;
+  apiConfig api;
   sslConfig ssl;
 } Config;
 
@@ -35,4 +102,7 @@ int free_config(Config *config);
 int read_config(Config *config);
 int write_config(Config *config);
 
+// NULL when every listener is a Unix domain socket
+listenerConfig *first_tcp_listener(networkConfig *network);
+
 #endif // !CONFIG_H_IMPLEMENTATION
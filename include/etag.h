@@ -0,0 +1,35 @@
+#ifndef ETAG_H_IMPLEMENTATION
+#define ETAG_H_IMPLEMENTATION
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <h2o.h>
+
+#define CONTENT_ETAG_LEN 18 // 16 hex digits in quotes
+
+// xxh64 of the bytes, fast enough to run over a whole site at startup
+uint64_t hash_content(const void *data, size_t len);
+// buf holds at least CONTENT_ETAG_LEN + 1
+void format_content_etag(char *buf, uint64_t hash);
+
+typedef struct siteHashes siteHashes;
+
+/* hashes every file under site_root, precompressed siblings included.
+ * shared by every worker, entries are hashed again when a request finds
+ * the file changed since */
+siteHashes *hash_site(const char *site_root);
+// rel_path as walk_dir hands it out, false when the file wasn't hashed
+bool find_site_hash(siteHashes *hashes, const char *rel_path, size_t len,
+                    uint64_t *hash);
+
+/* goes right before h2o_file_register, which should then be given
+ * H2O_FILE_FLAG_NO_ETAG. answers If-None-Match from the content hash and
+ * leaves ETag and Cache-Control on the response for the file handler, only
+ * for files that exist. hashes may be NULL for Cache-Control alone, the
+ * handler owns them */
+void register_static_headers(h2o_pathconf_t *pathconf, const char *site_root,
+                             siteHashes *hashes);
+
+#endif // !ETAG_H_IMPLEMENTATION
@@ -3,8 +3,10 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <sys/stat.h>
+
+#include <h2o.h>
 
-char *get_mime(const char *path);
 char *get_cwd(void);
 
 int make_dir(const char *path);
@@ -13,4 +15,14 @@ bool is_file(const char *path);
 char *read_file_from_fd(FILE *file);
 char *read_file(const char *path);
 
+// called for every directory before it's descended into, and every file
+typedef int (*walk_cb)(const char *path, const char *rel_path,
+                       struct stat *st, void *data);
+int walk_dir(const char *dir_path, const char *rel_path, walk_cb cb,
+             void *data);
+
+// the first such request header has value anywhere in it, for validators
+bool header_contains(h2o_req_t *req, const h2o_token_t *token,
+                     const char *value);
+
 #endif // !FILE_H_IMPLEMENTATION
@@ -0,0 +1,22 @@
+#ifndef FILECACHE_H_IMPLEMENTATION
+#define FILECACHE_H_IMPLEMENTATION
+
+#include <stddef.h>
+
+#include <h2o.h>
+
+typedef struct {
+  size_t entries;
+  size_t bytes;
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+} fileCacheStats;
+
+void register_filecache(h2o_pathconf_t *pathconf, const char *site_root,
+                        size_t budget, size_t max_file_size);
+
+// one slot per worker context, allocated from pool, returns how many
+size_t filecache_stats(h2o_mem_pool_t *pool, fileCacheStats **stats);
+
+#endif // !FILECACHE_H_IMPLEMENTATION
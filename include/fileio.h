@@ -0,0 +1,24 @@
+#ifndef FILEIO_H_IMPLEMENTATION
+#define FILEIO_H_IMPLEMENTATION
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+#include <h2o.h>
+
+/* back on the request's loop. err is 0 or an errno, EFBIG when the file is
+ * over max_size and EINVAL when it isn't a regular file. body.base is
+ * malloc'd and the callback owns it, req is NULL when the request was
+ * disposed meanwhile */
+typedef void (*fileReadDone)(h2o_req_t *req, int err, h2o_iovec_t body,
+                             const struct stat *st, void *data);
+
+/* reads a whole file without blocking the loop, through the worker's
+ * io_uring when it has one and on the libuv pool otherwise */
+int read_file_async(h2o_req_t *req, const char *path, size_t max_size,
+                    fileReadDone done, void *data);
+
+// sets up the calling worker's ring, a no-op without TOAST_USE_IO_URING
+void start_file_io(uv_loop_t *loop);
+
+#endif // !FILEIO_H_IMPLEMENTATION
@@ -0,0 +1,37 @@
+#ifndef JSONWRITER_H_IMPLEMENTATION
+#define JSONWRITER_H_IMPLEMENTATION
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <h2o.h>
+
+/* writes JSON straight into request pool memory, formatted like
+ * json_dumpb(..., JSON_INDENT(2)) so responses keep their shape */
+typedef struct {
+  h2o_mem_pool_t *pool;
+  char *buf;
+  size_t len;
+  size_t capacity;
+  unsigned int depth;
+  uint64_t has_members; // bit per depth, nesting is capped at 64
+  bool after_key;
+} jsonWriter;
+
+void jw_init(jsonWriter *writer, h2o_mem_pool_t *pool, size_t capacity);
+
+void jw_object_begin(jsonWriter *writer);
+void jw_object_end(jsonWriter *writer);
+void jw_array_begin(jsonWriter *writer);
+void jw_array_end(jsonWriter *writer);
+
+void jw_key(jsonWriter *writer, const char *key);
+void jw_string(jsonWriter *writer, const char *value);
+void jw_string_n(jsonWriter *writer, const char *value, size_t len);
+void jw_integer(jsonWriter *writer, long long value);
+void jw_bool(jsonWriter *writer, bool value);
+
+h2o_iovec_t jw_finish(jsonWriter *writer);
+
+#endif // !JSONWRITER_H_IMPLEMENTATION
@@ -0,0 +1,11 @@
+#ifndef KTLS_H_IMPLEMENTATION
+#define KTLS_H_IMPLEMENTATION
+
+#include <stdbool.h>
+
+/* hands TLS record encryption to the kernel after the handshake, so file
+ * bodies can go out with sendfile. returns false, and changes nothing, when
+ * the kernel or libh2o can't do it */
+bool enable_ktls(void);
+
+#endif // !KTLS_H_IMPLEMENTATION
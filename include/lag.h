@@ -0,0 +1,46 @@
+#ifndef LAG_H_IMPLEMENTATION
+#define LAG_H_IMPLEMENTATION
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <h2o.h>
+
+#include <metrics.h>
+
+#define SLOW_REQUESTS 32 // most recent, kept per worker
+
+typedef struct {
+  unsigned int worker;
+  size_t samples;
+  size_t lag_sum_usec;
+  size_t max_usec;
+  size_t lag[LATENCY_BUCKETS]; // same buckets as the request latency
+  size_t slow_requests;        // ever recorded, not just the ones kept
+} loopLag;
+
+typedef struct {
+  unsigned int worker;
+  metricsRoute route;
+  time_t at;
+  uint64_t usec;
+  char path[128]; // truncated
+} slowRequest;
+
+/* a timer on loop that measures how late it fires, which is how long
+ * something else held the loop. call from the thread running loop */
+void start_lag_probe(uv_loop_t *loop, unsigned int worker);
+
+/* remembers requests the handlers on pathconf took longer than threshold_ms
+ * to start responding to, 0 turns it off */
+void register_slow_trace(h2o_pathconf_t *pathconf, metricsRoute route,
+                         unsigned int threshold_ms);
+
+// one entry per worker, returns how many were filled
+size_t collect_lag(loopLag *lags, size_t max);
+
+// newest first over every worker, returns how many were filled
+size_t recent_slow_requests(slowRequest *requests, size_t max);
+
+#endif // !LAG_H_IMPLEMENTATION
@@ -0,0 +1,43 @@
+#ifndef METRICS_H_IMPLEMENTATION
+#define METRICS_H_IMPLEMENTATION
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <h2o.h>
+
+typedef enum {
+  RouteStatic,
+  RouteApi,
+  RouteNotFound,
+  ROUTE_COUNT,
+} metricsRoute;
+
+extern const char *metrics_route_names[ROUTE_COUNT];
+
+/* log-linear latency buckets in microseconds: below 4us every value gets
+ * its own bucket, above that each power of two is split in 4 */
+#define LATENCY_SUB_BUCKETS 4
+#define LATENCY_BUCKETS (LATENCY_SUB_BUCKETS * 28)
+
+typedef struct {
+  size_t requests;
+  size_t status[5]; // 1xx to 5xx
+  size_t bytes_in;
+  size_t bytes_out;
+  size_t latency_sum_usec;
+  size_t latency[LATENCY_BUCKETS];
+  size_t identity_bytes; // before on-the-fly compression
+  size_t encoded_bytes;  // after it
+} routeMetrics;
+
+// counts every request answered on pathconf under route, 404s under
+// RouteNotFound whatever the route
+void register_metrics(h2o_pathconf_t *pathconf, metricsRoute route);
+
+// sums every thread's counters
+void collect_metrics(routeMetrics totals[ROUTE_COUNT]);
+size_t latency_bucket(uint64_t usec);
+uint64_t latency_bucket_bound(size_t bucket);
+
+#endif // !METRICS_H_IMPLEMENTATION
@@ -0,0 +1,44 @@
+#ifndef MIME_H_IMPLEMENTATION
+#define MIME_H_IMPLEMENTATION
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <h2o.h>
+
+#include <config.h>
+
+typedef struct {
+  const char *extension; // lowercase, without the dot
+  size_t extension_len;
+  h2o_iovec_t type;
+} mimeEntry;
+
+// shared with tools/mime_table.c, which picks the seeds the table uses
+static inline uint32_t mime_hash(uint32_t seed, const char *ext, size_t len) {
+  uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = ext[i];
+    hash ^= c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    hash *= 16777619u;
+  }
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  return hash;
+}
+
+/* never allocates, the type points into the built-in table or config's
+ * mime_types. config may be NULL for the built-in table alone, unknown
+ * extensions are application/octet-stream */
+h2o_iovec_t mime_for_extension(const Config *config, const char *ext,
+                               size_t len);
+h2o_iovec_t mime_for_path(const Config *config, const char *path,
+                          size_t len);
+
+// the same types for h2o_file_register, drop it with h2o_mem_release_shared
+h2o_mimemap_t *create_mimemap(const Config *config);
+
+#endif // !MIME_H_IMPLEMENTATION
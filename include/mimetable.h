@@ -0,0 +1,107 @@
+/* generated by `just mime_table` from tools/mime_table.c, edit the list
+ * there instead */
+
+#ifndef MIMETABLE_H_IMPLEMENTATION
+#define MIMETABLE_H_IMPLEMENTATION
+
+#include <stdint.h>
+
+#include <mime.h>
+
+#define MIME_TABLE_SIZE 80
+#define MIME_BUCKETS 41
+
+// 0 for a bucket no extension hashes to
+static const uint32_t mime_seeds[MIME_BUCKETS] = {
+    5, 4, 1, 2, 18, 8, 0, 3,
+    28, 2, 11, 10, 7, 1, 10, 2,
+    3, 3, 4, 22, 1, 1, 18, 1,
+    0, 12, 11, 28, 3, 2, 13, 4,
+    0, 1, 1, 77, 24, 7, 18, 2,
+    4,
+};
+
+static const mimeEntry mime_table[MIME_TABLE_SIZE] = {
+    {H2O_STRLIT("doc"), {H2O_STRLIT("application/msword")}},
+    {H2O_STRLIT("jxl"), {H2O_STRLIT("image/jxl")}},
+    {H2O_STRLIT("txt"), {H2O_STRLIT("text/plain")}},
+    {H2O_STRLIT("zip"), {H2O_STRLIT("application/zip")}},
+    {H2O_STRLIT("webp"), {H2O_STRLIT("image/webp")}},
+    {H2O_STRLIT("epub"), {H2O_STRLIT("application/epub+zip")}},
+    {H2O_STRLIT("bmp"), {H2O_STRLIT("image/bmp")}},
+    {H2O_STRLIT("jsonld"), {H2O_STRLIT("application/ld+json")}},
+    {H2O_STRLIT("pdf"), {H2O_STRLIT("application/pdf")}},
+    {H2O_STRLIT("tif"), {H2O_STRLIT("image/tiff")}},
+    {H2O_STRLIT("mp3"), {H2O_STRLIT("audio/mpeg")}},
+    {H2O_STRLIT("oga"), {H2O_STRLIT("audio/ogg")}},
+    {H2O_STRLIT("mjs"), {H2O_STRLIT("text/javascript")}},
+    {H2O_STRLIT("webm"), {H2O_STRLIT("video/webm")}},
+    {H2O_STRLIT("xlsx"), {H2O_STRLIT("application/vnd.openxmlformats-officedocument.spreadsheetml.sheet")}},
+    {H2O_STRLIT("mid"), {H2O_STRLIT("audio/midi")}},
+    {H2O_STRLIT("mp4"), {H2O_STRLIT("video/mp4")}},
+    {H2O_STRLIT("otf"), {H2O_STRLIT("font/otf")}},
+    {H2O_STRLIT("webmanifest"), {H2O_STRLIT("application/manifest+json")}},
+    {H2O_STRLIT("json"), {H2O_STRLIT("application/json")}},
+    {H2O_STRLIT("toml"), {H2O_STRLIT("application/toml")}},
+    {H2O_STRLIT("woff"), {H2O_STRLIT("font/woff")}},
+    {H2O_STRLIT("flac"), {H2O_STRLIT("audio/flac")}},
+    {H2O_STRLIT("svg"), {H2O_STRLIT("image/svg+xml")}},
+    {H2O_STRLIT("3gp"), {H2O_STRLIT("video/3gpp")}},
+    {H2O_STRLIT("wav"), {H2O_STRLIT("audio/wav")}},
+    {H2O_STRLIT("yaml"), {H2O_STRLIT("application/yaml")}},
+    {H2O_STRLIT("css"), {H2O_STRLIT("text/css")}},
+    {H2O_STRLIT("mov"), {H2O_STRLIT("video/quicktime")}},
+    {H2O_STRLIT("csv"), {H2O_STRLIT("text/csv")}},
+    {H2O_STRLIT("ico"), {H2O_STRLIT("image/x-icon")}},
+    {H2O_STRLIT("avi"), {H2O_STRLIT("video/x-msvideo")}},
+    {H2O_STRLIT("jar"), {H2O_STRLIT("application/java-archive")}},
+    {H2O_STRLIT("mkv"), {H2O_STRLIT("video/x-matroska")}},
+    {H2O_STRLIT("atom"), {H2O_STRLIT("application/atom+xml")}},
+    {H2O_STRLIT("jpeg"), {H2O_STRLIT("image/jpeg")}},
+    {H2O_STRLIT("bz2"), {H2O_STRLIT("application/x-bzip2")}},
+    {H2O_STRLIT("apng"), {H2O_STRLIT("image/apng")}},
+    {H2O_STRLIT("png"), {H2O_STRLIT("image/png")}},
+    {H2O_STRLIT("xml"), {H2O_STRLIT("application/xml")}},
+    {H2O_STRLIT("aac"), {H2O_STRLIT("audio/aac")}},
+    {H2O_STRLIT("zst"), {H2O_STRLIT("application/zstd")}},
+    {H2O_STRLIT("docx"), {H2O_STRLIT("application/vnd.openxmlformats-officedocument.wordprocessingml.document")}},
+    {H2O_STRLIT("js"), {H2O_STRLIT("text/javascript")}},
+    {H2O_STRLIT("jpg"), {H2O_STRLIT("image/jpeg")}},
+    {H2O_STRLIT("pptx"), {H2O_STRLIT("application/vnd.openxmlformats-officedocument.presentationml.presentation")}},
+    {H2O_STRLIT("ts"), {H2O_STRLIT("video/mp2t")}},
+    {H2O_STRLIT("m4v"), {H2O_STRLIT("video/mp4")}},
+    {H2O_STRLIT("bin"), {H2O_STRLIT("application/octet-stream")}},
+    {H2O_STRLIT("xls"), {H2O_STRLIT("application/vnd.ms-excel")}},
+    {H2O_STRLIT("avif"), {H2O_STRLIT("image/avif")}},
+    {H2O_STRLIT("ppt"), {H2O_STRLIT("application/vnd.ms-powerpoint")}},
+    {H2O_STRLIT("xhtml"), {H2O_STRLIT("application/xhtml+xml")}},
+    {H2O_STRLIT("m3u8"), {H2O_STRLIT("application/vnd.apple.mpegurl")}},
+    {H2O_STRLIT("tar"), {H2O_STRLIT("application/x-tar")}},
+    {H2O_STRLIT("ics"), {H2O_STRLIT("text/calendar")}},
+    {H2O_STRLIT("7z"), {H2O_STRLIT("application/x-7z-compressed")}},
+    {H2O_STRLIT("eot"), {H2O_STRLIT("application/vnd.ms-fontobject")}},
+    {H2O_STRLIT("weba"), {H2O_STRLIT("audio/webm")}},
+    {H2O_STRLIT("woff2"), {H2O_STRLIT("font/woff2")}},
+    {H2O_STRLIT("wasm"), {H2O_STRLIT("application/wasm")}},
+    {H2O_STRLIT("ogv"), {H2O_STRLIT("video/ogg")}},
+    {H2O_STRLIT("rtf"), {H2O_STRLIT("application/rtf")}},
+    {H2O_STRLIT("ttf"), {H2O_STRLIT("font/ttf")}},
+    {H2O_STRLIT("gif"), {H2O_STRLIT("image/gif")}},
+    {H2O_STRLIT("html"), {H2O_STRLIT("text/html")}},
+    {H2O_STRLIT("gz"), {H2O_STRLIT("application/gzip")}},
+    {H2O_STRLIT("md"), {H2O_STRLIT("text/markdown")}},
+    {H2O_STRLIT("svgz"), {H2O_STRLIT("image/svg+xml")}},
+    {H2O_STRLIT("tiff"), {H2O_STRLIT("image/tiff")}},
+    {H2O_STRLIT("opus"), {H2O_STRLIT("audio/opus")}},
+    {H2O_STRLIT("heic"), {H2O_STRLIT("image/heic")}},
+    {H2O_STRLIT("m4a"), {H2O_STRLIT("audio/mp4")}},
+    {H2O_STRLIT("mpeg"), {H2O_STRLIT("video/mpeg")}},
+    {H2O_STRLIT("htm"), {H2O_STRLIT("text/html")}},
+    {H2O_STRLIT("ogg"), {H2O_STRLIT("audio/ogg")}},
+    {H2O_STRLIT("rss"), {H2O_STRLIT("application/rss+xml")}},
+    {H2O_STRLIT("rar"), {H2O_STRLIT("application/vnd.rar")}},
+    {H2O_STRLIT("map"), {H2O_STRLIT("application/json")}},
+    {H2O_STRLIT("mpd"), {H2O_STRLIT("application/dash+xml")}},
+};
+
+#endif // !MIMETABLE_H_IMPLEMENTATION
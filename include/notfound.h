@@ -0,0 +1,32 @@
+#ifndef NOTFOUND_H_IMPLEMENTATION
+#define NOTFOUND_H_IMPLEMENTATION
+
+#include <stddef.h>
+
+#include <h2o.h>
+
+#include <pages.h>
+
+typedef struct {
+  size_t entries;
+  size_t hits;
+  size_t flushes;
+} notFoundStats;
+
+typedef struct notFoundLookup notFoundLookup;
+
+/* remembers paths that ended in a 404, so scanners asking for the same
+ * missing files again get the 404 page without anything touching the disk.
+ * it goes first on pathconf, and is emptied whenever something appears
+ * under site_root. max_entries is per worker, 0 turns the cache off */
+notFoundLookup *register_missing_lookup(h2o_pathconf_t *pathconf,
+                                        const char *site_root,
+                                        size_t max_entries, pageSet *pages);
+
+// goes last on the same pathconf, sends the 404 and remembers the path
+void register_not_found(h2o_pathconf_t *pathconf, notFoundLookup *lookup);
+
+// summed over every worker context
+void not_found_stats(notFoundStats *stats);
+
+#endif // !NOTFOUND_H_IMPLEMENTATION
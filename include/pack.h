@@ -0,0 +1,19 @@
+#ifndef PACK_H_IMPLEMENTATION
+#define PACK_H_IMPLEMENTATION
+
+#include <h2o.h>
+
+#include <config.h>
+
+/* compiles site_root into one file: a perfect hash over the request paths,
+ * then every body and precompressed variant on its own page. written next
+ * to pack_path and renamed over it, so a running server never sees half */
+int build_pack(const char *site_root, const char *pack_path,
+               unsigned int min_size, const Config *config);
+
+/* maps the pack and serves GET and HEAD for the paths in it, anything else
+ * falls through. the mapping lives as long as the config snapshot, so a
+ * reload after a rebuild picks up the new file */
+int register_pack(h2o_pathconf_t *pathconf, const char *pack_path);
+
+#endif // !PACK_H_IMPLEMENTATION
@@ -0,0 +1,17 @@
+#ifndef PAGES_H_IMPLEMENTATION
+#define PAGES_H_IMPLEMENTATION
+
+#include <h2o.h>
+
+typedef struct pageSet pageSet;
+
+/* site_root/<status>.html for every error status toast knows, falling back
+ * to a built-in page. {status} and {reason} are filled in here, {path} and
+ * {year} per request, pages without {path} get precompressed variants */
+pageSet *load_pages(const char *site_root);
+void free_pages(pageSet *pages);
+
+// status 200 sends the welcome page shown while site_root has no index.html
+void send_page(h2o_req_t *req, pageSet *pages, int status);
+
+#endif // !PAGES_H_IMPLEMENTATION
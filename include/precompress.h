@@ -0,0 +1,44 @@
+#ifndef PRECOMPRESS_H_IMPLEMENTATION
+#define PRECOMPRESS_H_IMPLEMENTATION
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <h2o.h>
+
+#include <config.h>
+#include <etag.h>
+
+// ordered by preference when a client accepts more than one
+typedef enum {
+  Brotli = 1 << 0,
+  Zstd = 1 << 1,
+  Gzip = 1 << 2,
+} precompressEncoding;
+
+#define PRECOMPRESS_ENCODINGS 3
+
+typedef struct {
+  precompressEncoding encoding;
+  const char *name;      // Content-Encoding token
+  const char *extension; // sibling suffix
+} precompressVariant;
+
+extern const precompressVariant precompress_variants[PRECOMPRESS_ENCODINGS];
+
+int precompress_site(const char *site_root, unsigned int min_size);
+// *out is malloc'd, at the highest level the encoding has
+int precompress_buffer(precompressEncoding encoding, const char *in,
+                       size_t in_len, char **out, size_t *out_len);
+unsigned int accepted_encodings(h2o_req_t *req);
+// path ends in one of the variant extensions
+bool is_variant(const char *path);
+// by extension, text-like types worth a precompressed sibling
+bool is_compressible(const char *path);
+
+/* hashes are only read while indexing, and give content ETags to match the
+ * file handler's. NULL keeps the mtime ones h2o_file_send makes */
+void register_precompressed(h2o_pathconf_t *pathconf, const char *site_root,
+                            const Config *config, siteHashes *hashes);
+
+#endif // !PRECOMPRESS_H_IMPLEMENTATION
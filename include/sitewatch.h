@@ -0,0 +1,29 @@
+#ifndef SITEWATCH_H_IMPLEMENTATION
+#define SITEWATCH_H_IMPLEMENTATION
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <h2o.h>
+
+typedef struct siteWatch siteWatch;
+
+/* path is relative to site_root and starts with a slash, mask is the inotify
+ * event's. path is NULL when anything may have changed: the queue overflowed,
+ * or site_root itself was moved, deleted or watched again */
+typedef void (*siteChangeCb)(const char *path, size_t len, uint32_t mask,
+                             void *data);
+
+/* every caller on the same loop and site_root shares one inotify instance,
+ * new directories are watched before the callbacks hear about them. NULL
+ * when inotify is unavailable */
+siteWatch *watch_site(uv_loop_t *loop, const char *site_root, siteChangeCb cb,
+                      void *data);
+void unwatch_site(siteWatch *watch);
+
+/* false while site_root is gone, nothing under it can be trusted then. once
+ * it's back it's watched again, and the callbacks get a NULL path */
+bool is_site_watched(siteWatch *watch);
+
+#endif // !SITEWATCH_H_IMPLEMENTATION
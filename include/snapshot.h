@@ -0,0 +1,35 @@
+#ifndef SNAPSHOT_H_IMPLEMENTATION
+#define SNAPSHOT_H_IMPLEMENTATION
+
+#include <stdatomic.h>
+
+#include <h2o.h>
+
+#include <config.h>
+#include <pages.h>
+
+/* everything a request can see of the configuration, never modified once
+ * published. a reload builds a new one and swaps it in, the old one is freed
+ * when its last connection is done with it */
+typedef struct {
+  atomic_size_t refcnt;
+  unsigned int generation;
+  Config config;
+  h2o_globalconf_t globalconf;
+  SSL_CTX *ssl_ctx;
+  pageSet *pages; // error and welcome pages compiled from site_root
+} configSnapshot;
+
+typedef int (*snapshot_setup_cb)(configSnapshot *snapshot);
+
+// takes ownership of config, it's freed along with the snapshot
+configSnapshot *create_snapshot(Config *config, snapshot_setup_cb setup);
+void publish_snapshot(configSnapshot *snapshot);
+
+configSnapshot *acquire_snapshot(void);
+void release_snapshot(configSnapshot *snapshot);
+
+// the snapshot the request's connection was accepted under
+configSnapshot *get_snapshot(h2o_req_t *req);
+
+#endif // !SNAPSHOT_H_IMPLEMENTATION
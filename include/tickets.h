@@ -0,0 +1,24 @@
+#ifndef TICKETS_H_IMPLEMENTATION
+#define TICKETS_H_IMPLEMENTATION
+
+#include <stddef.h>
+
+#include <h2o.h>
+
+typedef struct {
+  size_t full;
+  size_t resumed;
+  size_t rotations;
+} ticketStats;
+
+/* ticket keys are process wide and shared by every worker, they rotate on
+ * the given loop and are synced to keyfile when it isn't NULL */
+int start_session_tickets(uv_loop_t *loop, const char *keyfile);
+void setup_session_tickets(SSL_CTX *ssl_ctx);
+
+// full and resumed handshakes, with or without tickets
+void count_handshakes(SSL_CTX *ssl_ctx);
+
+void session_ticket_stats(ticketStats *stats);
+
+#endif // !TICKETS_H_IMPLEMENTATION
@@ -0,0 +1,23 @@
+#ifndef UPGRADE_H_IMPLEMENTATION
+#define UPGRADE_H_IMPLEMENTATION
+
+#include <h2o.h>
+
+#include <config.h>
+
+/* execs argv with every listening socket passed down. the new process
+ * binds nothing it was given, and once it is accepting this one stops,
+ * waits up to drain_timeout seconds for its connections and exits */
+int start_upgrade(uv_loop_t *loop, char **argv, unsigned int drain_timeout);
+
+// the new process's side, before any listener is bound
+void read_inherited_fds(void);
+
+/* an inherited socket of type bound to the listener's address, or -1 so
+ * the caller binds its own */
+int take_inherited_fd(const listenerConfig *listener, int type);
+
+// closes inherited sockets no listener took, then lets the old process go
+void finish_upgrade(void);
+
+#endif // !UPGRADE_H_IMPLEMENTATION
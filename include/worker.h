@@ -0,0 +1,95 @@
+#ifndef WORKER_H_IMPLEMENTATION
+#define WORKER_H_IMPLEMENTATION
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#include <h2o.h>
+
+#include <config.h>
+#include <snapshot.h>
+
+typedef struct workerCtx workerCtx;
+
+/* one h2o context per snapshot, connections stay on the generation that
+ * accepted them and a retired generation is torn down once they're gone */
+typedef struct workerGeneration {
+  struct workerGeneration *next; // on the worker's list until it's reaped
+  workerCtx *worker;
+  configSnapshot *snapshot;
+  h2o_context_t ctx;
+  h2o_accept_ctx_t accept_ctx;
+  h2o_accept_ctx_t proxy_accept_ctx; // reads a PROXY line before the request
+  h2o_multithread_receiver_t libmemcached_receiver;
+  size_t connections;
+  bool retired;
+  uv_timer_t reaper;
+} workerGeneration;
+
+// TCP, or a Unix domain socket that all workers share
+typedef struct {
+  union {
+    uv_handle_t handle;
+    uv_stream_t stream;
+    uv_tcp_t tcp;
+    uv_pipe_t pipe;
+  };
+  workerCtx *worker;
+  bool is_unix;
+  bool proxy_protocol;
+  bool paused; // at max_connections, holding a connection it hasn't accepted
+  struct sockaddr_storage addr; // peer address for Unix socket connections
+  socklen_t addr_len;
+} workerListener;
+
+struct workerCtx {
+  unsigned int index;
+  pthread_t thread;
+  uv_loop_t loop;
+  workerListener *listeners; // one per configured listener
+  size_t listener_count;
+  uv_async_t reload;
+  uv_async_t stop; // closes the listeners, on upgrade
+  workerGeneration *generation;
+  workerGeneration *generations; // the current one and those still draining
+  struct workerConn *free_conns; // closed connections kept for reuse
+  size_t paused_listeners;
+  atomic_size_t accepted;
+  atomic_size_t requests;
+  atomic_size_t live_conns;
+  atomic_size_t free_conn_count;
+  atomic_size_t peak_conns; // free and live together never exceed it
+  atomic_size_t accept_pauses;
+};
+
+unsigned int default_worker_count(void);
+
+// workers pick up the published snapshot, and every one after it on reload
+int start_workers(Config *config);
+void reload_workers(void);
+void join_workers(void);
+
+/* every worker closes its listeners and asks its connections to finish,
+ * the sockets live on in whichever process they were handed to */
+void stop_accepting(void);
+size_t open_connections(void);
+
+// fds of every listening socket, TCP, Unix and UDP, returns how many
+size_t listener_fds(int *fds, size_t max);
+
+// every connection holds its generation, whichever listener accepted it
+void hold_generation(workerGeneration *generation);
+void drop_generation(workerGeneration *generation);
+
+// IPv4 or IPv6, whichever the listener's address parses as
+int listener_sockaddr(const listenerConfig *listener,
+                      struct sockaddr_storage *addr);
+
+workerCtx *get_workers(unsigned int *count);
+workerCtx *current_worker(void);
+
+void register_worker_counter(h2o_pathconf_t *pathconf);
+
+#endif // !WORKER_H_IMPLEMENTATION
@@ -12,6 +12,7 @@ with pkgs;
       openssl
       pkg-config
       brotli
+      zstd
       wslay
       libcap
     ];
@@ -23,6 +24,7 @@ with pkgs;
       clang-tools
       valgrind
       just
+      nghttp2 # h2load for just bench
     ];
 
     shellHook = ''
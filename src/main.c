@@ -6,7 +6,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
-#include <time.h>
 #include <unistd.h>
 
 #include <h2o.h>
@@ -15,11 +14,27 @@
 #include <h2o/http2.h>
 #include <h2o/memcached.h>
 
+#include <accesslog.h>
 #include <api.h>
 #include <cli.h>
+#include <clock.h>
 #include <config.h>
+#include <etag.h>
 #include <file.h>
+#include <filecache.h>
+#include <ktls.h>
+#include <lag.h>
 #include <meta.h>
+#include <metrics.h>
+#include <mime.h>
+#include <notfound.h>
+#include <pack.h>
+#include <pages.h>
+#include <precompress.h>
+#include <snapshot.h>
+#include <tickets.h>
+#include <upgrade.h>
+#include <worker.h>
 
 #ifdef API_H_IMPLEMENTATION
 static h2o_pathconf_t *
@@ -32,363 +47,360 @@ register_handler(h2o_hostconf_t *hostconf, const char *path,
 }
 #endif
 
-static h2o_globalconf_t config;
-static h2o_context_t ctx;
-static h2o_multithread_receiver_t libmemcached_receiver;
-static h2o_accept_ctx_t accept_ctx;
+static int saved_argc;
+static char **saved_argv;
 
-static void on_accept(uv_stream_t *listener, int status) {
-  uv_tcp_t *conn;
-  h2o_socket_t *sock;
+/* on every route the compression metrics report on, after register_metrics
+ * so its filter sees the body on both sides of this one */
+static void register_compression(h2o_pathconf_t *pathconf, Config *config) {
+  h2o_compress_args_t ca = {
+      .gzip.quality = config->compression.quality,
+  };
 
-  if (status != 0)
+  if (config->compression.enabled == false)
     return;
 
-  conn = h2o_mem_alloc(sizeof(*conn));
-  uv_tcp_init(listener->loop, conn);
+  if (config->compression.min_size != 0)
+    ca.min_size = config->compression.min_size;
 
-  if (uv_accept(listener, (uv_stream_t *)conn) != 0) {
-    uv_close((uv_handle_t *)conn, (uv_close_cb)free);
-    return;
-  }
-
-  sock = h2o_uv_socket_create((uv_handle_t *)conn, (uv_close_cb)free);
-  h2o_accept(&accept_ctx, sock);
+  h2o_compress_register(pathconf, &ca);
 }
 
-static int create_listener(char *ip, unsigned int port) {
-  static uv_tcp_t listener;
-  struct sockaddr_in addr;
-  int r;
-
-  uv_tcp_init(ctx.loop, &listener);
-  uv_ip4_addr(ip, port, &addr);
-  if ((r = uv_tcp_bind(&listener, (struct sockaddr *)&addr, 0)) != 0) {
-    fprintf(stderr, "uv_tcp_bind:%s\n", uv_strerror(r));
-    goto Error;
-  }
-  if ((r = uv_listen((uv_stream_t *)&listener, 128, on_accept)) != 0) {
-    fprintf(stderr, "uv_listen:%s\n", uv_strerror(r));
-    goto Error;
-  }
-
-  return 0;
-Error:
-  uv_close((uv_handle_t *)&listener, NULL);
-  return r;
+static void attach_loggers(h2o_pathconf_t *pathconf, metricsRoute route,
+                           Config *config) {
+  register_slow_trace(pathconf, route, config->slow_handler_ms);
+  register_metrics(pathconf, route);
+  register_compression(pathconf, config);
+  register_access_log(pathconf);
+  register_worker_counter(pathconf);
 }
 
-static int setup_ssl(const char *cert_file, const char *key_file,
-                     const char *ciphers, char *ip, bool use_memcached) {
+static int setup_ssl(SSL_CTX **out, const char *cert_file,
+                     const char *key_file, const char *ciphers, char *ip,
+                     bool use_memcached, bool use_tickets,
+                     const char *ticket_keyfile, bool use_ktls) {
+  // resumption through memcached is process wide, reloads can't move it
+  static bool memcached_ready = false;
+  // so are ticket keys, which is what lets tickets outlive a reload
+  static bool tickets_ready = false;
+  // libh2o's kTLS switch is global too, it's only ever turned on
+  static bool ktls_ready = false;
+  SSL_CTX *ssl_ctx;
+
   SSL_load_error_strings();
   SSL_library_init();
   OpenSSL_add_all_algorithms();
 
-  accept_ctx.ssl_ctx = SSL_CTX_new(SSLv23_server_method());
-  SSL_CTX_set_options(accept_ctx.ssl_ctx, SSL_OP_NO_SSLv2);
+  ssl_ctx = *out = SSL_CTX_new(SSLv23_server_method());
+  SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_SSLv2);
 
   if (use_memcached == true) {
-    accept_ctx.libmemcached_receiver = &libmemcached_receiver;
-    h2o_accept_setup_memcached_ssl_resumption(
-        h2o_memcached_create_context(ip, 11211, 0, 1, "h2o:ssl-resumption:"),
-        86400);
-    h2o_socket_ssl_async_resumption_setup_ctx(accept_ctx.ssl_ctx);
+    if (memcached_ready == false) {
+      h2o_accept_setup_memcached_ssl_resumption(
+          h2o_memcached_create_context(ip, 11211, 0, 1,
+                                       "h2o:ssl-resumption:"),
+          86400);
+      memcached_ready = true;
+    }
+    h2o_socket_ssl_async_resumption_setup_ctx(ssl_ctx);
+  }
+
+  if (use_tickets == true) {
+    if (tickets_ready == false) {
+      if (start_session_tickets(uv_default_loop(), ticket_keyfile) != 0)
+        return -1;
+      tickets_ready = true;
+    }
+    setup_session_tickets(ssl_ctx);
+  } else {
+    SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_TICKET);
+  }
+  count_handshakes(ssl_ctx);
+
+  if (use_ktls == true && ktls_ready == false) {
+    if (enable_ktls() == true)
+      printf("toast: kernel TLS offload enabled\n");
+    ktls_ready = true;
   }
 
 #ifdef SSL_CTX_set_ecdh_auto
-  SSL_CTX_set_ecdh_auto(accept_ctx.ssl_ctx, 1);
+  SSL_CTX_set_ecdh_auto(ssl_ctx, 1);
 #endif
 
   /* load certificate and private key */
-  if (SSL_CTX_use_certificate_chain_file(accept_ctx.ssl_ctx, cert_file) != 1) {
+  if (SSL_CTX_use_certificate_chain_file(ssl_ctx, cert_file) != 1) {
     fprintf(
         stderr,
         "an error occurred while trying to load server certificate file:%s\n",
         cert_file);
     return -1;
   }
-  if (SSL_CTX_use_PrivateKey_file(accept_ctx.ssl_ctx, key_file,
-                                  SSL_FILETYPE_PEM) != 1) {
+  if (SSL_CTX_use_PrivateKey_file(ssl_ctx, key_file, SSL_FILETYPE_PEM) != 1) {
     fprintf(stderr,
             "an error occurred while trying to load private key file:%s\n",
             key_file);
     return -1;
   }
 
-  if (SSL_CTX_set_cipher_list(accept_ctx.ssl_ctx, ciphers) != 1) {
+  if (SSL_CTX_set_cipher_list(ssl_ctx, ciphers) != 1) {
     fprintf(stderr, "ciphers could not be set: %s\n", ciphers);
     return -1;
   }
 
 /* setup protocol negotiation methods */
 #if H2O_USE_NPN
-  h2o_ssl_register_npn_protocols(accept_ctx.ssl_ctx, h2o_http2_npn_protocols);
+  h2o_ssl_register_npn_protocols(ssl_ctx, h2o_http2_npn_protocols);
 #endif
 #if H2O_USE_ALPN
-  h2o_ssl_register_alpn_protocols(accept_ctx.ssl_ctx, h2o_http2_alpn_protocols);
+  h2o_ssl_register_alpn_protocols(ssl_ctx, h2o_http2_alpn_protocols);
 #endif
 
   return 0;
 }
 
-static int get_year(void) {
-  time_t time_container = time(NULL);
-  struct tm *time = localtime(&time_container);
-  return time->tm_year + 1900;
+static int get_index(h2o_handler_t *handler, h2o_req_t *req) {
+  send_page(req, get_snapshot(req)->pages, 200);
+  return 0;
 }
 
-static int not_found(h2o_handler_t *handler, h2o_req_t *req) {
-  h2o_generator_t generator = {NULL, NULL};
-
-  char path_buffer[1024];
-
-  Config server_config;
-  read_config(&server_config);
-  char *path = req->path.base;
-  strlcpy(path_buffer, server_config.site_root, 1024);
-  free_config(&server_config);
-
-  path_buffer[strlen(path_buffer) - 1] = '\0';
-  strlcat(path_buffer, path, 1024);
+// builds the host, handlers and TLS context of a snapshot
+static int setup_host(configSnapshot *snapshot) {
+  Config *server_config = &snapshot->config;
+  h2o_globalconf_t *config = &snapshot->globalconf;
+  listenerConfig *tcp_listener = first_tcp_listener(&server_config->network);
+  char index_path[1024];
 
-  strlcpy(path_buffer, strtok(path_buffer, " "), 1024);
-  strlcat(path_buffer, "index.html", 1024);
+  h2o_hostconf_t *hostconf = NULL;
+  h2o_pathconf_t *pathconf = NULL;
+  notFoundLookup *not_found = NULL;
 
-  printf("path_buffer: %s\n", path_buffer);
+  h2o_compress_register_configurator(config);
 
-  if (path_exist(path_buffer) != true) {
+  if ((snapshot->pages = load_pages(server_config->site_root)) == NULL)
     return -1;
-  }
 
-  char *html_buffer = malloc(1024);
-
-  sprintf(html_buffer,
-          "<title>Error 404</title>"
-          "<style>"
-          "body{font-family: sans-serif;}"
-          "h1{font-size: 1.5em;}"
-          "p{font-size: 1em; margin-bottom: 0.5em;}"
-          "sub{font-size: 0.7em;}"
-          "</style>"
-          "<h1>Error 404</h1>"
-          "<p>Not found</p>"
-          "<sub><a href=\"https://git.enstore.cloud/enstore.cloud/toast\" "
-          "target=\"_blank\">toast</a>, %d</sub>",
-          get_year());
-
-  h2o_iovec_t body = h2o_strdup(&req->pool, html_buffer, strlen(html_buffer));
-  free(html_buffer);
-
-  req->res.status = 404;
-  req->res.reason = "Not Found";
-  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
-                 H2O_STRLIT("text/html; charset=utf-8"));
-  h2o_start_response(req, &generator);
-  h2o_send(req, &body, 1, 1);
+  hostconf = h2o_config_register_host(
+      config, h2o_iovec_init(H2O_STRLIT("default")), 65535);
 
-  return 0;
-}
+#ifdef API_H_IMPLEMENTATION
+  pathconf = register_handler(hostconf, "/api/serverinfo", get_server_info);
+  attach_loggers(pathconf, RouteApi, server_config);
 
-static int get_index(h2o_handler_t *handler, h2o_req_t *req) {
-  h2o_generator_t generator = {NULL, NULL};
-
-  char *html_buffer = malloc(1024);
-  sprintf(html_buffer,
-          "<title>welcome to toast!</title>"
-          "<style>"
-          "body{font-family: sans-serif;}"
-          "h1{font-size: 1.5em;}"
-          "p{font-size: 1em; margin-bottom: 0.5em;}"
-          "sub{font-size: 0.7em;}"
-          "</style>"
-          "<h1>error 404</h1>"
-          "<p>not found</p>"
-          "<sub><a href=\"https://git.enstore.cloud/enstore.cloud/toast\" "
-          "target=\"_blank\">toast</a>, %d</sub>",
-          get_year());
-  sprintf(html_buffer,
-          "<title>Welcome to toast!</title>"
-          "<style>"
-          "body{font-family: sans-serif;}"
-          "h1{font-size: 1.5em;}"
-          "p{font-size: 1em; margin-bottom: 0.5em;}"
-          "sub{font-size: 0.7em;}"
-          "</style>"
-          "<h1>Welcome to toast!</h1>"
-          "<p>If you are seeing this, it means that toast is working "
-          "but might be missing files in site root!</p>"
-          "<sub><a href=\"https://git.enstore.cloud/enstore.cloud/toast\" "
-          "target=\"_blank\">toast</a>, %d</sub>",
-          get_year());
-  req->res.status = 200;
-  req->res.reason = "OK";
-
-  h2o_iovec_t body = h2o_strdup(&req->pool, html_buffer, strlen(html_buffer));
-  free(html_buffer);
-
-  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
-                 H2O_STRLIT("text/html; charset=utf-8"));
-  h2o_start_response(req, &generator);
-  h2o_send(req, &body, 1, 1);
+  pathconf = register_handler(hostconf, "/api/uptime", get_uptime);
+  attach_loggers(pathconf, RouteApi, server_config);
 
-  return 0;
-}
+  pathconf = register_handler(hostconf, "/api/workers", get_workers_info);
+  attach_loggers(pathconf, RouteApi, server_config);
 
-int main(int argc, char **argv) {
-  Config server_config = {0};
-  char index_path[1024];
+  pathconf = register_handler(hostconf, "/api/cache", get_cache_info);
+  attach_loggers(pathconf, RouteApi, server_config);
 
-  time_t time_container = time(NULL);
-  struct tm *time = localtime(&time_container);
-  char log_fname[28] = {0};
+  pathconf = register_handler(hostconf, "/api/cv", get_cv);
+  attach_loggers(pathconf, RouteApi, server_config);
 
-  uv_loop_t loop;
-  h2o_access_log_filehandle_t *log2file = NULL;
-  h2o_access_log_filehandle_t *logfh = NULL;
-  h2o_hostconf_t *hostconf = NULL;
-  h2o_pathconf_t *pathconf = NULL;
+  pathconf = register_handler(hostconf, "/api/metrics", get_metrics);
+  attach_loggers(pathconf, RouteApi, server_config);
 
-  snprintf(log_fname, 28, "./logs/toast-%d-%02d-%02d.log", time->tm_year + 1900,
-           time->tm_mon + 1, time->tm_mday);
+  pathconf = register_handler(hostconf, "/api/lag", get_lag);
+  attach_loggers(pathconf, RouteApi, server_config);
+#endif
+  sprintf(index_path, "%s/index.html", server_config->site_root);
 
-  if (read_config(&server_config) != 0) {
-    init_config(&server_config);
-    write_config(&server_config);
-  }
+  if (server_config->pack == NULL && path_exist(index_path) == false) {
+    pathconf = register_handler(hostconf, "/", get_index);
+    attach_loggers(pathconf, RouteStatic, server_config);
+  } else {
+    pathconf = h2o_config_register_path(hostconf, "/", 0);
 
-  switch (server_config.log_type) {
-  case Both:
-    if (path_exist("./logs/") == false)
-      make_dir("./logs/");
-    log2file =
-        h2o_access_log_open_handle(log_fname, NULL, H2O_LOGCONF_ESCAPE_APACHE);
-    logfh = h2o_access_log_open_handle("/dev/stdout", NULL,
-                                       H2O_LOGCONF_ESCAPE_APACHE);
-    break;
-  case File:
-    if (path_exist("./logs/") == false)
-      make_dir("./logs/");
-    log2file =
-        h2o_access_log_open_handle(log_fname, NULL, H2O_LOGCONF_ESCAPE_APACHE);
-    break;
-
-  case Console:
-    logfh = h2o_access_log_open_handle("/dev/stdout", NULL,
-                                       H2O_LOGCONF_ESCAPE_APACHE);
-    break;
+    // a reload maps the pack again, so a rebuilt one is swapped in whole
+    if (server_config->pack != NULL &&
+        register_pack(pathconf, server_config->pack) != 0)
+      return -1;
+
+    // known 404s answer before anything looks at the disk
+    not_found = register_missing_lookup(
+        pathconf, server_config->site_root,
+        server_config->cache.enabled ? server_config->cache.not_found_entries
+                                     : 0,
+        snapshot->pages);
+
+    bool precompressed =
+        server_config->compression.precompress == true &&
+        precompress_site(server_config->site_root,
+                         server_config->compression.min_size) == 0;
+
+    // after precompress_site, so the variants it wrote get hashed too
+    siteHashes *hashes = NULL;
+    if (server_config->http_cache.content_etags == true &&
+        (hashes = hash_site(server_config->site_root)) == NULL)
+      return -1;
+
+    // cache hits are served first, precompressed variants then go to disk
+    if (server_config->cache.enabled == true)
+      register_filecache(pathconf, server_config->site_root,
+                         server_config->cache.max_bytes,
+                         server_config->cache.max_file_size);
+    if (precompressed)
+      register_precompressed(pathconf, server_config->site_root,
+                             server_config, hashes);
+    register_static_headers(pathconf, server_config->site_root, hashes);
+    h2o_mimemap_t *mimemap = create_mimemap(server_config);
+    h2o_file_register(pathconf, server_config->site_root, NULL, mimemap,
+                      hashes ? H2O_FILE_FLAG_NO_ETAG : 0);
+    h2o_mem_release_shared(mimemap);
+    register_not_found(pathconf, not_found);
+    attach_loggers(pathconf, RouteStatic, server_config);
   }
 
-  signal(SIGPIPE, SIG_IGN);
-
-  if (parse_args(&argc, &argv, &server_config) != 0) {
-    fprintf(stderr, "toast: failed parsing args, something is very wrong..\n");
-    free_config(&server_config);
+  if (server_config->ssl.enabled == true &&
+      setup_ssl(&snapshot->ssl_ctx, server_config->ssl.cert_path,
+                server_config->ssl.key_path,
+                "DEFAULT:!MD5:!DSS:!DES:!RC4:!RC2:!SEED:!IDEA:!"
+                "NULL:!ADH:!EXP:!SRP:!PSK",
+                tcp_listener ? tcp_listener->address : "127.0.0.1",
+                server_config->ssl.mem_cached,
+                server_config->ssl.session_tickets,
+                server_config->ssl.ticket_keyfile,
+                server_config->ssl.ktls) != 0)
     return -1;
-  }
 
-  h2o_config_init(&config);
-  h2o_compress_register_configurator(&config);
+  return 0;
+}
 
-  hostconf = h2o_config_register_host(
-      &config, h2o_iovec_init(H2O_STRLIT("default")), 65535);
+static bool same_string(const char *a, const char *b) {
+  return a == b || (a && b && strcmp(a, b) == 0);
+}
 
-#ifdef API_H_IMPLEMENTATION
-  pathconf = register_handler(hostconf, "/api/serverinfo", get_server_info);
-  if (logfh)
-    h2o_access_log_register(pathconf, logfh);
+// listening sockets are opened once at startup, a reload can't change them
+static bool same_listeners(const networkConfig *a, const networkConfig *b) {
+  if (a->listener_count != b->listener_count)
+    return false;
+
+  for (size_t i = 0; i < a->listener_count; ++i) {
+    const listenerConfig *x = &a->listeners[i], *y = &b->listeners[i];
+
+    if (!same_string(x->address, y->address) ||
+        !same_string(x->path, y->path) || !same_string(x->owner, y->owner) ||
+        x->mode != y->mode || x->proxy_protocol != y->proxy_protocol ||
+        x->port != y->port ||
+        x->backlog != y->backlog || x->fastopen != y->fastopen ||
+        x->defer_accept != y->defer_accept || x->nodelay != y->nodelay ||
+        x->ipv6_only != y->ipv6_only || x->sndbuf != y->sndbuf ||
+        x->notsent_lowat != y->notsent_lowat)
+      return false;
+  }
 
-  if (log2file)
-    h2o_access_log_register(pathconf, log2file);
+  return true;
+}
 
-  pathconf = register_handler(hostconf, "/api/uptime", get_uptime);
-  if (logfh)
-    h2o_access_log_register(pathconf, logfh);
+static void on_sighup(uv_signal_t *handle, int signum) {
+  Config server_config = {0};
+  configSnapshot *snapshot = acquire_snapshot();
 
-  if (log2file)
-    h2o_access_log_register(pathconf, log2file);
+  if (read_config(&server_config) != 0) {
+    fprintf(stderr, "toast: failed to read config, keeping generation %u\n",
+            snapshot->generation);
+    release_snapshot(snapshot);
+    return;
+  }
 
-  pathconf = register_handler(hostconf, "/api/cv", get_cv);
-  if (logfh)
-    h2o_access_log_register(pathconf, logfh);
+  optind = 0;
+  if (parse_args(&saved_argc, &saved_argv, &server_config) != 0) {
+    free_config(&server_config);
+    release_snapshot(snapshot);
+    return;
+  }
 
-  if (log2file)
-    h2o_access_log_register(pathconf, log2file);
-#endif
-  sprintf(index_path, "%s/index.html", server_config.site_root);
+  if (!same_listeners(&server_config.network, &snapshot->config.network) ||
+      server_config.workers != snapshot->config.workers)
+    fprintf(stderr, "toast: listener and worker changes need a restart\n");
 
-  if (path_exist(index_path) == false) {
-    pathconf = register_handler(hostconf, "/", get_index);
-    if (logfh)
-      h2o_access_log_register(pathconf, logfh);
-    if (log2file)
-      h2o_access_log_register(pathconf, log2file);
-  } else {
-    pathconf = h2o_config_register_path(hostconf, "/", 0);
-    h2o_file_register(pathconf, server_config.site_root, NULL, NULL, 0);
-    if (logfh)
-      h2o_access_log_register(pathconf, logfh);
+  release_snapshot(snapshot);
 
-    if (log2file)
-      h2o_access_log_register(pathconf, log2file);
+  if ((snapshot = create_snapshot(&server_config, setup_host)) == NULL) {
+    fprintf(stderr, "toast: reload failed, keeping the current config\n");
+    return;
   }
 
-  pathconf = register_handler(hostconf, "/", not_found);
-  if (logfh)
-    h2o_access_log_register(pathconf, logfh);
+  publish_snapshot(snapshot);
+  set_access_log_target(&snapshot->config);
+  reload_workers();
+  printf("toast: reloaded config, generation %u\n", snapshot->generation);
+}
 
-  if (log2file)
-    h2o_access_log_register(pathconf, log2file);
+// the binary at argv[0] takes over the listeners, this process drains
+static void on_sigusr2(uv_signal_t *handle, int signum) {
+  configSnapshot *snapshot = acquire_snapshot();
 
-  if (server_config.compression.enabled == false)
-    goto NotCompress;
+  start_upgrade(handle->loop, saved_argv,
+                snapshot->config.network.drain_timeout);
+  release_snapshot(snapshot);
+}
 
-  h2o_compress_args_t ca = {
-      .gzip.quality = server_config.compression.quality,
-  };
+int main(int argc, char **argv) {
+  Config server_config = {0};
+  configSnapshot *snapshot = NULL;
+  uv_signal_t sighup, sigusr2;
 
-  if (server_config.compression.min_size != 0)
-    ca.min_size = server_config.compression.min_size;
+  if (read_config(&server_config) != 0) {
+    init_config(&server_config);
+    write_config(&server_config);
+  }
 
-  h2o_compress_register(pathconf, &ca);
-  if (logfh != NULL)
-    h2o_access_log_register(pathconf, logfh);
+  signal(SIGPIPE, SIG_IGN);
+
+  saved_argc = argc;
+  saved_argv = argv;
+  if (parse_args(&argc, &argv, &server_config) != 0) {
+    fprintf(stderr, "toast: failed parsing args, something is very wrong..\n");
+    free_config(&server_config);
+    return -1;
+  }
 
-  if (log2file != NULL)
-    h2o_access_log_register(pathconf, log2file);
+  // sockets handed down by an old process on SIGUSR2, before anything binds
+  read_inherited_fds();
 
-NotCompress:
-  uv_loop_init(&loop);
-  h2o_context_init(&ctx, &loop, &config);
+  init_clock();
+  start_clock(uv_default_loop());
+  init_static_responses();
 
-  if (server_config.ssl.mem_cached == true)
-    h2o_multithread_register_receiver(ctx.queue, &libmemcached_receiver,
-                                      h2o_memcached_receiver);
+  if (start_access_log() != 0) {
+    free_config(&server_config);
+    return -1;
+  }
 
-  if (server_config.ssl.enabled == true &&
-      setup_ssl(server_config.ssl.cert_path, server_config.ssl.key_path,
-                "DEFAULT:!MD5:!DSS:!DES:!RC4:!RC2:!SEED:!IDEA:!"
-                "NULL:!ADH:!EXP:!SRP:!PSK",
-                server_config.network.ip, server_config.ssl.mem_cached) != 0)
-    goto Error;
-
-  accept_ctx.ctx = &ctx;
-  accept_ctx.hosts = config.hosts;
-  config.server_name = h2o_iovec_init(H2O_STRLIT("toast"));
-
-  if (create_listener(server_config.network.ip, server_config.network.port) !=
-      0) {
-    fprintf(stderr, "failed to listen to %s:%u:%s\n", server_config.network.ip,
-            server_config.network.port, strerror(errno));
-    goto Error;
+  if ((snapshot = create_snapshot(&server_config, setup_host)) == NULL)
+    return -1;
+  publish_snapshot(snapshot);
+  set_access_log_target(&snapshot->config);
+
+  if (start_workers(&snapshot->config) != 0) {
+    fprintf(stderr, "failed to open the configured listeners\n");
+    return -1;
   }
+  // every worker is listening, the old process can stop accepting
+  finish_upgrade();
 
-  printf("toast: running on %s:%u\n", server_config.network.ip,
-         server_config.network.port);
-  free_config(&server_config);
-  init_start_date();
-  uv_run(ctx.loop, UV_RUN_DEFAULT);
+  for (size_t i = 0; i < snapshot->config.network.listener_count; ++i) {
+    listenerConfig *listener = &snapshot->config.network.listeners[i];
 
-Error:
-  free_config(&server_config);
-  return -1;
+    if (listener->path)
+      printf("toast: listening on %s\n", listener->path);
+    else
+      printf("toast: listening on %s port %u\n", listener->address,
+             listener->port);
+  }
+  printf("toast: running with %u workers\n",
+         snapshot->config.workers ? snapshot->config.workers
+                                  : default_worker_count());
+
+  // the main thread only waits for reload and upgrade requests
+  uv_signal_init(uv_default_loop(), &sighup);
+  uv_signal_start(&sighup, on_sighup, SIGHUP);
+  uv_signal_init(uv_default_loop(), &sigusr2);
+  uv_signal_start(&sigusr2, on_sigusr2, SIGUSR2);
+  uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+
+  join_workers();
+  return 0;
 }
@@ -0,0 +1,489 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <h2o.h>
+#include <zstd.h>
+
+#include <accesslog.h>
+#include <clock.h>
+#include <config.h>
+#include <file.h>
+
+#define LOG_FORMAT                                                             \
+  "%h %l %u %t \"%r\" %s %b \"%{Referer}i\" \"%{User-agent}i\""
+#define LOG_DIR "./logs/"
+#define RING_SIZE (1 << 20) // per thread, power of two
+#define BATCH_IOVECS 64
+
+// single producer (the owning thread), single consumer (the writer)
+typedef struct logRing {
+  struct logRing *next;
+  atomic_size_t head;
+  atomic_size_t tail;
+  atomic_size_t written;
+  atomic_size_t dropped;
+  char buf[RING_SIZE];
+} logRing;
+
+typedef struct {
+  struct iovec iov[BATCH_IOVECS];
+  size_t iov_count;
+  logRing *rings[BATCH_IOVECS / 2];
+  size_t heads[BATCH_IOVECS / 2];
+  size_t ring_count;
+} logBatch;
+
+typedef struct {
+  int log_type;
+  bool compress;
+  int file_fd;
+  char file_path[64];
+  time_t next_rotation;
+  time_t retry_at;  // when to try opening a file that failed to open
+  bool open_failed; // reported once, until it opens again
+} logWriter;
+
+static h2o_logconf_t *logconf = NULL;
+static pthread_t writer_thread;
+static bool writer_started = false;
+static atomic_bool stopping = false; // write out what's left, then return
+
+// rings are only ever prepended, and live as long as the process
+static _Atomic(logRing *) rings = NULL;
+static _Thread_local logRing *this_ring = NULL;
+
+static pthread_mutex_t target_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_bool target_changed = false;
+static int target_log_type = Console;
+static bool target_compress = false;
+
+// the writer sleeps until a line is pushed, or a second passes
+static pthread_mutex_t wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static atomic_bool writer_sleeping = false;
+
+static logRing *get_ring(void) {
+  logRing *ring;
+
+  if (this_ring)
+    return this_ring;
+
+  if ((ring = calloc(1, sizeof(*ring))) == NULL)
+    return NULL;
+
+  ring->next = atomic_load(&rings);
+  while (!atomic_compare_exchange_weak(&rings, &ring->next, ring))
+    ;
+
+  return this_ring = ring;
+}
+
+/* pairs with the fence in wait_for_lines: either the writer sees the new
+ * head before it sleeps, or the pusher sees it sleeping */
+static void wake_writer(void) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!atomic_load_explicit(&writer_sleeping, memory_order_relaxed))
+    return;
+
+  pthread_mutex_lock(&wake_mutex);
+  pthread_cond_signal(&wake_cond);
+  pthread_mutex_unlock(&wake_mutex);
+}
+
+static void push_line(logRing *ring, const char *line, size_t len) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  size_t off = head & (RING_SIZE - 1);
+  size_t first = RING_SIZE - off;
+
+  // never wait on the writer, a full ring loses the line
+  if (len > RING_SIZE - (head - tail)) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  if (first > len)
+    first = len;
+  memcpy(ring->buf + off, line, first);
+  memcpy(ring->buf, line + first, len - first);
+
+  atomic_store_explicit(&ring->head, head + len, memory_order_release);
+  atomic_fetch_add_explicit(&ring->written, 1, memory_order_relaxed);
+  wake_writer();
+}
+
+static void log_access(h2o_logger_t *self, h2o_req_t *req) {
+  char buf[4096];
+  size_t len = sizeof(buf);
+  logRing *ring = get_ring();
+  char *line;
+
+  if (!ring)
+    return;
+
+  line = h2o_log_request(logconf, req, &len, buf);
+  push_line(ring, line, len);
+  if (line != buf)
+    free(line);
+}
+
+static int write_all(int fd, struct iovec *iov, size_t iov_count) {
+  while (iov_count > 0) {
+    ssize_t r = writev(fd, iov, iov_count);
+
+    if (r == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+
+    while (iov_count > 0 && (size_t)r >= iov->iov_len) {
+      r -= iov->iov_len;
+      ++iov;
+      --iov_count;
+    }
+    if (iov_count > 0) {
+      iov->iov_base = (char *)iov->iov_base + r;
+      iov->iov_len -= r;
+    }
+  }
+
+  return 0;
+}
+
+static void flush_batch(logWriter *writer, logBatch *batch) {
+  struct iovec iov[BATCH_IOVECS];
+  int fds[2];
+  size_t fd_count = 0;
+
+  if (writer->log_type != File)
+    fds[fd_count++] = STDOUT_FILENO;
+  if (writer->log_type != Console && writer->file_fd != -1)
+    fds[fd_count++] = writer->file_fd;
+
+  for (size_t i = 0; i < fd_count; ++i) {
+    // writev may be partial, so every target works on its own copy
+    memcpy(iov, batch->iov, batch->iov_count * sizeof(*iov));
+    if (write_all(fds[i], iov, batch->iov_count) != 0)
+      fprintf(stderr, "access log: write failed: %s\n", strerror(errno));
+  }
+
+  for (size_t i = 0; i < batch->ring_count; ++i)
+    atomic_store_explicit(&batch->rings[i]->tail, batch->heads[i],
+                          memory_order_release);
+
+  batch->iov_count = 0;
+  batch->ring_count = 0;
+}
+
+static size_t drain(logWriter *writer) {
+  logBatch batch = {0};
+  size_t total = 0;
+
+  for (logRing *ring = atomic_load(&rings); ring; ring = ring->next) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t off = tail & (RING_SIZE - 1);
+    size_t len = head - tail;
+    size_t first = RING_SIZE - off;
+
+    if (len == 0)
+      continue;
+
+    if (first > len)
+      first = len;
+    batch.iov[batch.iov_count++] =
+        (struct iovec){.iov_base = ring->buf + off, .iov_len = first};
+    if (len > first)
+      batch.iov[batch.iov_count++] =
+          (struct iovec){.iov_base = ring->buf, .iov_len = len - first};
+
+    batch.rings[batch.ring_count] = ring;
+    batch.heads[batch.ring_count++] = head;
+    total += len;
+
+    if (batch.iov_count + 2 > BATCH_IOVECS)
+      flush_batch(writer, &batch);
+  }
+
+  if (batch.iov_count > 0)
+    flush_batch(writer, &batch);
+
+  return total;
+}
+
+static void *compress_log(void *arg) {
+  char *path = arg;
+  char zst_path[1024], tmp_path[1024];
+  size_t in_size = ZSTD_CStreamInSize(), out_size = ZSTD_CStreamOutSize();
+  char *in_buf = malloc(in_size), *out_buf = malloc(out_size);
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+  FILE *in = fopen(path, "rb"), *out = NULL;
+  bool last = false;
+
+  snprintf(zst_path, 1024, "%s.zst", path);
+  snprintf(tmp_path, 1024, "%s.zst.tmp", path);
+
+  if (!in_buf || !out_buf || !cctx || !in ||
+      (out = fopen(tmp_path, "wb")) == NULL)
+    goto Error;
+
+  while (!last) {
+    size_t read = fread(in_buf, 1, in_size, in);
+    ZSTD_inBuffer input = {in_buf, read, 0};
+    bool finished = false;
+
+    if (ferror(in))
+      goto Error;
+    last = read < in_size;
+
+    while (!finished) {
+      ZSTD_outBuffer output = {out_buf, out_size, 0};
+      size_t remaining = ZSTD_compressStream2(cctx, &output, &input,
+                                              last ? ZSTD_e_end
+                                                   : ZSTD_e_continue);
+      if (ZSTD_isError(remaining) ||
+          fwrite(out_buf, 1, output.pos, out) != output.pos)
+        goto Error;
+      finished = last ? remaining == 0 : input.pos == input.size;
+    }
+  }
+
+  if (fclose(out) != 0 || rename(tmp_path, zst_path) != 0) {
+    out = NULL;
+    goto Error;
+  }
+  out = NULL;
+  unlink(path);
+  goto Done;
+
+Error:
+  fprintf(stderr, "access log: failed to compress %s\n", path);
+  if (out)
+    fclose(out);
+  unlink(tmp_path);
+Done:
+  if (in)
+    fclose(in);
+  ZSTD_freeCCtx(cctx);
+  free(in_buf);
+  free(out_buf);
+  free(path);
+  return NULL;
+}
+
+static void close_log_file(logWriter *writer, bool rotated) {
+  pthread_t thread;
+  char *path;
+
+  if (writer->file_fd == -1)
+    return;
+
+  close(writer->file_fd);
+  writer->file_fd = -1;
+
+  // compression runs on its own so the rings keep draining
+  if (!rotated || !writer->compress ||
+      (path = strdup(writer->file_path)) == NULL)
+    return;
+  if (pthread_create(&thread, NULL, compress_log, path) != 0) {
+    free(path);
+    return;
+  }
+  pthread_detach(thread);
+}
+
+static bool has_lines(void) {
+  for (logRing *ring = atomic_load(&rings); ring; ring = ring->next)
+    if (atomic_load_explicit(&ring->head, memory_order_relaxed) !=
+        atomic_load_explicit(&ring->tail, memory_order_relaxed))
+      return true;
+  return false;
+}
+
+// holding: there are lines, but nowhere to write them until the file opens
+static void wait_for_lines(bool holding) {
+  struct timespec deadline;
+
+  // rotation, drop reports and reopening the file still get their tick
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 1;
+
+  pthread_mutex_lock(&wake_mutex);
+  atomic_store_explicit(&writer_sleeping, true, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  if ((holding || !has_lines()) && !atomic_load(&target_changed) &&
+      !atomic_load(&stopping))
+    pthread_cond_timedwait(&wake_cond, &wake_mutex, &deadline);
+  atomic_store_explicit(&writer_sleeping, false, memory_order_relaxed);
+  pthread_mutex_unlock(&wake_mutex);
+}
+
+static void open_log_file(logWriter *writer) {
+  time_t now = time(NULL);
+  struct tm local_time;
+
+  localtime_r(&now, &local_time);
+  snprintf(writer->file_path, sizeof(writer->file_path),
+           LOG_DIR "toast-%d-%02d-%02d.log", local_time.tm_year + 1900,
+           local_time.tm_mon + 1, local_time.tm_mday);
+
+  local_time.tm_mday += 1;
+  local_time.tm_hour = local_time.tm_min = local_time.tm_sec = 0;
+  local_time.tm_isdst = -1;
+  writer->next_rotation = mktime(&local_time);
+
+  if (path_exist(LOG_DIR) == false)
+    make_dir(LOG_DIR);
+
+  writer->file_fd = open(writer->file_path,
+                         O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (writer->file_fd != -1) {
+    if (writer->open_failed)
+      fprintf(stderr, "access log: opened %s, writing again\n",
+              writer->file_path);
+    writer->open_failed = false;
+    return;
+  }
+
+  // lines wait in the rings meanwhile, and count as drops once they're full
+  if (!writer->open_failed)
+    fprintf(stderr, "access log: failed to open %s, retrying: %s\n",
+            writer->file_path, strerror(errno));
+  writer->open_failed = true;
+  writer->retry_at = now + 1;
+}
+
+static void update_target(logWriter *writer) {
+  if (!atomic_exchange(&target_changed, false))
+    return;
+
+  pthread_mutex_lock(&target_mutex);
+  writer->log_type = target_log_type;
+  writer->compress = target_compress;
+  pthread_mutex_unlock(&target_mutex);
+
+  if (writer->log_type == Console) {
+    close_log_file(writer, false);
+    writer->open_failed = false;
+  }
+}
+
+static void report_drops(size_t *reported) {
+  accessLogStats stats;
+
+  access_log_stats(&stats);
+  if (stats.dropped == *reported)
+    return;
+
+  fprintf(stderr, "access log: [%s] %zu lines dropped, rings were full\n",
+          clock_now()->log_date, stats.dropped - *reported);
+  *reported = stats.dropped;
+}
+
+static void *run_writer(void *arg) {
+  logWriter writer = {.log_type = Console, .file_fd = -1};
+  size_t reported = 0;
+  time_t last_report = 0;
+
+  while (1) {
+    time_t now = clock_now()->wall;
+    bool stop = atomic_load(&stopping);
+    bool holding;
+
+    update_target(&writer);
+
+    if (writer.log_type != Console && writer.file_fd == -1 &&
+        (now >= writer.retry_at || stop))
+      open_log_file(&writer);
+
+    // lines queued before midnight still land in the old file
+    if (writer.file_fd != -1 && now >= writer.next_rotation) {
+      drain(&writer);
+      close_log_file(&writer, true);
+      open_log_file(&writer);
+    }
+
+    if (now != last_report) {
+      report_drops(&reported);
+      last_report = now;
+    }
+
+    // a file-only log keeps its lines until the file opens
+    holding = writer.log_type == File && writer.file_fd == -1;
+    if (stop) {
+      while (!holding && drain(&writer) != 0)
+        ;
+      break;
+    }
+    if (holding || drain(&writer) == 0)
+      wait_for_lines(holding);
+  }
+
+  close_log_file(&writer, false);
+  return NULL;
+}
+
+int start_access_log(void) {
+  char errbuf[256];
+
+  if ((logconf = h2o_logconf_compile(LOG_FORMAT, H2O_LOGCONF_ESCAPE_APACHE,
+                                     errbuf)) == NULL) {
+    fprintf(stderr, "access log: %s\n", errbuf);
+    return -1;
+  }
+
+  if (pthread_create(&writer_thread, NULL, run_writer, NULL) != 0) {
+    fprintf(stderr, "access log: failed to start writer thread\n");
+    return -1;
+  }
+
+  writer_started = true;
+  return 0;
+}
+
+void stop_access_log(void) {
+  if (!writer_started)
+    return;
+
+  atomic_store(&stopping, true);
+  wake_writer();
+  pthread_join(writer_thread, NULL);
+  writer_started = false;
+}
+
+void set_access_log_target(Config *config) {
+  pthread_mutex_lock(&target_mutex);
+  target_log_type = config->log_type;
+  target_compress = config->log_compress;
+  pthread_mutex_unlock(&target_mutex);
+
+  atomic_store(&target_changed, true);
+  wake_writer();
+}
+
+void register_access_log(h2o_pathconf_t *pathconf) {
+  h2o_logger_t *logger = h2o_create_logger(pathconf, sizeof(*logger));
+  logger->log_access = log_access;
+}
+
+void access_log_stats(accessLogStats *stats) {
+  stats->written = 0;
+  stats->dropped = 0;
+
+  for (logRing *ring = atomic_load(&rings); ring; ring = ring->next) {
+    stats->written +=
+        atomic_load_explicit(&ring->written, memory_order_relaxed);
+    stats->dropped +=
+        atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+  }
+}
@@ -15,23 +15,51 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <jansson.h>
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <netinet/in.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <time.h>
-#include <zlib.h>
 
+#include <accesslog.h>
 #include <api.h>
+#include <apibody.h>
+#include <async.h>
+#include <clock.h>
+#include <filecache.h>
+#include <fileio.h>
 #include <h2o.h>
-#include <h2o/version.h>
-#include <meta.h>
-
-static struct tm start_date;
-void init_start_date(void) {
-  time_t now = time(NULL);
-  localtime_r(&now, &start_date);
-}
+#include <jsonwriter.h>
+#include <lag.h>
+#include <metrics.h>
+#include <mime.h>
+#include <notfound.h>
+#include <pages.h>
+#include <snapshot.h>
+#include <tickets.h>
+#include <worker.h>
+
+#define MAX_CV_SIZE (16 * 1024 * 1024)
+
+// rendered at most once per second and thread, shared with the requests
+// still sending it
+typedef struct {
+  uint64_t uptime; // whole seconds
+  char *body;
+  size_t len;
+  char etag[48];
+} uptimeResponse;
+
+static h2o_mem_pool_t template_pool;
+static uptimeTemplate serverinfo_template;
+static uptimeTemplate uptime_template;
+static _Thread_local uptimeResponse serverinfo_response;
+static _Thread_local uptimeResponse uptime_response;
 
 static int is_leap_year(int year) {
   return (year % 4 == 0 && year % 100 != 0) || (year % 400 == 0);
@@ -44,10 +72,15 @@ static int days_in_month(int year, int month) {
   return days[month];
 }
 
-static char *format_uptime(time_t current_time, struct tm start_date) {
-  char *bufptr = malloc(48);
-  struct tm end_date;
-  localtime_r(&current_time, &end_date);
+/* the calendar is walked from the start date, but the end is the start
+ * plus monotonic uptime so changing the system time doesn't skew it */
+static void format_uptime(char (*buf)[48], uint64_t uptime) {
+  time_t start_time = started_at();
+  time_t end_time = start_time + (time_t)uptime;
+  struct tm start_date, end_date;
+
+  localtime_r(&start_time, &start_date);
+  localtime_r(&end_time, &end_date);
 
   int years = end_date.tm_year - start_date.tm_year;
   int months = end_date.tm_mon - start_date.tm_mon + years * 12;
@@ -74,34 +107,137 @@ static char *format_uptime(time_t current_time, struct tm start_date) {
     --days;
   }
 
-  snprintf(bufptr, 48, "%dm %dd %02d:%02d:%02d", months, days, hours, minutes,
+  snprintf(*buf, 48, "%dm %dd %02d:%02d:%02d", months, days, hours, minutes,
            seconds);
+}
+
+void init_static_responses(void) {
+  h2o_mem_init_pool(&template_pool);
+  build_serverinfo_template(&serverinfo_template, &template_pool);
+  build_uptime_template(&uptime_template, &template_pool);
+}
+
+static uptimeResponse *refresh_response(uptimeTemplate *template,
+                                        uptimeResponse *response) {
+  uint64_t uptime = uptime_ms() / 1000;
+  char uptime_buf[48];
+
+  if (response->body && response->uptime == uptime)
+    return response;
+
+  format_uptime(&uptime_buf, uptime);
+
+  // requests still sending the previous body hold their own reference
+  if (response->body)
+    h2o_mem_release_shared(response->body);
+  response->body = render_uptime_body(template, uptime_buf, &response->len);
+
+  snprintf(response->etag, sizeof(response->etag), "\"%016" PRIx64 "-%lld\"",
+           template->hash, (long long)uptime);
+  response->uptime = uptime;
+
+  return response;
+}
+
+static int send_uptime_response(h2o_req_t *req, uptimeTemplate *template,
+                                uptimeResponse *response) {
+  static h2o_generator_t generator = {NULL, NULL};
+  size_t etag_len;
+  ssize_t header_index;
+
+  response = refresh_response(template, response);
+  etag_len = strlen(response->etag);
+
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_ETAG, NULL,
+                 response->etag, etag_len);
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CACHE_CONTROL, NULL,
+                 H2O_STRLIT("public, max-age=1"));
+
+  header_index = h2o_find_header(&req->headers, H2O_TOKEN_IF_NONE_MATCH, -1);
+  if (header_index != -1 &&
+      h2o_strstr(req->headers.entries[header_index].value.base,
+                 req->headers.entries[header_index].value.len, response->etag,
+                 etag_len) != SIZE_MAX) {
+    req->res.status = 304;
+    req->res.reason = "Not Modified";
+    h2o_start_response(req, &generator);
+    h2o_send(req, NULL, 0, H2O_SEND_STATE_FINAL);
+    return 0;
+  }
+
+  h2o_mem_link_shared(&req->pool, response->body);
+  h2o_iovec_t body = h2o_iovec_init(response->body, response->len);
+
+  req->res.status = 200;
+  req->res.reason = "OK";
+
+  h2o_iovec_t type = mime_for_extension(NULL, H2O_STRLIT("json"));
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
+                 type.base, type.len);
+  h2o_start_response(req, &generator);
+  h2o_send(req, &body, 1, 1);
 
-  return bufptr;
+  return 0;
 }
 
-static char *get_uptime_str(void) {
-  time_t current_time = time(NULL);
+static int send_json(h2o_req_t *req, jsonWriter *writer) {
+  static h2o_generator_t generator = {NULL, NULL};
+  h2o_iovec_t body = jw_finish(writer);
+
+  req->res.status = 200;
+  req->res.reason = "OK";
+
+  h2o_iovec_t type = mime_for_extension(NULL, H2O_STRLIT("json"));
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
+                 type.base, type.len);
+  h2o_start_response(req, &generator);
+  h2o_send(req, &body, 1, 1);
 
-  char *uptime_buf = format_uptime(current_time, start_date);
-  return uptime_buf;
+  return 0;
+}
+
+static void free_body(void *ref) { free(*(char **)ref); }
+
+static void send_cv(h2o_req_t *req, int err, h2o_iovec_t body,
+                    const struct stat *st, void *data) {
+  static h2o_generator_t generator = {NULL, NULL};
+  char **ref;
+
+  if (!req || err != 0) {
+    if (req)
+      send_page(req, get_snapshot(req)->pages, 404);
+    free(body.base);
+    return;
+  }
+
+  // the request holds the body from here on
+  ref = h2o_mem_alloc_shared(&req->pool, sizeof(*ref), free_body);
+  *ref = body.base;
+
+  req->res.status = 200;
+  req->res.reason = "OK";
+  req->res.content_length = body.len;
+  h2o_iovec_t type =
+      mime_for_extension(&get_snapshot(req)->config, H2O_STRLIT("pdf"));
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
+                 type.base, type.len);
+  h2o_start_response(req, &generator);
+  h2o_send(req, &body, 1, H2O_SEND_STATE_FINAL);
 }
 
 int get_cv(h2o_handler_t *self, h2o_req_t *req) {
-  char path[1024] = "./assets/cvs/";
+  char path[1024];
 
   if (!h2o_memis(req->method.base, req->method.len, H2O_STRLIT("GET")))
     return -1;
 
-  h2o_iovec_t mime_type;
-  mime_type = h2o_strdup(&req->pool, "application/pdf", SIZE_MAX);
-
   ssize_t header_index =
       h2o_find_header_by_str(&req->headers, H2O_STRLIT("language"), 0);
-  fprintf(stderr, "header index: %li\n", header_index);
   if (header_index == -1)
     return -1;
 
+  strlcpy(path, "./assets/cvs/", 1024);
+
   if (h2o_memis(req->headers.entries[header_index].value.base,
                 req->headers.entries[header_index].value.len,
                 H2O_STRLIT("Swedish")))
@@ -109,83 +245,364 @@ int get_cv(h2o_handler_t *self, h2o_req_t *req) {
   else
     strlcat(path, "CV_-_English.pdf", 1024);
 
-  req->res.status = 200;
-  req->res.reason = "OK";
-
-  h2o_file_send(req, req->res.status, req->res.reason, path, mime_type, 0);
-  return 0;
+  // the loop never waits on the disk for these
+  return read_file_async(req, path, MAX_CV_SIZE, send_cv, NULL);
 }
 
 int get_server_info(h2o_handler_t *self, h2o_req_t *req) {
-  static h2o_generator_t generator = {NULL, NULL};
-
-  json_t *root = json_object();
-  json_t *dependencies = json_object();
-  char *uptime_buf = get_uptime_str();
-
   if (!h2o_memis(req->method.base, req->method.len, H2O_STRLIT("GET")))
     return -1;
 
-  json_object_set_new(root, "name", json_string(__NAME__));
-  json_object_set_new(root, "description", json_string(__DESCRIPTION__));
-  json_object_set_new(root, "version", json_string(__PROJ_VERSION__));
-  json_object_set_new(root, "uptime", json_string(uptime_buf));
-
-  json_object_set_new(dependencies, "jansson_version",
-                      json_string(JANSSON_VERSION));
-  json_object_set_new(dependencies, "libh2o_version",
-                      json_string(H2O_LIBRARY_VERSION));
-  json_object_set_new(dependencies, "libuv_version",
-                      json_string(uv_version_string()));
-  json_object_set_new(dependencies, "zlib_version", json_string(ZLIB_VERSION));
-  json_object_set_new(dependencies, "openssl_version",
-                      json_string(OPENSSL_VERSION));
-
-  json_object_set_new(root, "dependencies", dependencies);
-
-  size_t size = json_dumpb(root, NULL, 0, JSON_INDENT(2));
-  if (size == 0) {
-    fprintf(stderr, "failed to dump json for uptime");
-    return -1;
+  return send_uptime_response(req, &serverinfo_template, &serverinfo_response);
+}
+
+int get_uptime(h2o_handler_t *self, h2o_req_t *req) {
+  return send_uptime_response(req, &uptime_template, &uptime_response);
+}
+
+int get_workers_info(h2o_handler_t *self, h2o_req_t *req) {
+  unsigned int count = 0;
+  workerCtx *workers = get_workers(&count);
+  jsonWriter writer;
+
+  jw_init(&writer, &req->pool, 64 + count * 80);
+  write_workers_body(&writer, workers, count);
+  return send_json(req, &writer);
+}
+
+int get_cache_info(h2o_handler_t *self, h2o_req_t *req) {
+  fileCacheStats *stats;
+  size_t count = filecache_stats(&req->pool, &stats);
+  jsonWriter writer;
+
+  jw_init(&writer, &req->pool, 64 + count * 128);
+  write_cache_body(&writer, stats, count);
+  return send_json(req, &writer);
+}
+
+static bool is_allowed_peer(const char *allowed, struct sockaddr *addr) {
+  struct in6_addr *addr6 = &((struct sockaddr_in6 *)addr)->sin6_addr;
+  struct in_addr v4;
+  struct in6_addr v6;
+
+  if (strncmp(allowed, "unix:", 5) == 0)
+    return addr->sa_family == AF_UNIX &&
+           strcmp(((struct sockaddr_un *)addr)->sun_path, allowed + 5) == 0;
+
+  if (inet_pton(AF_INET, allowed, &v4) == 1) {
+    if (addr->sa_family == AF_INET)
+      return ((struct sockaddr_in *)addr)->sin_addr.s_addr == v4.s_addr;
+    return addr->sa_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(addr6) &&
+           memcmp(&addr6->s6_addr[12], &v4, 4) == 0;
   }
 
-  char *buf = malloc(size);
-  (void)json_dumpb(root, buf, size, JSON_INDENT(2));
-  json_decref(root);
+  return addr->sa_family == AF_INET6 &&
+         inet_pton(AF_INET6, allowed, &v6) == 1 &&
+         IN6_ARE_ADDR_EQUAL(addr6, &v6);
+}
 
-  h2o_iovec_t body = h2o_strdup(&req->pool, buf, size);
-  free(buf);
-  free(uptime_buf);
+/* only peers listed in api.lag_allow. behind a local proxy every client has
+ * the proxy's address unless the listener reads a PROXY line, so that's
+ * what a Unix socket or loopback entry lets in */
+static bool is_lag_peer(h2o_req_t *req) {
+  const apiConfig *api = &get_snapshot(req)->config.api;
+  struct sockaddr_storage addr = {0};
+
+  if (api->lag_allow_count == 0 ||
+      req->conn->callbacks->get_peername(req->conn,
+                                         (struct sockaddr *)&addr) == 0)
+    return false;
+
+  for (size_t i = 0; i < api->lag_allow_count; ++i)
+    if (is_allowed_peer(api->lag_allow[i], (struct sockaddr *)&addr))
+      return true;
+  return false;
+}
 
-  req->res.status = 200;
-  req->res.reason = "OK";
+// other clients' paths and timings, only for whoever runs the server
+int get_lag(h2o_handler_t *self, h2o_req_t *req) {
+  unsigned int worker_count = 0;
+  loopLag *lags;
+  slowRequest slow[64];
+  size_t count, slow_count;
+  jsonWriter writer;
+
+  if (!is_lag_peer(req)) {
+    send_page(req, get_snapshot(req)->pages, 404);
+    return 0;
+  }
 
-  h2o_add_header(&req->pool, &req->headers, H2O_TOKEN_CONTENT_TYPE, NULL,
-                 H2O_STRLIT("application/json"));
-  h2o_start_response(req, &generator);
-  h2o_send(req, &body, 1, 1);
+  get_workers(&worker_count);
+  lags = h2o_mem_alloc_pool(&req->pool, *lags, worker_count ? worker_count : 1);
+  count = collect_lag(lags, worker_count);
+  slow_count = recent_slow_requests(slow, 64);
+
+  jw_init(&writer, &req->pool, 128 + count * 512 + slow_count * 256);
+  jw_object_begin(&writer);
+  jw_key(&writer, "workers");
+  jw_array_begin(&writer);
+
+  for (size_t i = 0; i < count; ++i) {
+    jw_object_begin(&writer);
+    jw_key(&writer, "index");
+    jw_integer(&writer, lags[i].worker);
+    jw_key(&writer, "samples");
+    jw_integer(&writer, lags[i].samples);
+    jw_key(&writer, "mean_usec");
+    jw_integer(&writer, lags[i].samples
+                            ? lags[i].lag_sum_usec / lags[i].samples
+                            : 0);
+    jw_key(&writer, "max_usec");
+    jw_integer(&writer, lags[i].max_usec);
+    jw_key(&writer, "slow_requests");
+    jw_integer(&writer, lags[i].slow_requests);
+
+    // only the buckets anything landed in
+    jw_key(&writer, "histogram");
+    jw_array_begin(&writer);
+    for (size_t j = 0; j < LATENCY_BUCKETS; ++j) {
+      if (lags[i].lag[j] == 0)
+        continue;
+      jw_object_begin(&writer);
+      jw_key(&writer, "le_usec");
+      jw_integer(&writer, latency_bucket_bound(j));
+      jw_key(&writer, "count");
+      jw_integer(&writer, lags[i].lag[j]);
+      jw_object_end(&writer);
+    }
+    jw_array_end(&writer);
+    jw_object_end(&writer);
+  }
 
-  return 0;
+  jw_array_end(&writer);
+  jw_key(&writer, "slow");
+  jw_array_begin(&writer);
+
+  for (size_t i = 0; i < slow_count; ++i) {
+    jw_object_begin(&writer);
+    jw_key(&writer, "worker");
+    jw_integer(&writer, slow[i].worker);
+    jw_key(&writer, "route");
+    jw_string(&writer, metrics_route_names[slow[i].route]);
+    jw_key(&writer, "path");
+    jw_string(&writer, slow[i].path);
+    jw_key(&writer, "usec");
+    jw_integer(&writer, slow[i].usec);
+    jw_key(&writer, "at");
+    jw_integer(&writer, slow[i].at);
+    jw_object_end(&writer);
+  }
+
+  jw_array_end(&writer);
+  jw_object_end(&writer);
+  return send_json(req, &writer);
 }
 
-int get_uptime(h2o_handler_t *self, h2o_req_t *req) {
-  static h2o_generator_t generator = {NULL, NULL};
+static void write_route_counter(FILE *out, const char *name, const char *help,
+                                routeMetrics *routes, size_t offset) {
+  fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+  for (int i = 0; i < ROUTE_COUNT; ++i)
+    fprintf(out, "%s{route=\"%s\"} %zu\n", name, metrics_route_names[i],
+            *(size_t *)((char *)&routes[i] + offset));
+}
 
-  json_t *root = json_object();
+static void write_async_wait(FILE *out, asyncStats *async) {
+  size_t cumulative = 0, waited = 0;
 
-  char *uptime_buf = get_uptime_str();
-  json_object_set_new(root, "uptime", json_string(uptime_buf));
+  for (size_t j = 0; j < LATENCY_BUCKETS; ++j)
+    waited += async->wait[j];
 
-  size_t size = json_dumpb(root, NULL, 0, JSON_INDENT(2));
-  if (size == 0) {
-    fprintf(stderr, "failed to dump json for uptime");
-    return -1;
+  fprintf(out, "# HELP toast_async_wait_seconds Time blocking tasks spent "
+               "queued.\n"
+               "# TYPE toast_async_wait_seconds histogram\n");
+  for (size_t j = 0; j < LATENCY_BUCKETS - 1; ++j) {
+    cumulative += async->wait[j];
+    fprintf(out, "toast_async_wait_seconds_bucket{le=\"%g\"} %zu\n",
+            latency_bucket_bound(j) / 1e6, cumulative);
   }
+  fprintf(out,
+          "toast_async_wait_seconds_bucket{le=\"+Inf\"} %zu\n"
+          "toast_async_wait_seconds_sum %g\n"
+          "toast_async_wait_seconds_count %zu\n",
+          waited, async->wait_sum_usec / 1e6, waited);
+}
+
+int get_metrics(h2o_handler_t *self, h2o_req_t *req) {
+  static h2o_generator_t generator = {NULL, NULL};
 
-  char *buf = malloc(size);
-  (void)json_dumpb(root, buf, size, JSON_INDENT(2));
-  json_decref(root);
-  free(uptime_buf);
+  routeMetrics routes[ROUTE_COUNT];
+  accessLogStats log_stats;
+  ticketStats ticket_stats;
+  notFoundStats not_found;
+  asyncStats async;
+  unsigned int count = 0;
+  workerCtx *workers = get_workers(&count);
+  char *buf = NULL;
+  size_t size = 0;
+  FILE *out;
+
+  collect_metrics(routes);
+  access_log_stats(&log_stats);
+  session_ticket_stats(&ticket_stats);
+  not_found_stats(&not_found);
+  async_stats(&async);
+
+  if ((out = open_memstream(&buf, &size)) == NULL) {
+    fprintf(stderr, "failed to open stream for metrics");
+    send_page(req, get_snapshot(req)->pages, 500);
+    return 0;
+  }
+
+  write_route_counter(out, "toast_requests_total", "Requests answered.",
+                      routes, offsetof(routeMetrics, requests));
+
+  fprintf(out, "# HELP toast_responses_total Responses by status class.\n"
+               "# TYPE toast_responses_total counter\n");
+  for (int i = 0; i < ROUTE_COUNT; ++i)
+    for (int j = 0; j < 5; ++j)
+      fprintf(out, "toast_responses_total{route=\"%s\",class=\"%dxx\"} %zu\n",
+              metrics_route_names[i], j + 1, routes[i].status[j]);
+
+  write_route_counter(out, "toast_request_body_bytes_total",
+                      "Request body bytes received.", routes,
+                      offsetof(routeMetrics, bytes_in));
+  write_route_counter(out, "toast_response_body_bytes_total",
+                      "Response body bytes sent.", routes,
+                      offsetof(routeMetrics, bytes_out));
+
+  fprintf(out, "# HELP toast_request_duration_seconds Time from request "
+               "start to response end.\n"
+               "# TYPE toast_request_duration_seconds histogram\n");
+  for (int i = 0; i < ROUTE_COUNT; ++i) {
+    size_t cumulative = 0;
+    for (size_t j = 0; j < LATENCY_BUCKETS - 1; ++j) {
+      cumulative += routes[i].latency[j];
+      fprintf(out,
+              "toast_request_duration_seconds_bucket{route=\"%s\",le=\"%g\"} "
+              "%zu\n",
+              metrics_route_names[i], latency_bucket_bound(j) / 1e6,
+              cumulative);
+    }
+    fprintf(out,
+            "toast_request_duration_seconds_bucket{route=\"%s\",le=\"+Inf\"} "
+            "%zu\n"
+            "toast_request_duration_seconds_sum{route=\"%s\"} %g\n"
+            "toast_request_duration_seconds_count{route=\"%s\"} %zu\n",
+            metrics_route_names[i], routes[i].requests, metrics_route_names[i],
+            routes[i].latency_sum_usec / 1e6, metrics_route_names[i],
+            routes[i].requests);
+  }
+
+  write_route_counter(out, "toast_compress_identity_bytes_total",
+                      "Body bytes before on-the-fly compression.", routes,
+                      offsetof(routeMetrics, identity_bytes));
+  write_route_counter(out, "toast_compress_encoded_bytes_total",
+                      "Body bytes after on-the-fly compression.", routes,
+                      offsetof(routeMetrics, encoded_bytes));
+
+  fprintf(out, "# HELP toast_compress_ratio Identity over encoded bytes.\n"
+               "# TYPE toast_compress_ratio gauge\n");
+  for (int i = 0; i < ROUTE_COUNT; ++i)
+    fprintf(out, "toast_compress_ratio{route=\"%s\"} %g\n",
+            metrics_route_names[i],
+            routes[i].encoded_bytes
+                ? (double)routes[i].identity_bytes / routes[i].encoded_bytes
+                : 0.0);
+
+  fprintf(out, "# HELP toast_connections_accepted_total Connections accepted "
+               "per worker.\n"
+               "# TYPE toast_connections_accepted_total counter\n");
+  for (unsigned int i = 0; i < count; ++i)
+    fprintf(out, "toast_connections_accepted_total{worker=\"%u\"} %zu\n",
+            workers[i].index,
+            atomic_load_explicit(&workers[i].accepted, memory_order_relaxed));
+
+  fprintf(out, "# HELP toast_connections Open connections per worker.\n"
+               "# TYPE toast_connections gauge\n");
+  for (unsigned int i = 0; i < count; ++i)
+    fprintf(
+        out, "toast_connections{worker=\"%u\"} %zu\n", workers[i].index,
+        atomic_load_explicit(&workers[i].live_conns, memory_order_relaxed));
+
+  fprintf(out, "# HELP toast_connections_free Closed connection objects kept "
+               "for reuse per worker.\n"
+               "# TYPE toast_connections_free gauge\n");
+  for (unsigned int i = 0; i < count; ++i)
+    fprintf(out, "toast_connections_free{worker=\"%u\"} %zu\n",
+            workers[i].index,
+            atomic_load_explicit(&workers[i].free_conn_count,
+                                 memory_order_relaxed));
+
+  fprintf(out, "# HELP toast_connections_peak Most connections open at once "
+               "per worker.\n"
+               "# TYPE toast_connections_peak gauge\n");
+  for (unsigned int i = 0; i < count; ++i)
+    fprintf(
+        out, "toast_connections_peak{worker=\"%u\"} %zu\n", workers[i].index,
+        atomic_load_explicit(&workers[i].peak_conns, memory_order_relaxed));
+
+  fprintf(out, "# HELP toast_accept_pauses_total Times a listener stopped "
+               "accepting at max_connections.\n"
+               "# TYPE toast_accept_pauses_total counter\n");
+  for (unsigned int i = 0; i < count; ++i)
+    fprintf(out, "toast_accept_pauses_total{worker=\"%u\"} %zu\n",
+            workers[i].index,
+            atomic_load_explicit(&workers[i].accept_pauses,
+                                 memory_order_relaxed));
+
+  fprintf(out,
+          "# HELP toast_async_queue_depth Blocking tasks waiting for a pool "
+          "thread.\n"
+          "# TYPE toast_async_queue_depth gauge\n"
+          "toast_async_queue_depth %zu\n"
+          "# HELP toast_async_running Blocking tasks on a pool thread.\n"
+          "# TYPE toast_async_running gauge\n"
+          "toast_async_running %zu\n"
+          "# HELP toast_async_tasks_total Blocking tasks finished.\n"
+          "# TYPE toast_async_tasks_total counter\n"
+          "toast_async_tasks_total{client=\"waiting\"} %zu\n"
+          "toast_async_tasks_total{client=\"gone\"} %zu\n",
+          async.queued, async.running, async.completed - async.abandoned,
+          async.abandoned);
+
+  write_async_wait(out, &async);
+
+  fprintf(out,
+          "# HELP toast_access_log_dropped_total Access log lines dropped.\n"
+          "# TYPE toast_access_log_dropped_total counter\n"
+          "toast_access_log_dropped_total %zu\n",
+          log_stats.dropped);
+
+  fprintf(out,
+          "# HELP toast_tls_handshakes_total Completed TLS handshakes.\n"
+          "# TYPE toast_tls_handshakes_total counter\n"
+          "toast_tls_handshakes_total{type=\"full\"} %zu\n"
+          "toast_tls_handshakes_total{type=\"resumed\"} %zu\n"
+          "# HELP toast_tls_ticket_key_rotations_total Session ticket keys "
+          "generated.\n"
+          "# TYPE toast_tls_ticket_key_rotations_total counter\n"
+          "toast_tls_ticket_key_rotations_total %zu\n",
+          ticket_stats.full, ticket_stats.resumed, ticket_stats.rotations);
+
+  fprintf(out,
+          "# HELP toast_notfound_cache_entries Paths remembered as missing.\n"
+          "# TYPE toast_notfound_cache_entries gauge\n"
+          "toast_notfound_cache_entries %zu\n"
+          "# HELP toast_notfound_cache_hits_total 404s answered without "
+          "looking at the disk.\n"
+          "# TYPE toast_notfound_cache_hits_total counter\n"
+          "toast_notfound_cache_hits_total %zu\n"
+          "# HELP toast_notfound_cache_flushes_total Times new files under "
+          "site_root emptied the cache.\n"
+          "# TYPE toast_notfound_cache_flushes_total counter\n"
+          "toast_notfound_cache_flushes_total %zu\n",
+          not_found.entries, not_found.hits, not_found.flushes);
+
+  if (fclose(out) != 0) {
+    free(buf);
+    send_page(req, get_snapshot(req)->pages, 500);
+    return 0;
+  }
 
   h2o_iovec_t body = h2o_strdup(&req->pool, buf, size);
   free(buf);
@@ -193,8 +610,8 @@ int get_uptime(h2o_handler_t *self, h2o_req_t *req) {
   req->res.status = 200;
   req->res.reason = "OK";
 
-  h2o_add_header(&req->pool, &req->headers, H2O_TOKEN_CONTENT_TYPE, NULL,
-                 H2O_STRLIT("application/json"));
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
+                 H2O_STRLIT("text/plain; version=0.0.4; charset=utf-8"));
   h2o_start_response(req, &generator);
   h2o_send(req, &body, 1, 1);
 
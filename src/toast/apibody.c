@@ -0,0 +1,143 @@
+#include <jansson.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <h2o.h>
+#include <h2o/version.h>
+
+#include <apibody.h>
+#include <jsonwriter.h>
+#include <meta.h>
+
+static uint64_t hash_body(const char *data, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= (unsigned char)data[i];
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+static void split_template(uptimeTemplate *template, jsonWriter *writer,
+                           size_t prefix_len, size_t suffix_at) {
+  h2o_iovec_t body = jw_finish(writer);
+
+  template->prefix = h2o_iovec_init(body.base, prefix_len);
+  template->suffix =
+      h2o_iovec_init(body.base + suffix_at, body.len - suffix_at);
+  template->hash = hash_body(body.base, body.len);
+}
+
+void build_serverinfo_template(uptimeTemplate *template, h2o_mem_pool_t *pool) {
+  jsonWriter writer;
+  size_t prefix_len, suffix_at;
+
+  jw_init(&writer, pool, 512);
+  jw_object_begin(&writer);
+  jw_key(&writer, "name");
+  jw_string(&writer, __NAME__);
+  jw_key(&writer, "description");
+  jw_string(&writer, __DESCRIPTION__);
+  jw_key(&writer, "version");
+  jw_string(&writer, __PROJ_VERSION__);
+  jw_key(&writer, "uptime");
+  prefix_len = writer.len + 1;
+  jw_string(&writer, "");
+  suffix_at = writer.len - 1;
+
+  jw_key(&writer, "dependencies");
+  jw_object_begin(&writer);
+  jw_key(&writer, "jansson_version");
+  jw_string(&writer, JANSSON_VERSION);
+  jw_key(&writer, "libh2o_version");
+  jw_string(&writer, H2O_LIBRARY_VERSION);
+  jw_key(&writer, "libuv_version");
+  jw_string(&writer, uv_version_string());
+  jw_key(&writer, "zlib_version");
+  jw_string(&writer, ZLIB_VERSION);
+  jw_key(&writer, "openssl_version");
+  jw_string(&writer, OpenSSL_version(OPENSSL_VERSION));
+  jw_object_end(&writer);
+  jw_object_end(&writer);
+  split_template(template, &writer, prefix_len, suffix_at);
+}
+
+void build_uptime_template(uptimeTemplate *template, h2o_mem_pool_t *pool) {
+  jsonWriter writer;
+  size_t prefix_len, suffix_at;
+
+  jw_init(&writer, pool, 64);
+  jw_object_begin(&writer);
+  jw_key(&writer, "uptime");
+  prefix_len = writer.len + 1;
+  jw_string(&writer, "");
+  suffix_at = writer.len - 1;
+  jw_object_end(&writer);
+  split_template(template, &writer, prefix_len, suffix_at);
+}
+
+char *render_uptime_body(const uptimeTemplate *template, const char *uptime,
+                         size_t *len) {
+  size_t uptime_len = strlen(uptime);
+  char *body, *out;
+
+  *len = template->prefix.len + uptime_len + template->suffix.len;
+  body = out = h2o_mem_alloc_shared(NULL, *len, NULL);
+  memcpy(out, template->prefix.base, template->prefix.len);
+  out += template->prefix.len;
+  memcpy(out, uptime, uptime_len);
+  out += uptime_len;
+  memcpy(out, template->suffix.base, template->suffix.len);
+  return body;
+}
+
+void write_workers_body(jsonWriter *writer, workerCtx *workers,
+                        unsigned int count) {
+  jw_object_begin(writer);
+  jw_key(writer, "workers");
+  jw_array_begin(writer);
+
+  for (unsigned int i = 0; i < count; ++i) {
+    jw_object_begin(writer);
+    jw_key(writer, "index");
+    jw_integer(writer, workers[i].index);
+    jw_key(writer, "accepted");
+    jw_integer(writer, atomic_load_explicit(&workers[i].accepted,
+                                            memory_order_relaxed));
+    jw_key(writer, "requests");
+    jw_integer(writer, atomic_load_explicit(&workers[i].requests,
+                                            memory_order_relaxed));
+    jw_object_end(writer);
+  }
+
+  jw_array_end(writer);
+  jw_object_end(writer);
+}
+
+void write_cache_body(jsonWriter *writer, const fileCacheStats *stats,
+                      size_t count) {
+  jw_object_begin(writer);
+  jw_key(writer, "caches");
+  jw_array_begin(writer);
+
+  for (size_t i = 0; i < count; ++i) {
+    jw_object_begin(writer);
+    jw_key(writer, "entries");
+    jw_integer(writer, stats[i].entries);
+    jw_key(writer, "bytes");
+    jw_integer(writer, stats[i].bytes);
+    jw_key(writer, "hits");
+    jw_integer(writer, stats[i].hits);
+    jw_key(writer, "misses");
+    jw_integer(writer, stats[i].misses);
+    jw_key(writer, "evictions");
+    jw_integer(writer, stats[i].evictions);
+    jw_object_end(writer);
+  }
+
+  jw_array_end(writer);
+  jw_object_end(writer);
+}
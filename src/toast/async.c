@@ -0,0 +1,111 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <h2o.h>
+
+#include <async.h>
+#include <metrics.h>
+
+typedef struct asyncTask asyncTask;
+
+// lives in the request's pool, so it learns when the request goes away
+typedef struct {
+  asyncTask *task;
+} taskLink;
+
+struct asyncTask {
+  uv_work_t work;
+  h2o_req_t *req;
+  taskLink *link;
+  asyncWork on_work;
+  asyncDone on_done;
+  void *data;
+  uint64_t queued_at; // uv_hrtime
+};
+
+// pool threads and every worker write these, unlike the route counters
+static atomic_size_t queued;
+static atomic_size_t running;
+static atomic_size_t completed;
+static atomic_size_t abandoned;
+static atomic_size_t wait_sum_usec;
+static atomic_size_t wait[LATENCY_BUCKETS];
+
+static void on_req_dispose(void *_link) {
+  taskLink *link = _link;
+
+  if (link->task)
+    link->task->req = NULL;
+}
+
+static void run_work(uv_work_t *work) {
+  asyncTask *task = work->data;
+  uint64_t usec = (uv_hrtime() - task->queued_at) / 1000;
+
+  atomic_fetch_sub_explicit(&queued, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&running, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&wait_sum_usec, usec, memory_order_relaxed);
+  atomic_fetch_add_explicit(&wait[latency_bucket(usec)], 1,
+                            memory_order_relaxed);
+
+  task->on_work(task->data);
+
+  atomic_fetch_sub_explicit(&running, 1, memory_order_relaxed);
+}
+
+static void after_work(uv_work_t *work, int status) {
+  asyncTask *task = work->data;
+
+  atomic_fetch_add_explicit(&completed, 1, memory_order_relaxed);
+  if (task->req)
+    task->link->task = NULL;
+  else
+    atomic_fetch_add_explicit(&abandoned, 1, memory_order_relaxed);
+
+  task->on_done(task->req, task->data);
+  free(task);
+}
+
+int queue_work(h2o_req_t *req, asyncWork work, asyncDone done, void *data) {
+  asyncTask *task = malloc(sizeof(*task));
+  int r;
+
+  if (!task)
+    return -1;
+
+  task->work.data = task;
+  task->req = req;
+  task->on_work = work;
+  task->on_done = done;
+  task->data = data;
+  task->queued_at = uv_hrtime();
+
+  // counted first, a pool thread may pick the task up before this returns
+  atomic_fetch_add_explicit(&queued, 1, memory_order_relaxed);
+  if ((r = uv_queue_work(req->conn->ctx->loop, &task->work, run_work,
+                         after_work)) != 0) {
+    fprintf(stderr, "uv_queue_work:%s\n", uv_strerror(r));
+    atomic_fetch_sub_explicit(&queued, 1, memory_order_relaxed);
+    free(task);
+    return -1;
+  }
+
+  task->link = h2o_mem_alloc_shared(&req->pool, sizeof(*task->link),
+                                    on_req_dispose);
+  task->link->task = task;
+  return 0;
+}
+
+void async_stats(asyncStats *stats) {
+  stats->queued = atomic_load_explicit(&queued, memory_order_relaxed);
+  stats->running = atomic_load_explicit(&running, memory_order_relaxed);
+  stats->completed = atomic_load_explicit(&completed, memory_order_relaxed);
+  stats->abandoned = atomic_load_explicit(&abandoned, memory_order_relaxed);
+  stats->wait_sum_usec =
+      atomic_load_explicit(&wait_sum_usec, memory_order_relaxed);
+  for (int i = 0; i < LATENCY_BUCKETS; ++i)
+    stats->wait[i] = atomic_load_explicit(&wait[i], memory_order_relaxed);
+}
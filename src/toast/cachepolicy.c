@@ -0,0 +1,101 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <h2o.h>
+
+#include <cachepolicy.h>
+#include <config.h>
+
+static const h2o_iovec_t immutable = {
+    H2O_STRLIT("public, max-age=31536000, immutable")};
+
+// '*' stays within a path segment, '**' crosses them, '?' is any one character
+static bool glob_match(const char *pattern, const char *str, size_t len) {
+  for (; *pattern; ++pattern) {
+    if (*pattern == '*') {
+      bool across = pattern[1] == '*';
+
+      pattern += across ? 2 : 1;
+      for (size_t i = 0;; ++i) {
+        if (glob_match(pattern, str + i, len - i))
+          return true;
+        if (i == len || (!across && str[i] == '/'))
+          return false;
+      }
+    }
+
+    if (len == 0 || (*pattern != *str && (*pattern != '?' || *str == '/')))
+      return false;
+    ++str;
+    --len;
+  }
+  return len == 0;
+}
+
+bool is_fingerprinted(const char *name, size_t len) {
+  const char *ext = name + len, *start;
+  bool digit = false, lower = false, upper = false, hex = true;
+
+  while (ext > name && *--ext != '.')
+    ;
+  if (ext == name)
+    return false;
+
+  // the hash follows a dot or a dash, and something has to come before it
+  for (start = ext; start > name && start[-1] != '.' && start[-1] != '-';
+       --start)
+    ;
+  if (start <= name + 1)
+    return false;
+
+  for (const char *p = start; p < ext; ++p) {
+    if (*p >= '0' && *p <= '9') {
+      digit = true;
+    } else if (*p >= 'a' && *p <= 'z') {
+      lower = true;
+      hex = hex && *p <= 'f';
+    } else if ((*p >= 'A' && *p <= 'Z') || *p == '_') {
+      upper = upper || *p != '_';
+      hex = false;
+    } else {
+      return false;
+    }
+  }
+
+  // hex digests from webpack and friends, or rollup's 8 base64url characters
+  if (hex)
+    return ext - start >= 6 && digit && lower;
+  return ext - start == 8 && digit && lower && upper;
+}
+
+h2o_iovec_t cache_control_for(const Config *config, const char *path,
+                              size_t len) {
+  const httpCacheConfig *http_cache = &config->http_cache;
+  char index_path[1024];
+  const char *name;
+
+  if (len > 0 && path[len - 1] == '/' &&
+      len + sizeof("index.html") <= sizeof(index_path)) {
+    memcpy(index_path, path, len);
+    memcpy(index_path + len, "index.html", sizeof("index.html") - 1);
+    path = index_path;
+    len += sizeof("index.html") - 1;
+  }
+
+  for (name = path + len; name > path && name[-1] != '/'; --name)
+    ;
+
+  for (size_t i = 0; i < http_cache->policy_count; ++i) {
+    const cachePolicy *policy = &http_cache->policies[i];
+    const char *target = policy->match[0] == '/' ? path : name;
+
+    if (glob_match(policy->match, target, path + len - target))
+      return h2o_iovec_init(policy->cache_control, policy->cache_control_len);
+  }
+
+  if (http_cache->immutable_fingerprinted &&
+      is_fingerprinted(name, path + len - name))
+    return immutable;
+  return h2o_iovec_init(NULL, 0);
+}
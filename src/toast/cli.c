@@ -1,19 +1,18 @@
+#include <arpa/inet.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <cli.h>
+#include <clock.h>
 #include <config.h>
 #include <meta.h>
-#include <time.h>
+#include <pack.h>
+#include <precompress.h>
 
 static void get_current_year(char (*buf)[5]) {
-  struct tm local_time;
-  time_t now = time(NULL);
-  localtime_r(&now, &local_time);
-
-  snprintf(*buf, 5, "%d", local_time.tm_year + 1900);
+  snprintf(*buf, 5, "%d", clock_now()->year);
 }
 
 static void usage(void) {
@@ -23,12 +22,19 @@ static void usage(void) {
   printf("USAGE: toast [OPTIONS]\n"
          "Options:\n"
          "    -h, --help                     displays this message\n"
-         "    -i, --ip-address [address]     override ip address specified in "
-         "config\n"
-         "    -p, --port       [port number] override port \n"
+         "    -i, --ip-address [address]     override the first TCP "
+         "listener's address\n"
+         "    -p, --port       [port number] override the first TCP "
+         "listener's port\n"
          "    -s, --ssl                      toggles HTTPS/SSL (needs a cert "
          "and key in path)\n"
          "    -c, --compress                 toggles gzip compression\n"
+         "        --precompress              build .gz, .br and .zst siblings "
+         "in site root and exit\n"
+         "        --pack                     compile site root into the "
+         "configured pack file and exit\n"
+         "    -w, --workers    [count]       override worker thread count "
+         "(0 = one per CPU)\n"
          "    -v, --verbose                  toggles verbose messaging "
          "(enables logs)\n\n"
 
@@ -45,6 +51,8 @@ int parse_args(int *argc, char ***argv, Config *populated_args) {
   int option_index = 0;
   char *ip_buf = {0};
   unsigned int port_buf = 0;
+  int workers_buf = 0;
+  listenerConfig *tcp_listener = NULL;
 
   if (local_argc == 1)
     return 0;
@@ -56,11 +64,15 @@ int parse_args(int *argc, char ***argv, Config *populated_args) {
       // requires no arg due to being bool;
       {"ssl", no_argument, 0, 's'},
       {"compress", no_argument, 0, 'c'},
+      {"workers", required_argument, 0, 'w'},
+      // long only, it runs instead of the server
+      {"precompress", no_argument, 0, 'z'},
+      {"pack", no_argument, 0, 'k'},
       {"verbose", no_argument, 0, 'v'},
       {0, 0, 0, 0}}; // end options_arr
 
   while (1) {
-    char arg = getopt_long(local_argc, local_argv, ":hi:p:scv", long_options,
+    char arg = getopt_long(local_argc, local_argv, ":hi:p:scw:v", long_options,
                            &option_index);
 
     if (arg == -1)
@@ -73,11 +85,16 @@ int parse_args(int *argc, char ***argv, Config *populated_args) {
 
     case 'i':
       ip_buf = optarg;
-      if (strlen(ip_buf) > 15) {
+      if (strlen(ip_buf) >= INET6_ADDRSTRLEN) {
         fprintf(stderr, "Unknown ip address \"%s\"\n", ip_buf);
         return -1;
+      } else if ((tcp_listener = first_tcp_listener(
+                      &populated_args->network)) == NULL) {
+        fprintf(stderr, "No TCP listener to set the address of\n");
+        return -1;
       } else {
-        strlcpy(populated_args->network.ip, ip_buf, 16);
+        free(tcp_listener->address);
+        tcp_listener->address = strdup(ip_buf);
       }
       break;
 
@@ -86,8 +103,12 @@ int parse_args(int *argc, char ***argv, Config *populated_args) {
       if (port_buf <= 0 || port_buf > 65535) {
         fprintf(stderr, "Unknown port \"%s\"\n", optarg);
         return -1;
+      } else if ((tcp_listener = first_tcp_listener(
+                      &populated_args->network)) == NULL) {
+        fprintf(stderr, "No TCP listener to set the port of\n");
+        return -1;
       } else {
-        populated_args->network.port = port_buf;
+        tcp_listener->port = port_buf;
       }
       break;
 
@@ -100,6 +121,34 @@ int parse_args(int *argc, char ***argv, Config *populated_args) {
           !populated_args->compression.enabled;
       break;
 
+    case 'w':
+      workers_buf = atoi(optarg);
+      if (workers_buf < 0 || workers_buf > MAX_WORKERS) {
+        fprintf(stderr, "Unknown worker count \"%s\"\n", optarg);
+        return -1;
+      } else {
+        populated_args->workers = workers_buf;
+      }
+      break;
+
+    case 'z':
+      exit(precompress_site(populated_args->site_root,
+                            populated_args->compression.min_size) == 0
+               ? 0
+               : 1);
+
+    case 'k':
+      if (populated_args->pack == NULL) {
+        fprintf(stderr, "Set \"pack\" in the config to where the pack "
+                        "should go\n");
+        exit(1);
+      }
+      exit(build_pack(populated_args->site_root, populated_args->pack,
+                      populated_args->compression.min_size,
+                      populated_args) == 0
+               ? 0
+               : 1);
+
     case '?':
       fprintf(stderr, "invalid flag passed \"%s\"\n", local_argv[optind - 1]);
       return 0;
@@ -0,0 +1,60 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <h2o.h>
+
+#include <clock.h>
+
+typedef struct {
+  uv_loop_t *loop;
+  bool valid;
+  clockTime time;
+} threadClock;
+
+static uint64_t start_mono_ms;
+static time_t start_wall;
+static _Thread_local threadClock this_clock;
+
+void init_clock(void) {
+  start_mono_ms = uv_hrtime() / 1000000;
+  start_wall = time(NULL);
+}
+
+void start_clock(uv_loop_t *loop) {
+  this_clock.loop = loop;
+  this_clock.valid = false;
+}
+
+const clockTime *clock_now(void) {
+  clockTime *now = &this_clock.time;
+  uint64_t mono_ms = this_clock.loop ? uv_now(this_clock.loop)
+                                     : uv_hrtime() / 1000000;
+  struct timespec wall;
+  struct tm local_time;
+
+  if (this_clock.valid && now->mono_ms == mono_ms)
+    return now;
+  now->mono_ms = mono_ms;
+
+  clock_gettime(CLOCK_REALTIME_COARSE, &wall);
+  if (this_clock.valid && now->wall == wall.tv_sec)
+    return now;
+  now->wall = wall.tv_sec;
+
+  localtime_r(&now->wall, &local_time);
+  now->year = local_time.tm_year + 1900;
+  h2o_time2str_log(now->log_date, now->wall);
+  this_clock.valid = true;
+
+  return now;
+}
+
+uint64_t uptime_ms(void) {
+  uint64_t mono_ms = clock_now()->mono_ms;
+
+  // the loop time may be read from a coarser clock than uv_hrtime
+  return mono_ms > start_mono_ms ? mono_ms - start_mono_ms : 0;
+}
+
+time_t started_at(void) { return start_wall; }
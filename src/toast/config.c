@@ -1,3 +1,5 @@
+#include <arpa/inet.h>
+#include <ctype.h>
 #include <jansson.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -10,6 +12,10 @@
 
 #define DEFAULT_PATH "/config/"
 #define DEFAULT_LEVEL 6
+#define DEFAULT_BACKLOG 4096
+#define DEFAULT_SOCKET_MODE 0660
+#define DEFAULT_SLOW_HANDLER_MS 10
+#define DEFAULT_DRAIN_TIMEOUT 30
 
 static int handle_parse_err(char *categ, char *field) {
   fprintf(stderr,
@@ -19,23 +25,411 @@ static int handle_parse_err(char *categ, char *field) {
   return -1;
 }
 
+static void default_listener(listenerConfig *listener, const char *address,
+                             unsigned int port) {
+  *listener = (listenerConfig){
+      .address = strdup(address),
+      .port = port,
+      .backlog = DEFAULT_BACKLOG,
+      .nodelay = true,
+  };
+}
+
+static void free_listener(listenerConfig *listener) {
+  free(listener->address);
+  free(listener->path);
+  free(listener->owner);
+}
+
+static void free_listeners(listenerConfig *listeners, size_t count) {
+  for (size_t i = 0; i < count; ++i)
+    free_listener(&listeners[i]);
+  free(listeners);
+}
+
+listenerConfig *first_tcp_listener(networkConfig *network) {
+  for (size_t i = 0; i < network->listener_count; ++i)
+    if (network->listeners[i].path == NULL)
+      return &network->listeners[i];
+  return NULL;
+}
+
+// optional listener fields keep their default when missing
+static int read_listener_uint(json_t *listener_object, char *field,
+                              unsigned int *value) {
+  json_t *value_integer = json_object_get(listener_object, field);
+
+  if (json_is_integer(value_integer))
+    *value = json_integer_value(value_integer);
+  else if (value_integer != NULL)
+    return handle_parse_err("listeners", field);
+
+  return 0;
+}
+
+static int read_listener_bool(json_t *listener_object, char *field,
+                              bool *value) {
+  json_t *value_bool = json_object_get(listener_object, field);
+
+  if (json_is_boolean(value_bool))
+    *value = json_boolean_value(value_bool);
+  else if (value_bool != NULL)
+    return handle_parse_err("listeners", field);
+
+  return 0;
+}
+
+// a listener with a path binds a Unix domain socket, mode is an octal string
+static int read_unix_listener(json_t *listener_object,
+                              listenerConfig *listener) {
+  json_t *path_string = json_object_get(listener_object, "path");
+  json_t *mode_string = json_object_get(listener_object, "mode");
+  json_t *owner_string = json_object_get(listener_object, "owner");
+  char *end;
+
+  *listener = (listenerConfig){
+      .path = strdup(json_string_value(path_string)),
+      .mode = DEFAULT_SOCKET_MODE,
+      .backlog = DEFAULT_BACKLOG,
+  };
+
+  if (json_is_string(mode_string)) {
+    listener->mode = strtoul(json_string_value(mode_string), &end, 8);
+    if (*end != '\0' || listener->mode > 0777) {
+      free_listener(listener);
+      return handle_parse_err("listeners", "mode");
+    }
+  } else if (mode_string != NULL) {
+    free_listener(listener);
+    return handle_parse_err("listeners", "mode");
+  }
+
+  if (json_is_string(owner_string)) {
+    if (json_string_length(owner_string) > 0)
+      listener->owner = strdup(json_string_value(owner_string));
+  } else if (owner_string != NULL) {
+    free_listener(listener);
+    return handle_parse_err("listeners", "owner");
+  }
+
+  if (read_listener_uint(listener_object, "backlog", &listener->backlog) !=
+          0 ||
+      read_listener_uint(listener_object, "sndbuf", &listener->sndbuf) != 0 ||
+      read_listener_bool(listener_object, "proxy_protocol",
+                         &listener->proxy_protocol) != 0) {
+    free_listener(listener);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int read_listener(json_t *listener_object, listenerConfig *listener) {
+  json_t *address_string = json_object_get(listener_object, "address");
+  json_t *port_integer = json_object_get(listener_object, "port");
+
+  if (json_is_string(json_object_get(listener_object, "path")))
+    return read_unix_listener(listener_object, listener);
+
+  if (!json_is_string(address_string))
+    return handle_parse_err("listeners", "address");
+
+  if (!json_is_integer(port_integer) || json_integer_value(port_integer) <= 0 ||
+      json_integer_value(port_integer) > 65535)
+    return handle_parse_err("listeners", "port");
+
+  default_listener(listener, json_string_value(address_string),
+                   json_integer_value(port_integer));
+
+  if (read_listener_uint(listener_object, "backlog", &listener->backlog) !=
+          0 ||
+      read_listener_uint(listener_object, "fastopen", &listener->fastopen) !=
+          0 ||
+      read_listener_uint(listener_object, "defer_accept",
+                         &listener->defer_accept) != 0 ||
+      read_listener_bool(listener_object, "nodelay", &listener->nodelay) !=
+          0 ||
+      read_listener_bool(listener_object, "ipv6_only", &listener->ipv6_only) !=
+          0 ||
+      read_listener_uint(listener_object, "sndbuf", &listener->sndbuf) != 0 ||
+      read_listener_uint(listener_object, "notsent_lowat",
+                         &listener->notsent_lowat) != 0 ||
+      read_listener_bool(listener_object, "proxy_protocol",
+                         &listener->proxy_protocol) != 0) {
+    free_listener(listener);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int read_listeners(json_t *network_object, networkConfig *network) {
+  json_t *listeners_array = json_object_get(network_object, "listeners");
+
+  // configs written before listeners existed have a single ip and port
+  if (listeners_array == NULL) {
+    json_t *ip_string = json_object_get(network_object, "ip");
+    json_t *port_integer = json_object_get(network_object, "port");
+
+    if (!json_is_string(ip_string))
+      return handle_parse_err("network", "ip");
+    if (!json_is_integer(port_integer) ||
+        json_integer_value(port_integer) <= 0 ||
+        json_integer_value(port_integer) > 65535)
+      return handle_parse_err("network", "port");
+
+    network->listeners = malloc(sizeof(listenerConfig));
+    if (!network->listeners)
+      return -1;
+
+    default_listener(network->listeners, json_string_value(ip_string),
+                     json_integer_value(port_integer));
+    network->listener_count = 1;
+    return 0;
+  }
+
+  if (!json_is_array(listeners_array) || json_array_size(listeners_array) == 0)
+    return handle_parse_err("network", "listeners");
+
+  network->listeners =
+      calloc(json_array_size(listeners_array), sizeof(listenerConfig));
+  if (!network->listeners)
+    return -1;
+
+  for (size_t i = 0; i < json_array_size(listeners_array); ++i) {
+    json_t *listener_object = json_array_get(listeners_array, i);
+
+    if (!json_is_object(listener_object) ||
+        read_listener(listener_object, &network->listeners[i]) != 0) {
+      free_listeners(network->listeners, network->listener_count);
+      network->listeners = NULL;
+      network->listener_count = 0;
+      return handle_parse_err("network", "listeners");
+    }
+    ++network->listener_count;
+  }
+
+  return 0;
+}
+
+static void free_mime_types(mimeOverride *mime_types, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    free(mime_types[i].extension);
+    free(mime_types[i].type);
+  }
+  free(mime_types);
+}
+
+static int compare_mime_types(const void *_a, const void *_b) {
+  const mimeOverride *a = _a, *b = _b;
+  return strcmp(a->extension, b->extension);
+}
+
+// "ext": "type" pairs, a leading dot is fine and case doesn't matter
+static int read_mime_types(json_t *mime_object, Config *config) {
+  const char *extension;
+  json_t *type_string;
+  size_t count = 0;
+
+  if (!json_is_object(mime_object))
+    return handle_parse_err("root", "mime_types");
+  if (json_object_size(mime_object) == 0)
+    return 0;
+
+  config->mime_types =
+      calloc(json_object_size(mime_object), sizeof(mimeOverride));
+  if (!config->mime_types)
+    return -1;
+
+  json_object_foreach(mime_object, extension, type_string) {
+    mimeOverride *override = &config->mime_types[count];
+
+    if (*extension == '.')
+      ++extension;
+    if (*extension == '\0' || !json_is_string(type_string) ||
+        json_string_length(type_string) == 0) {
+      free_mime_types(config->mime_types, count);
+      config->mime_types = NULL;
+      return handle_parse_err("mime_types", (char *)extension);
+    }
+
+    override->extension = strdup(extension);
+    override->type = strdup(json_string_value(type_string));
+    override->type_len = json_string_length(type_string);
+    if (!override->extension || !override->type) {
+      free_mime_types(config->mime_types, count + 1);
+      config->mime_types = NULL;
+      return -1;
+    }
+    for (char *c = override->extension; *c; ++c)
+      *c = tolower((unsigned char)*c);
+    ++count;
+  }
+
+  qsort(config->mime_types, count, sizeof(mimeOverride), compare_mime_types);
+  config->mime_type_count = count;
+  return 0;
+}
+
+static void free_policies(cachePolicy *policies, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    free(policies[i].match);
+    free(policies[i].cache_control);
+  }
+  free(policies);
+}
+
+static int read_http_cache(json_t *http_cache_object,
+                           httpCacheConfig *http_cache) {
+  json_t *content_etags_bool =
+      json_object_get(http_cache_object, "content_etags");
+  json_t *fingerprinted_bool =
+      json_object_get(http_cache_object, "immutable_fingerprinted");
+  json_t *policies_array = json_object_get(http_cache_object, "policies");
+  json_t *policy_object;
+  size_t index;
+
+  if (json_is_boolean(content_etags_bool))
+    http_cache->content_etags = json_boolean_value(content_etags_bool);
+  else if (content_etags_bool != NULL)
+    return handle_parse_err("http_cache", "content_etags");
+
+  if (json_is_boolean(fingerprinted_bool))
+    http_cache->immutable_fingerprinted =
+        json_boolean_value(fingerprinted_bool);
+  else if (fingerprinted_bool != NULL)
+    return handle_parse_err("http_cache", "immutable_fingerprinted");
+
+  if (policies_array == NULL)
+    return 0;
+  if (!json_is_array(policies_array))
+    return handle_parse_err("http_cache", "policies");
+  if (json_array_size(policies_array) == 0)
+    return 0;
+
+  http_cache->policies =
+      calloc(json_array_size(policies_array), sizeof(cachePolicy));
+  if (!http_cache->policies)
+    return -1;
+
+  json_array_foreach(policies_array, index, policy_object) {
+    cachePolicy *policy = &http_cache->policies[index];
+    json_t *match_string = json_object_get(policy_object, "match");
+    json_t *cache_control_string =
+        json_object_get(policy_object, "cache_control");
+
+    if (!json_is_string(match_string) ||
+        json_string_length(match_string) == 0 ||
+        !json_is_string(cache_control_string)) {
+      free_policies(http_cache->policies, index);
+      http_cache->policies = NULL;
+      return handle_parse_err("http_cache", "policies");
+    }
+
+    policy->match = strdup(json_string_value(match_string));
+    policy->cache_control = strdup(json_string_value(cache_control_string));
+    policy->cache_control_len = json_string_length(cache_control_string);
+    if (!policy->match || !policy->cache_control) {
+      free_policies(http_cache->policies, index + 1);
+      http_cache->policies = NULL;
+      return -1;
+    }
+  }
+
+  http_cache->policy_count = json_array_size(policies_array);
+  return 0;
+}
+
+static void free_lag_allow(char **lag_allow, size_t count) {
+  for (size_t i = 0; i < count; ++i)
+    free(lag_allow[i]);
+  free(lag_allow);
+}
+
+static bool is_lag_peer(const char *peer) {
+  unsigned char addr[sizeof(struct in6_addr)];
+
+  if (strncmp(peer, "unix:", 5) == 0)
+    return peer[5] == '/';
+  return inet_pton(AF_INET, peer, addr) == 1 ||
+         inet_pton(AF_INET6, peer, addr) == 1;
+}
+
+static int read_api(json_t *api_object, apiConfig *api) {
+  json_t *lag_allow_array = json_object_get(api_object, "lag_allow");
+  json_t *peer_string;
+  size_t index;
+
+  if (lag_allow_array == NULL)
+    return 0;
+  if (!json_is_array(lag_allow_array))
+    return handle_parse_err("api", "lag_allow");
+  if (json_array_size(lag_allow_array) == 0)
+    return 0;
+
+  api->lag_allow = calloc(json_array_size(lag_allow_array), sizeof(char *));
+  if (!api->lag_allow)
+    return -1;
+
+  json_array_foreach(lag_allow_array, index, peer_string) {
+    if (!json_is_string(peer_string) ||
+        !is_lag_peer(json_string_value(peer_string))) {
+      free_lag_allow(api->lag_allow, index);
+      api->lag_allow = NULL;
+      return handle_parse_err("api", "lag_allow");
+    }
+
+    if ((api->lag_allow[index] = strdup(json_string_value(peer_string))) ==
+        NULL) {
+      free_lag_allow(api->lag_allow, index);
+      api->lag_allow = NULL;
+      return -1;
+    }
+  }
+
+  api->lag_allow_count = json_array_size(lag_allow_array);
+  return 0;
+}
+
 int init_config(Config *config) {
   Config local_config;
   networkConfig local_network;
   sslConfig local_ssl; // remember SSL actually means TLS
   compressionConfig local_compression;
+  cacheConfig local_cache;
+  httpCacheConfig local_http_cache;
+  apiConfig local_api;
 
-  // Max length for ipv4 is 15 characters, adding 1 for nullterm.
-  local_network.ip = (char *)malloc(16);
-  strlcpy(local_network.ip, "127.0.0.1", 16);
-  local_network.port = 8080;
+  // one listener on loopback, add more under network.listeners
+  local_network.listeners = malloc(sizeof(listenerConfig));
+  default_listener(local_network.listeners, "127.0.0.1", 8080);
+  local_network.listener_count = 1;
+  local_network.max_connections = 0; // per worker, 0 never stops accepting
+  local_network.drain_timeout = DEFAULT_DRAIN_TIMEOUT;
 
   local_compression.enabled = true; // Compression is gzip
   local_compression.quality = 6;    // 6 is middleground and relatively fast
   local_compression.min_size = 150; // 150 recommended minimum
+  local_compression.precompress = false; // .gz/.br/.zst siblings at startup
+
+  local_cache.enabled = true;
+  local_cache.max_bytes = 64 * 1024 * 1024; // per worker
+  local_cache.max_file_size = 256 * 1024;
+  local_cache.not_found_entries = 4096; // per worker, 0 stats every 404
+
+  local_http_cache.content_etags = true; // hashes site_root at startup
+  local_http_cache.immutable_fingerprinted = true;
+  local_http_cache.policies = NULL; // no Cache-Control unless fingerprinted
+  local_http_cache.policy_count = 0;
+
+  local_api.lag_allow = NULL; // /api/lag answers nobody until it's listed
+  local_api.lag_allow_count = 0;
 
   local_ssl.enabled = false;
   local_ssl.mem_cached = false;
+  local_ssl.session_tickets = true; // keys rotate hourly, shared by workers
+  local_ssl.ticket_keyfile = NULL;
+  local_ssl.ktls = false;
   local_ssl.cert_path = (char *)malloc(1024); // 1024 is usual max path for *nix
   local_ssl.key_path = (char *)malloc(1024);
   local_ssl.cert_path = NULL; // NULL by default
@@ -45,9 +439,18 @@ int init_config(Config *config) {
   local_config.site_root = (char *)malloc(1024);
   strlcpy(local_config.site_root, "site/", 1024);
 
+  local_config.workers = 0; // 0 starts one worker per CPU
   local_config.log_type = Both; // Console, File, Both are the available options
+  local_config.log_compress = false;
+  local_config.slow_handler_ms = DEFAULT_SLOW_HANDLER_MS;
+  local_config.pack = NULL; // serve site_root file by file
+  local_config.mime_types = NULL; // the built-in table is enough
+  local_config.mime_type_count = 0;
   local_config.network = local_network;
   local_config.compression = local_compression;
+  local_config.cache = local_cache;
+  local_config.http_cache = local_http_cache;
+  local_config.api = local_api;
   local_config.ssl = local_ssl;
 
   *config = local_config;
@@ -84,10 +487,12 @@ int write_config(Config *config) {
   json_t *root = json_object();
   json_t *network_object = json_object();
   json_t *compression_object = json_object();
+  json_t *cache_object = json_object();
   json_t *ssl_object = json_object();
 
   char *site_root = config->site_root;
   json_object_set_new(root, "site_root", json_string(site_root));
+  json_object_set_new(root, "workers", json_integer(config->workers));
 
   switch (config->log_type) {
   case Both:
@@ -104,16 +509,114 @@ int write_config(Config *config) {
     return -1;
   }
 
-  if (config->network.ip == NULL)
-    json_object_set_new(network_object, "ip", json_string("127.0.0.1"));
+  if (config->log_compress == true)
+    json_object_set_new(root, "log_compress", json_true());
+  else
+    json_object_set_new(root, "log_compress", json_false());
+
+  json_object_set_new(root, "slow_handler_ms",
+                      json_integer(config->slow_handler_ms));
+
+  if (config->pack == NULL)
+    json_object_set_new(root, "pack", json_string(""));
   else
-    json_object_set_new(network_object, "ip", json_string(config->network.ip));
+    json_object_set_new(root, "pack", json_string(config->pack));
 
-  if (config->network.port == 0 || config->network.port > 65535)
-    json_object_set_new(network_object, "port", json_integer(8080));
+  json_t *mime_object = json_object();
+  for (size_t i = 0; i < config->mime_type_count; ++i)
+    json_object_set_new(mime_object, config->mime_types[i].extension,
+                        json_string(config->mime_types[i].type));
+  json_object_set_new(root, "mime_types", mime_object);
+
+  json_t *http_cache_object = json_object();
+  if (config->http_cache.content_etags == true)
+    json_object_set_new(http_cache_object, "content_etags", json_true());
   else
-    json_object_set_new(network_object, "port",
-                        json_integer(config->network.port));
+    json_object_set_new(http_cache_object, "content_etags", json_false());
+
+  if (config->http_cache.immutable_fingerprinted == true)
+    json_object_set_new(http_cache_object, "immutable_fingerprinted",
+                        json_true());
+  else
+    json_object_set_new(http_cache_object, "immutable_fingerprinted",
+                        json_false());
+
+  json_t *policies_array = json_array();
+  for (size_t i = 0; i < config->http_cache.policy_count; ++i) {
+    cachePolicy *policy = &config->http_cache.policies[i];
+    json_t *policy_object = json_object();
+    json_object_set_new(policy_object, "match", json_string(policy->match));
+    json_object_set_new(policy_object, "cache_control",
+                        json_string(policy->cache_control));
+    json_array_append_new(policies_array, policy_object);
+  }
+  json_object_set_new(http_cache_object, "policies", policies_array);
+  json_object_set_new(root, "http_cache", http_cache_object);
+
+  json_t *api_object = json_object();
+  json_t *lag_allow_array = json_array();
+  for (size_t i = 0; i < config->api.lag_allow_count; ++i)
+    json_array_append_new(lag_allow_array,
+                          json_string(config->api.lag_allow[i]));
+  json_object_set_new(api_object, "lag_allow", lag_allow_array);
+  json_object_set_new(root, "api", api_object);
+
+  json_t *listeners_array = json_array();
+  for (size_t i = 0; i < config->network.listener_count; ++i) {
+    listenerConfig *listener = &config->network.listeners[i];
+    json_t *listener_object = json_object();
+
+    if (listener->proxy_protocol == true)
+      json_object_set_new(listener_object, "proxy_protocol", json_true());
+    else
+      json_object_set_new(listener_object, "proxy_protocol", json_false());
+
+    if (listener->path != NULL) {
+      char mode[8];
+
+      snprintf(mode, sizeof(mode), "%04o", listener->mode);
+      json_object_set_new(listener_object, "path", json_string(listener->path));
+      json_object_set_new(listener_object, "mode", json_string(mode));
+      json_object_set_new(listener_object, "owner",
+                          json_string(listener->owner ? listener->owner : ""));
+      json_object_set_new(listener_object, "backlog",
+                          json_integer(listener->backlog));
+      json_object_set_new(listener_object, "sndbuf",
+                          json_integer(listener->sndbuf));
+      json_array_append_new(listeners_array, listener_object);
+      continue;
+    }
+
+    json_object_set_new(listener_object, "address",
+                        json_string(listener->address));
+    json_object_set_new(listener_object, "port", json_integer(listener->port));
+    json_object_set_new(listener_object, "backlog",
+                        json_integer(listener->backlog));
+    json_object_set_new(listener_object, "fastopen",
+                        json_integer(listener->fastopen));
+    json_object_set_new(listener_object, "defer_accept",
+                        json_integer(listener->defer_accept));
+    if (listener->nodelay == true)
+      json_object_set_new(listener_object, "nodelay", json_true());
+    else
+      json_object_set_new(listener_object, "nodelay", json_false());
+    if (listener->ipv6_only == true)
+      json_object_set_new(listener_object, "ipv6_only", json_true());
+    else
+      json_object_set_new(listener_object, "ipv6_only", json_false());
+    json_object_set_new(listener_object, "sndbuf",
+                        json_integer(listener->sndbuf));
+    json_object_set_new(listener_object, "notsent_lowat",
+                        json_integer(listener->notsent_lowat));
+
+    json_array_append_new(listeners_array, listener_object);
+  }
+  json_object_set_new(network_object, "listeners", listeners_array);
+
+  json_object_set_new(network_object, "max_connections",
+                      json_integer(config->network.max_connections));
+  json_object_set_new(network_object, "drain_timeout",
+                      json_integer(config->network.drain_timeout));
 
   if (config->compression.enabled == true)
     json_object_set_new(compression_object, "enabled", json_true());
@@ -134,6 +637,23 @@ int write_config(Config *config) {
   json_object_set_new(compression_object, "min_size",
                       json_integer(config->compression.min_size));
 
+  if (config->compression.precompress == true)
+    json_object_set_new(compression_object, "precompress", json_true());
+  else
+    json_object_set_new(compression_object, "precompress", json_false());
+
+  if (config->cache.enabled == true)
+    json_object_set_new(cache_object, "enabled", json_true());
+  else
+    json_object_set_new(cache_object, "enabled", json_false());
+
+  json_object_set_new(cache_object, "max_bytes",
+                      json_integer(config->cache.max_bytes));
+  json_object_set_new(cache_object, "max_file_size",
+                      json_integer(config->cache.max_file_size));
+  json_object_set_new(cache_object, "not_found_entries",
+                      json_integer(config->cache.not_found_entries));
+
   if (config->ssl.enabled == true)
     json_object_set_new(ssl_object, "enabled", json_true());
   else
@@ -144,6 +664,22 @@ int write_config(Config *config) {
   else
     json_object_set_new(ssl_object, "mem_cached", json_false());
 
+  if (config->ssl.session_tickets == true)
+    json_object_set_new(ssl_object, "session_tickets", json_true());
+  else
+    json_object_set_new(ssl_object, "session_tickets", json_false());
+
+  if (config->ssl.ticket_keyfile == NULL)
+    json_object_set_new(ssl_object, "ticket_keyfile", json_string(""));
+  else
+    json_object_set_new(ssl_object, "ticket_keyfile",
+                        json_string(config->ssl.ticket_keyfile));
+
+  if (config->ssl.ktls == true)
+    json_object_set_new(ssl_object, "ktls", json_true());
+  else
+    json_object_set_new(ssl_object, "ktls", json_false());
+
   if (config->ssl.cert_path == NULL) {
     json_object_set_new(ssl_object, "cert_path", json_string(""));
     json_object_set(ssl_object, "enabled", json_false());
@@ -162,6 +698,7 @@ int write_config(Config *config) {
 
   json_object_set_new(root, "network", network_object);
   json_object_set_new(root, "compression", compression_object);
+  json_object_set_new(root, "cache", cache_object);
   json_object_set_new(root, "ssl", ssl_object);
 
   FILE *file = fopen(path, "w");
@@ -225,6 +762,20 @@ int read_config(Config *config) {
     return handle_parse_err("root", "site_root");
   }
 
+  json_t *workers_integer = json_object_get(root, "workers");
+
+  // optional, configs written before workers existed don't have it
+  unsigned int workers = 0;
+  if (json_is_integer(workers_integer) &&
+      json_integer_value(workers_integer) >= 0 &&
+      json_integer_value(workers_integer) <= MAX_WORKERS) {
+    workers = json_integer_value(workers_integer);
+  } else if (workers_integer != NULL) {
+    json_decref(root);
+    free(site_root);
+    return handle_parse_err("root", "workers");
+  }
+
   json_t *log_type_enum = json_object_get(root, "log_type");
 
   int log_type = Both;
@@ -241,6 +792,30 @@ int read_config(Config *config) {
     return handle_parse_err("root", "log_type");
   }
 
+  json_t *log_compress_bool = json_object_get(root, "log_compress");
+
+  // optional, rotated log files stay plain text unless asked for
+  bool log_compress = false;
+  if (json_is_boolean(log_compress_bool)) {
+    log_compress = json_boolean_value(log_compress_bool);
+  } else if (log_compress_bool != NULL) {
+    json_decref(root);
+    free(site_root);
+    return handle_parse_err("root", "log_compress");
+  }
+
+  json_t *slow_handler_integer = json_object_get(root, "slow_handler_ms");
+
+  // optional, configs written before tracing existed get the default
+  unsigned int slow_handler_ms = DEFAULT_SLOW_HANDLER_MS;
+  if (json_is_integer(slow_handler_integer)) {
+    slow_handler_ms = json_integer_value(slow_handler_integer);
+  } else if (slow_handler_integer != NULL) {
+    json_decref(root);
+    free(site_root);
+    return handle_parse_err("root", "slow_handler_ms");
+  }
+
   json_t *network_object = json_object_get(root, "network");
   if (!json_is_object(network_object)) {
     json_decref(root);
@@ -248,43 +823,48 @@ int read_config(Config *config) {
     return -1;
   }
 
-  json_t *ip_string = json_object_get(network_object, "ip");
-
-  char *ip = (char *)malloc(16);
-  if (!ip) {
+  networkConfig network = {0};
+  if (read_listeners(network_object, &network) != 0) {
     json_decref(root);
     free(site_root);
     return -1;
   }
 
-  if (json_is_string(ip_string)) {
-    strlcpy(ip, json_string_value(ip_string), 16);
-  } else {
+  json_t *max_connections_integer =
+      json_object_get(network_object, "max_connections");
+
+  // optional, configs written before the limit existed accept without one
+  network.max_connections = 0;
+  if (json_is_integer(max_connections_integer)) {
+    network.max_connections = json_integer_value(max_connections_integer);
+  } else if (max_connections_integer != NULL) {
     json_decref(root);
     free(site_root);
-    free(ip);
+    free_listeners(network.listeners, network.listener_count);
 
-    return handle_parse_err("network", "ip");
+    return handle_parse_err("network", "max_connections");
   }
 
-  json_t *port_integer = json_object_get(network_object, "port");
+  json_t *drain_timeout_integer =
+      json_object_get(network_object, "drain_timeout");
 
-  unsigned int port = 0;
-  if (json_is_integer(port_integer)) {
-    port = json_integer_value(port_integer);
-  } else {
+  // optional, configs written before upgrades existed get the default
+  network.drain_timeout = DEFAULT_DRAIN_TIMEOUT;
+  if (json_is_integer(drain_timeout_integer)) {
+    network.drain_timeout = json_integer_value(drain_timeout_integer);
+  } else if (drain_timeout_integer != NULL) {
     json_decref(root);
     free(site_root);
-    free(ip);
+    free_listeners(network.listeners, network.listener_count);
 
-    return handle_parse_err("root", "port");
+    return handle_parse_err("network", "drain_timeout");
   }
 
   json_t *compression_object = json_object_get(root, "compression");
   if (!json_is_object(compression_object)) {
     json_decref(root);
     free(site_root);
-    free(ip);
+    free_listeners(network.listeners, network.listener_count);
 
     return -1;
   }
@@ -298,7 +878,7 @@ int read_config(Config *config) {
   } else {
     json_decref(root);
     free(site_root);
-    free(ip);
+    free_listeners(network.listeners, network.listener_count);
 
     return handle_parse_err("compression", "enabled");
   }
@@ -312,7 +892,7 @@ int read_config(Config *config) {
   } else {
     json_decref(root);
     free(site_root);
-    free(ip);
+    free_listeners(network.listeners, network.listener_count);
 
     return handle_parse_err("compression", "quality");
   }
@@ -322,20 +902,95 @@ int read_config(Config *config) {
 
   unsigned int compression_min_size = 150;
   if (json_is_integer(compression_min_size_uint)) {
-    compression_min_size = json_integer_value(compression_quality_uint);
+    compression_min_size = json_integer_value(compression_min_size_uint);
   } else {
     json_decref(root);
     free(site_root);
-    free(ip);
+    free_listeners(network.listeners, network.listener_count);
 
     return handle_parse_err("compression", "min_size");
   }
 
+  json_t *precompress_bool = json_object_get(compression_object, "precompress");
+
+  bool precompress = false;
+  if (json_is_boolean(precompress_bool)) {
+    precompress = json_boolean_value(precompress_bool);
+  } else if (precompress_bool != NULL) {
+    json_decref(root);
+    free(site_root);
+    free_listeners(network.listeners, network.listener_count);
+
+    return handle_parse_err("compression", "precompress");
+  }
+
+  // the whole cache object is optional, older configs don't have one
+  json_t *cache_object = json_object_get(root, "cache");
+
+  bool cache_enabled = true;
+  unsigned int cache_max_bytes = 64 * 1024 * 1024;
+  unsigned int cache_max_file_size = 256 * 1024;
+  unsigned int cache_not_found_entries = 4096;
+  if (json_is_object(cache_object)) {
+    json_t *cache_enabled_bool = json_object_get(cache_object, "enabled");
+    json_t *cache_max_bytes_uint = json_object_get(cache_object, "max_bytes");
+    json_t *cache_max_file_size_uint =
+        json_object_get(cache_object, "max_file_size");
+
+    if (!json_is_boolean(cache_enabled_bool)) {
+      json_decref(root);
+      free(site_root);
+      free_listeners(network.listeners, network.listener_count);
+
+      return handle_parse_err("cache", "enabled");
+    }
+    cache_enabled = json_boolean_value(cache_enabled_bool);
+
+    if (!json_is_integer(cache_max_bytes_uint)) {
+      json_decref(root);
+      free(site_root);
+      free_listeners(network.listeners, network.listener_count);
+
+      return handle_parse_err("cache", "max_bytes");
+    }
+    cache_max_bytes = json_integer_value(cache_max_bytes_uint);
+
+    if (!json_is_integer(cache_max_file_size_uint)) {
+      json_decref(root);
+      free(site_root);
+      free_listeners(network.listeners, network.listener_count);
+
+      return handle_parse_err("cache", "max_file_size");
+    }
+    cache_max_file_size = json_integer_value(cache_max_file_size_uint);
+
+    json_t *cache_not_found_entries_uint =
+        json_object_get(cache_object, "not_found_entries");
+
+    // optional, configs written before the 404 cache existed get the default
+    if (json_is_integer(cache_not_found_entries_uint)) {
+      cache_not_found_entries =
+          json_integer_value(cache_not_found_entries_uint);
+    } else if (cache_not_found_entries_uint != NULL) {
+      json_decref(root);
+      free(site_root);
+      free_listeners(network.listeners, network.listener_count);
+
+      return handle_parse_err("cache", "not_found_entries");
+    }
+  } else if (cache_object != NULL) {
+    json_decref(root);
+    free(site_root);
+    free_listeners(network.listeners, network.listener_count);
+
+    return handle_parse_err("root", "cache");
+  }
+
   json_t *ssl_object = json_object_get(root, "ssl");
   if (!json_is_object(ssl_object)) {
     json_decref(root);
     free(site_root);
-    free(ip);
+    free_listeners(network.listeners, network.listener_count);
 
     return -1;
   }
@@ -348,7 +1003,7 @@ int read_config(Config *config) {
   } else {
     json_decref(root);
     free(site_root);
-    free(ip);
+    free_listeners(network.listeners, network.listener_count);
 
     return handle_parse_err("ssl", "enabled");
   }
@@ -361,18 +1016,63 @@ int read_config(Config *config) {
   } else {
     json_decref(root);
     free(site_root);
-    free(ip);
+    free_listeners(network.listeners, network.listener_count);
 
     return handle_parse_err("ssl", "mem_cached");
   }
 
+  json_t *session_tickets_bool = json_object_get(ssl_object, "session_tickets");
+
+  // optional, configs written before tickets existed keep them on
+  bool session_tickets = true;
+  if (json_is_boolean(session_tickets_bool)) {
+    session_tickets = json_boolean_value(session_tickets_bool);
+  } else if (session_tickets_bool != NULL) {
+    json_decref(root);
+    free(site_root);
+    free_listeners(network.listeners, network.listener_count);
+
+    return handle_parse_err("ssl", "session_tickets");
+  }
+
+  json_t *ticket_keyfile_string = json_object_get(ssl_object, "ticket_keyfile");
+
+  // optional, "" keeps the keys in memory
+  char *ticket_keyfile = NULL;
+  if (json_is_string(ticket_keyfile_string)) {
+    if (json_string_length(ticket_keyfile_string) != 0)
+      ticket_keyfile = strdup(json_string_value(ticket_keyfile_string));
+  } else if (ticket_keyfile_string != NULL) {
+    json_decref(root);
+    free(site_root);
+    free_listeners(network.listeners, network.listener_count);
+
+    return handle_parse_err("ssl", "ticket_keyfile");
+  }
+
+  json_t *ktls_bool = json_object_get(ssl_object, "ktls");
+
+  // optional, off unless asked for
+  bool ktls = false;
+  if (json_is_boolean(ktls_bool)) {
+    ktls = json_boolean_value(ktls_bool);
+  } else if (ktls_bool != NULL) {
+    json_decref(root);
+    free(site_root);
+    free_listeners(network.listeners, network.listener_count);
+    free(ticket_keyfile);
+
+    return handle_parse_err("ssl", "ktls");
+  }
+
   json_t *cert_path_string = json_object_get(ssl_object, "cert_path");
 
   char *cert_path = (char *)malloc(1024);
   if (!cert_path) {
     json_decref(root);
     free(site_root);
-    free(ip);
+    free_listeners(network.listeners, network.listener_count);
+    free(ticket_keyfile);
 
     return -1;
   }
@@ -382,7 +1082,8 @@ int read_config(Config *config) {
   } else {
     json_decref(root);
     free(site_root);
-    free(ip);
+    free_listeners(network.listeners, network.listener_count);
+    free(ticket_keyfile);
     free(cert_path);
 
     return handle_parse_err("ssl", "cert_path");
@@ -393,7 +1094,8 @@ int read_config(Config *config) {
   char *key_path = (char *)malloc(1024);
   if (!key_path) {
     free(site_root);
-    free(ip);
+    free_listeners(network.listeners, network.listener_count);
+    free(ticket_keyfile);
     free(cert_path);
     json_decref(root);
 
@@ -405,25 +1107,123 @@ int read_config(Config *config) {
   } else {
     json_decref(root);
     free(site_root);
-    free(ip);
+    free_listeners(network.listeners, network.listener_count);
+    free(ticket_keyfile);
     free(cert_path);
     free(key_path);
 
     return handle_parse_err("ssl", "key_path");
   }
 
+  json_t *pack_string = json_object_get(root, "pack");
+
+  // optional, "" serves site_root straight from the filesystem
+  char *pack = NULL;
+  if (json_is_string(pack_string)) {
+    if (json_string_length(pack_string) != 0)
+      pack = strdup(json_string_value(pack_string));
+  } else if (pack_string != NULL) {
+    json_decref(root);
+    free(site_root);
+    free_listeners(network.listeners, network.listener_count);
+    free(ticket_keyfile);
+    free(cert_path);
+    free(key_path);
+
+    return handle_parse_err("root", "pack");
+  }
+
+  json_t *mime_object = json_object_get(root, "mime_types");
+
+  // optional, overrides and additions to the built-in MIME table
+  config->mime_types = NULL;
+  config->mime_type_count = 0;
+  if (mime_object != NULL && read_mime_types(mime_object, config) != 0) {
+    json_decref(root);
+    free(site_root);
+    free_listeners(network.listeners, network.listener_count);
+    free(ticket_keyfile);
+    free(cert_path);
+    free(key_path);
+    free(pack);
+
+    return -1;
+  }
+
+  json_t *http_cache_object = json_object_get(root, "http_cache");
+
+  // optional, older configs get content ETags and immutable fingerprints
+  httpCacheConfig http_cache = {.content_etags = true,
+                                .immutable_fingerprinted = true};
+  if (http_cache_object != NULL &&
+      (!json_is_object(http_cache_object) ||
+       read_http_cache(http_cache_object, &http_cache) != 0)) {
+    json_decref(root);
+    free(site_root);
+    free_listeners(network.listeners, network.listener_count);
+    free(ticket_keyfile);
+    free(cert_path);
+    free(key_path);
+    free(pack);
+    free_mime_types(config->mime_types, config->mime_type_count);
+    config->mime_types = NULL;
+    config->mime_type_count = 0;
+
+    if (!json_is_object(http_cache_object))
+      return handle_parse_err("root", "http_cache");
+    return -1;
+  }
+
+  json_t *api_object = json_object_get(root, "api");
+
+  // optional, without it /api/lag stays closed
+  apiConfig api = {0};
+  if (api_object != NULL &&
+      (!json_is_object(api_object) || read_api(api_object, &api) != 0)) {
+    json_decref(root);
+    free(site_root);
+    free_listeners(network.listeners, network.listener_count);
+    free(ticket_keyfile);
+    free(cert_path);
+    free(key_path);
+    free(pack);
+    free_mime_types(config->mime_types, config->mime_type_count);
+    config->mime_types = NULL;
+    config->mime_type_count = 0;
+    free_policies(http_cache.policies, http_cache.policy_count);
+
+    if (!json_is_object(api_object))
+      return handle_parse_err("root", "api");
+    return -1;
+  }
+
   config->site_root = site_root;
+  config->workers = workers;
   config->log_type = log_type;
+  config->log_compress = log_compress;
+  config->slow_handler_ms = slow_handler_ms;
+  config->pack = pack;
 
-  config->network.ip = ip;
-  config->network.port = port;
+  config->network = network;
 
   config->compression.enabled = compression_enabled;
   config->compression.quality = compression_quality;
   config->compression.min_size = compression_min_size;
+  config->compression.precompress = precompress;
+
+  config->cache.enabled = cache_enabled;
+  config->cache.max_bytes = cache_max_bytes;
+  config->cache.max_file_size = cache_max_file_size;
+  config->cache.not_found_entries = cache_not_found_entries;
+
+  config->http_cache = http_cache;
+  config->api = api;
 
   config->ssl.enabled = ssl_enabled;
   config->ssl.mem_cached = mem_cached;
+  config->ssl.session_tickets = session_tickets;
+  config->ssl.ticket_keyfile = ticket_keyfile;
+  config->ssl.ktls = ktls;
   config->ssl.cert_path = cert_path;
   config->ssl.key_path = key_path;
 
@@ -434,7 +1234,12 @@ int read_config(Config *config) {
 
 int free_config(Config *config) {
   free(config->site_root);
-  free(config->network.ip);
+  free(config->pack);
+  free_mime_types(config->mime_types, config->mime_type_count);
+  free_policies(config->http_cache.policies, config->http_cache.policy_count);
+  free_lag_allow(config->api.lag_allow, config->api.lag_allow_count);
+  free_listeners(config->network.listeners, config->network.listener_count);
+  free(config->ssl.ticket_keyfile);
   free(config->ssl.cert_path);
   free(config->ssl.key_path);
   return 0;
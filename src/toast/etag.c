@@ -0,0 +1,576 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <h2o.h>
+
+#include <async.h>
+#include <cachepolicy.h>
+#include <etag.h>
+#include <file.h>
+#include <snapshot.h>
+
+#define PRIME64_1 0x9e3779b185ebca87ull
+#define PRIME64_2 0xc2b2ae3d27d4eb4full
+#define PRIME64_3 0x165667b19e3779f9ull
+#define PRIME64_4 0x85ebca77c2b2ae63ull
+#define PRIME64_5 0x27d4eb2f165667c5ull
+
+typedef struct siteHash {
+  struct siteHash *hash_next;
+  uint64_t path_hash;
+  char *path; // relative to site_root, starting with a slash
+  size_t path_len;
+  // the file as it was hashed
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  uint64_t hash;
+  bool known;
+  bool pending; // a request is hashing it again
+} siteHash;
+
+struct siteHashes {
+  pthread_rwlock_t lock; // workers read, rehashes write
+  siteHash **buckets;
+  size_t bucket_count;
+  size_t count;
+  char *site_root;
+  atomic_size_t refcnt; // the handler and every rehash in flight
+};
+
+typedef enum { HashKnown, HashStale, HashPending } hashState;
+
+typedef struct {
+  siteHashes *hashes;
+  char path[1024];
+  size_t path_len;
+  char fs_path[1024];
+  struct stat st;
+  uint64_t hash;
+  int err;
+} rehashJob;
+
+typedef struct {
+  h2o_handler_t super;
+  char *site_root; // without a trailing slash
+  siteHashes *hashes;
+} staticHeadersHandler;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+  acc += input * PRIME64_2;
+  return rotl64(acc, 31) * PRIME64_1;
+}
+
+static inline uint64_t merge64(uint64_t acc, uint64_t v) {
+  acc ^= round64(0, v);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+typedef struct {
+  uint64_t v1, v2, v3, v4;
+  uint64_t total;
+  unsigned char stripe[32]; // input short of a whole stripe
+  size_t stripe_len;
+} xxh64State;
+
+static void hash_init(xxh64State *state) {
+  state->v1 = PRIME64_1 + PRIME64_2;
+  state->v2 = PRIME64_2;
+  state->v3 = 0;
+  state->v4 = -PRIME64_1;
+  state->total = 0;
+  state->stripe_len = 0;
+}
+
+static inline void hash_stripe(xxh64State *state, const unsigned char *p) {
+  // four independent lanes keep the multipliers busy
+  state->v1 = round64(state->v1, read64(p));
+  state->v2 = round64(state->v2, read64(p + 8));
+  state->v3 = round64(state->v3, read64(p + 16));
+  state->v4 = round64(state->v4, read64(p + 24));
+}
+
+static void hash_update(xxh64State *state, const void *data, size_t len) {
+  const unsigned char *p = data, *end = p + len;
+
+  state->total += len;
+  if (state->stripe_len + len < 32) {
+    if (len)
+      memcpy(state->stripe + state->stripe_len, p, len);
+    state->stripe_len += len;
+    return;
+  }
+
+  if (state->stripe_len) {
+    size_t fill = 32 - state->stripe_len;
+
+    memcpy(state->stripe + state->stripe_len, p, fill);
+    hash_stripe(state, state->stripe);
+    p += fill;
+    state->stripe_len = 0;
+  }
+  for (; end - p >= 32; p += 32)
+    hash_stripe(state, p);
+
+  state->stripe_len = end - p;
+  if (state->stripe_len)
+    memcpy(state->stripe, p, state->stripe_len);
+}
+
+static uint64_t hash_finish(const xxh64State *state) {
+  const unsigned char *p = state->stripe, *end = p + state->stripe_len;
+  uint64_t hash;
+
+  if (state->total >= 32) {
+    hash = rotl64(state->v1, 1) + rotl64(state->v2, 7) +
+           rotl64(state->v3, 12) + rotl64(state->v4, 18);
+    hash = merge64(hash, state->v1);
+    hash = merge64(hash, state->v2);
+    hash = merge64(hash, state->v3);
+    hash = merge64(hash, state->v4);
+  } else {
+    hash = PRIME64_5;
+  }
+
+  hash += state->total;
+  for (; end - p >= 8; p += 8) {
+    hash ^= round64(0, read64(p));
+    hash = rotl64(hash, 27) * PRIME64_1 + PRIME64_4;
+  }
+  if (end - p >= 4) {
+    hash ^= read32(p) * PRIME64_1;
+    hash = rotl64(hash, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    hash ^= *p * PRIME64_5;
+    hash = rotl64(hash, 11) * PRIME64_1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= PRIME64_2;
+  hash ^= hash >> 29;
+  hash *= PRIME64_3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+uint64_t hash_content(const void *data, size_t len) {
+  xxh64State state;
+
+  hash_init(&state);
+  hash_update(&state, data, len);
+  return hash_finish(&state);
+}
+
+void format_content_etag(char *buf, uint64_t hash) {
+  snprintf(buf, CONTENT_ETAG_LEN + 1, "\"%016" PRIx64 "\"", hash);
+}
+
+/* read, not mmap: a file truncated under a mapping raises SIGBUS, and sites
+ * get rewritten while they're served */
+static int hash_file(const char *fs_path, uint64_t *hash, struct stat *st) {
+  int fd = open(fs_path, O_RDONLY | O_CLOEXEC);
+  unsigned char buf[65536];
+  xxh64State state;
+  off_t offset = 0;
+
+  if (fd == -1)
+    return -1;
+  if (fstat(fd, st) != 0 || !S_ISREG(st->st_mode)) {
+    close(fd);
+    return -1;
+  }
+
+  hash_init(&state);
+  while (offset < st->st_size) {
+    size_t want = st->st_size - offset < (off_t)sizeof(buf)
+                      ? (size_t)(st->st_size - offset)
+                      : sizeof(buf);
+    ssize_t r = pread(fd, buf, want, offset);
+
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r <= 0) {
+      if (r == 0)
+        errno = EIO; // shrank while we read it, hash it next time
+      close(fd);
+      return -1;
+    }
+    hash_update(&state, buf, r);
+    offset += r;
+  }
+
+  close(fd);
+  *hash = hash_finish(&state);
+  return 0;
+}
+
+static bool same_file(const siteHash *entry, const struct stat *st) {
+  return entry->ino == st->st_ino && entry->dev == st->st_dev &&
+         entry->size == st->st_size &&
+         entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+         entry->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static void remember(siteHash *entry, const struct stat *st, uint64_t hash) {
+  entry->dev = st->st_dev;
+  entry->ino = st->st_ino;
+  entry->size = st->st_size;
+  entry->mtime = st->st_mtim;
+  entry->hash = hash;
+  entry->known = true;
+}
+
+static siteHash *find_hash(siteHashes *hashes, const char *path, size_t len) {
+  uint64_t path_hash = hash_content(path, len);
+  siteHash *entry = hashes->buckets[path_hash & (hashes->bucket_count - 1)];
+
+  for (; entry; entry = entry->hash_next)
+    if (entry->path_hash == path_hash &&
+        h2o_memis(entry->path, entry->path_len, path, len))
+      return entry;
+  return NULL;
+}
+
+static void grow_buckets(siteHashes *hashes) {
+  size_t bucket_count = hashes->bucket_count * 2;
+  siteHash **buckets = calloc(bucket_count, sizeof(*buckets));
+
+  if (!buckets)
+    return;
+
+  for (size_t i = 0; i < hashes->bucket_count; ++i) {
+    siteHash *entry = hashes->buckets[i], *next;
+    for (; entry; entry = next) {
+      next = entry->hash_next;
+      entry->hash_next = buckets[entry->path_hash & (bucket_count - 1)];
+      buckets[entry->path_hash & (bucket_count - 1)] = entry;
+    }
+  }
+
+  free(hashes->buckets);
+  hashes->buckets = buckets;
+  hashes->bucket_count = bucket_count;
+}
+
+// entries are never removed, a deleted file just never matches again
+static siteHash *insert_hash(siteHashes *hashes, const char *path,
+                             size_t len) {
+  siteHash *entry = calloc(1, sizeof(*entry));
+
+  if (!entry || (entry->path = malloc(len)) == NULL) {
+    free(entry);
+    return NULL;
+  }
+
+  if (hashes->count >= hashes->bucket_count)
+    grow_buckets(hashes);
+
+  memcpy(entry->path, path, len);
+  entry->path_len = len;
+  entry->path_hash = hash_content(path, len);
+
+  siteHash **bucket =
+      &hashes->buckets[entry->path_hash & (hashes->bucket_count - 1)];
+  entry->hash_next = *bucket;
+  *bucket = entry;
+  ++hashes->count;
+  return entry;
+}
+
+static void release_hashes(siteHashes *hashes) {
+  if (atomic_fetch_sub_explicit(&hashes->refcnt, 1, memory_order_acq_rel) !=
+      1)
+    return;
+
+  for (size_t i = 0; hashes->buckets && i < hashes->bucket_count; ++i) {
+    siteHash *entry = hashes->buckets[i], *next;
+    for (; entry; entry = next) {
+      next = entry->hash_next;
+      free(entry->path);
+      free(entry);
+    }
+  }
+
+  pthread_rwlock_destroy(&hashes->lock);
+  free(hashes->buckets);
+  free(hashes->site_root);
+  free(hashes);
+}
+
+static int hash_entry(const char *path, const char *rel_path, struct stat *st,
+                      void *data) {
+  siteHashes *hashes = data;
+  struct stat hashed_st;
+  uint64_t hash;
+  siteHash *entry;
+
+  if (S_ISDIR(st->st_mode))
+    return 0;
+
+  if (hash_file(path, &hash, &hashed_st) != 0) {
+    fprintf(stderr, "etag: failed to hash %s: %s\n", path, strerror(errno));
+    return 0;
+  }
+
+  if ((entry = insert_hash(hashes, rel_path, strlen(rel_path))) == NULL)
+    return -1;
+  remember(entry, &hashed_st, hash);
+  return 0;
+}
+
+siteHashes *hash_site(const char *site_root) {
+  siteHashes *hashes = calloc(1, sizeof(*hashes));
+  size_t root_len = strlen(site_root);
+
+  if (!hashes)
+    return NULL;
+
+  hashes->bucket_count = 256;
+  hashes->buckets = calloc(hashes->bucket_count, sizeof(*hashes->buckets));
+  hashes->site_root = strdup(site_root);
+  atomic_init(&hashes->refcnt, 1);
+  pthread_rwlock_init(&hashes->lock, NULL);
+  if (!hashes->buckets || !hashes->site_root) {
+    release_hashes(hashes);
+    return NULL;
+  }
+
+  // request paths start with a slash, so keep the root without one
+  while (root_len > 1 && hashes->site_root[root_len - 1] == '/')
+    hashes->site_root[--root_len] = '\0';
+
+  if (walk_dir(site_root, "", hash_entry, hashes) != 0)
+    fprintf(stderr, "etag: failed to hash all of %s\n", site_root);
+  return hashes;
+}
+
+bool find_site_hash(siteHashes *hashes, const char *rel_path, size_t len,
+                    uint64_t *hash) {
+  siteHash *entry;
+  bool found = false;
+
+  pthread_rwlock_rdlock(&hashes->lock);
+  if ((entry = find_hash(hashes, rel_path, len)) != NULL && entry->known) {
+    *hash = entry->hash;
+    found = true;
+  }
+  pthread_rwlock_unlock(&hashes->lock);
+  return found;
+}
+
+static hashState lookup_hash(siteHashes *hashes, const char *path, size_t len,
+                             const struct stat *st, uint64_t *hash) {
+  hashState state = HashKnown;
+  siteHash *entry;
+
+  pthread_rwlock_rdlock(&hashes->lock);
+  entry = find_hash(hashes, path, len);
+  if (entry && entry->known && same_file(entry, st)) {
+    *hash = entry->hash;
+    pthread_rwlock_unlock(&hashes->lock);
+    return HashKnown;
+  }
+  pthread_rwlock_unlock(&hashes->lock);
+
+  // changed or new since startup, the first request to notice hashes it
+  pthread_rwlock_wrlock(&hashes->lock);
+  if ((entry = find_hash(hashes, path, len)) == NULL &&
+      (entry = insert_hash(hashes, path, len)) == NULL) {
+    state = HashPending;
+  } else if (entry->known && same_file(entry, st)) {
+    *hash = entry->hash;
+  } else if (entry->pending) {
+    state = HashPending;
+  } else {
+    entry->pending = true;
+    state = HashStale;
+  }
+  pthread_rwlock_unlock(&hashes->lock);
+  return state;
+}
+
+static void add_cache_control(h2o_req_t *req) {
+  h2o_iovec_t cache_control =
+      cache_control_for(&get_snapshot(req)->config, req->path_normalized.base,
+                        req->path_normalized.len);
+
+  if (cache_control.len != 0)
+    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CACHE_CONTROL,
+                   NULL, cache_control.base, cache_control.len);
+}
+
+// 0 when it answered with a 304, -1 leaves the body to the file handler
+static int send_validators(h2o_req_t *req, const uint64_t *hash) {
+  static h2o_generator_t generator = {NULL, NULL};
+  char *etag;
+
+  add_cache_control(req);
+  if (!hash)
+    return -1;
+
+  etag = h2o_mem_alloc_pool(&req->pool, char, CONTENT_ETAG_LEN + 1);
+  format_content_etag(etag, *hash);
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_ETAG, NULL, etag,
+                 CONTENT_ETAG_LEN);
+
+  if (!header_contains(req, H2O_TOKEN_IF_NONE_MATCH, etag))
+    return -1;
+
+  req->res.status = 304;
+  req->res.reason = "Not Modified";
+  h2o_start_response(req, &generator);
+  h2o_send(req, NULL, 0, H2O_SEND_STATE_FINAL);
+  return 0;
+}
+
+static void rehash(void *data) {
+  rehashJob *job = data;
+  job->err = hash_file(job->fs_path, &job->hash, &job->st) == 0 ? 0 : errno;
+}
+
+static void on_rehashed(h2o_req_t *req, void *data) {
+  rehashJob *job = data;
+  siteHashes *hashes = job->hashes;
+  siteHash *entry;
+
+  pthread_rwlock_wrlock(&hashes->lock);
+  if ((entry = find_hash(hashes, job->path, job->path_len)) != NULL) {
+    if (job->err == 0)
+      remember(entry, &job->st, job->hash);
+    else
+      entry->known = false;
+    entry->pending = false;
+  }
+  pthread_rwlock_unlock(&hashes->lock);
+
+  // gone or unreadable now, whatever answers it shouldn't be cached
+  if (req && (job->err != 0 || send_validators(req, &job->hash) != 0))
+    h2o_delegate_request(req);
+
+  release_hashes(hashes);
+  free(job);
+}
+
+static int queue_rehash(h2o_req_t *req, siteHashes *hashes, const char *path,
+                        size_t len, const char *fs_path) {
+  rehashJob *job = calloc(1, sizeof(*job));
+
+  if (!job)
+    return -1;
+
+  job->hashes = hashes;
+  memcpy(job->path, path, len);
+  job->path_len = len;
+  strcpy(job->fs_path, fs_path);
+
+  atomic_fetch_add_explicit(&hashes->refcnt, 1, memory_order_relaxed);
+  if (queue_work(req, rehash, on_rehashed, job) != 0) {
+    release_hashes(hashes);
+    free(job);
+    return -1;
+  }
+  return 0;
+}
+
+static void forget_pending(siteHashes *hashes, const char *path, size_t len) {
+  siteHash *entry;
+
+  pthread_rwlock_wrlock(&hashes->lock);
+  if ((entry = find_hash(hashes, path, len)) != NULL)
+    entry->pending = false;
+  pthread_rwlock_unlock(&hashes->lock);
+}
+
+static int on_req(h2o_handler_t *_self, h2o_req_t *req) {
+  staticHeadersHandler *self = (staticHeadersHandler *)_self;
+  siteHashes *hashes = self->hashes;
+  h2o_iovec_t path = req->path_normalized;
+  char rel_path[1024], fs_path[1024];
+  struct stat st;
+  uint64_t hash;
+  int len;
+
+  if (!h2o_memis(req->method.base, req->method.len, H2O_STRLIT("GET")) &&
+      !h2o_memis(req->method.base, req->method.len, H2O_STRLIT("HEAD")))
+    return -1;
+
+  len = snprintf(rel_path, 1024, "%.*s%s", (int)path.len, path.base,
+                 path.base[path.len - 1] == '/' ? "index.html" : "");
+  if (len <= 0 || len >= 1024 ||
+      snprintf(fs_path, 1024, "%s%s", self->site_root, rel_path) >= 1024)
+    return -1;
+
+  /* missing files and directories are the file handler's to answer, and
+   * their 404s and redirects mustn't pick up a year of Cache-Control */
+  if (stat(fs_path, &st) != 0 || !S_ISREG(st.st_mode))
+    return -1;
+
+  if (!hashes)
+    return send_validators(req, NULL);
+
+  switch (lookup_hash(hashes, rel_path, len, &st, &hash)) {
+  case HashKnown:
+    return send_validators(req, &hash);
+  case HashStale:
+    if (queue_rehash(req, hashes, rel_path, len, fs_path) == 0)
+      return 0;
+    forget_pending(hashes, rel_path, len);
+    return send_validators(req, NULL);
+  case HashPending:
+  default:
+    // the request that noticed the change is hashing it, go without
+    return send_validators(req, NULL);
+  }
+}
+
+static void on_dispose(h2o_handler_t *_self) {
+  staticHeadersHandler *self = (staticHeadersHandler *)_self;
+
+  if (self->hashes)
+    release_hashes(self->hashes);
+  free(self->site_root);
+}
+
+void register_static_headers(h2o_pathconf_t *pathconf, const char *site_root,
+                             siteHashes *hashes) {
+  staticHeadersHandler *self =
+      (staticHeadersHandler *)h2o_create_handler(pathconf, sizeof(*self));
+  size_t root_len = strlen(site_root);
+
+  self->site_root = h2o_strdup(NULL, site_root, root_len).base;
+  while (root_len > 1 && self->site_root[root_len - 1] == '/')
+    self->site_root[--root_len] = '\0';
+
+  self->hashes = hashes;
+  self->super.on_req = on_req;
+  self->super.dispose = on_dispose;
+}
@@ -1,5 +1,4 @@
-// #include <magic.h>
-#include <regex.h>
+#include <dirent.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,37 +6,9 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
-#include <file.h>
-
-/*
-char *get_mime(const char *path) {
-  char *mime = (char *)malloc(1024);
-
-  regex_t regex_js;
-  regex_t regex_css;
-
-  regcomp(&regex_js, "^.*\\.(js)$", REG_EXTENDED);
-  regcomp(&regex_css, "^.*\\.(css)$", REG_EXTENDED);
-
-  magic_t magic = magic_open(MAGIC_MIME_TYPE);
-  magic_load(magic, NULL);
-
-  char *mime_type = (char *)magic_file(magic, path);
-  if (strncmp(mime_type, "image/vnd.microsoft.icon", 24) == 0)
-    mime_type = "image/x-icon";
-  else if (regexec(&regex_js, path, 0, NULL, 0) == 0)
-    mime_type = "text/javascript";
-  else if (regexec(&regex_css, path, 0, NULL, 0) == 0)
-    mime_type = "text/css";
+#include <h2o.h>
 
-  strlcpy(mime, mime_type, 1024);
-
-  regfree(&regex_css);
-  regfree(&regex_js);
-  magic_close(magic);
-  return mime;
-}
-*/
+#include <file.h>
 
 char *get_cwd(void) {
   char *cwd = malloc(1024);
@@ -116,3 +87,49 @@ char *read_file(const char *path) {
 
   return buf;
 }
+
+int walk_dir(const char *dir_path, const char *rel_path, walk_cb cb,
+             void *data) {
+  DIR *dir = opendir(dir_path);
+  struct dirent *ent;
+  size_t dir_len = strlen(dir_path);
+  int r = 0;
+
+  if (!dir)
+    return -1;
+
+  while (r == 0 && (ent = readdir(dir)) != NULL) {
+    char path[1024], rel[1024];
+    struct stat st;
+
+    if (ent->d_name[0] == '.')
+      continue;
+
+    if (dir_len > 0 && dir_path[dir_len - 1] == '/')
+      snprintf(path, 1024, "%s%s", dir_path, ent->d_name);
+    else
+      snprintf(path, 1024, "%s/%s", dir_path, ent->d_name);
+    snprintf(rel, 1024, "%s/%s", rel_path, ent->d_name);
+
+    if (stat(path, &st) != 0)
+      continue;
+
+    if (S_ISDIR(st.st_mode)) {
+      if ((r = cb(path, rel, &st, data)) == 0)
+        r = walk_dir(path, rel, cb, data);
+    } else if (S_ISREG(st.st_mode)) {
+      r = cb(path, rel, &st, data);
+    }
+  }
+
+  closedir(dir);
+  return r;
+}
+
+bool header_contains(h2o_req_t *req, const h2o_token_t *token,
+                     const char *value) {
+  ssize_t index = h2o_find_header(&req->headers, token, -1);
+  return index != -1 && h2o_strstr(req->headers.entries[index].value.base,
+                                   req->headers.entries[index].value.len,
+                                   value, strlen(value)) != SIZE_MAX;
+}
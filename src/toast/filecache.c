@@ -0,0 +1,611 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <h2o.h>
+
+#include <cachepolicy.h>
+#include <etag.h>
+#include <file.h>
+#include <filecache.h>
+#include <fileio.h>
+#include <mime.h>
+#include <precompress.h>
+#include <sitewatch.h>
+#include <snapshot.h>
+
+#define MISS_SLOTS 1024 // a power of two, scanners just overwrite each other
+#define IDENTITY PRECOMPRESS_ENCODINGS
+
+typedef struct cacheEntry {
+  struct cacheEntry *hash_next;
+  struct cacheEntry *lru_prev, *lru_next;
+  uint64_t hash;
+  h2o_iovec_t path;
+  h2o_iovec_t mime;
+  h2o_iovec_t cache_control; // points into the snapshot's config
+  h2o_iovec_t bodies[PRECOMPRESS_ENCODINGS + 1];
+  char etags[PRECOMPRESS_ENCODINGS + 1][32];
+  char last_modified[H2O_TIMESTR_RFC1123_LEN + 1];
+  unsigned int variants;
+  size_t bytes;
+  size_t refcnt; // responses still sending from this entry
+  bool linked;
+} cacheEntry;
+
+// a path the file handler answered last time, valid for one generation
+typedef struct {
+  uint64_t hash;
+  uint64_t generation;
+  char *path;
+  size_t len;
+} knownMiss;
+
+typedef struct {
+  cacheEntry **buckets;
+  size_t bucket_count;
+  size_t count;
+  cacheEntry lru; // sentinel, lru.lru_next is the most recently used
+  size_t bytes;
+  size_t budget;
+  size_t max_file_size;
+  const char *site_root;
+
+  uint64_t generation; // bumped by every invalidation
+  knownMiss known_misses[MISS_SLOTS];
+
+  siteWatch *watch;
+
+  atomic_size_t hits;
+  atomic_size_t misses;
+  atomic_size_t evictions;
+  atomic_size_t stat_entries;
+  atomic_size_t stat_bytes;
+} fileCache;
+
+// a miss being read, identity first and then each precompressed variant
+typedef struct {
+  fileCache *cache;
+  cacheEntry *entry;
+  uint64_t generation; // the cache's when the load started
+  int step;
+  time_t mtime;
+  char fs_path[1024];
+} entryLoad;
+
+typedef struct {
+  h2o_handler_t super;
+  char *site_root;
+  size_t budget;
+  size_t max_file_size;
+} fileCacheHandler;
+
+// one cache per worker context, across every generation still running
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fileCache **registry;
+static size_t registry_count, registry_capacity;
+
+static uint64_t hash_path(const char *path, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= (unsigned char)path[i];
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+static void lru_unlink(cacheEntry *entry) {
+  entry->lru_prev->lru_next = entry->lru_next;
+  entry->lru_next->lru_prev = entry->lru_prev;
+}
+
+static void lru_push_front(fileCache *cache, cacheEntry *entry) {
+  entry->lru_prev = &cache->lru;
+  entry->lru_next = cache->lru.lru_next;
+  cache->lru.lru_next->lru_prev = entry;
+  cache->lru.lru_next = entry;
+}
+
+static void free_entry(cacheEntry *entry) {
+  for (int i = 0; i <= IDENTITY; ++i)
+    free(entry->bodies[i].base);
+  free(entry->path.base);
+  free(entry);
+}
+
+static void release_entry(cacheEntry *entry) {
+  if (--entry->refcnt == 0 && !entry->linked)
+    free_entry(entry);
+}
+
+static void on_response_dispose(void *p) { release_entry(*(cacheEntry **)p); }
+
+static void update_stats(fileCache *cache) {
+  atomic_store_explicit(&cache->stat_entries, cache->count,
+                        memory_order_relaxed);
+  atomic_store_explicit(&cache->stat_bytes, cache->bytes,
+                        memory_order_relaxed);
+}
+
+static void remove_entry(fileCache *cache, cacheEntry *entry) {
+  cacheEntry **slot = &cache->buckets[entry->hash & (cache->bucket_count - 1)];
+
+  while (*slot != entry)
+    slot = &(*slot)->hash_next;
+  *slot = entry->hash_next;
+
+  lru_unlink(entry);
+  entry->linked = false;
+  cache->bytes -= entry->bytes;
+  --cache->count;
+
+  // responses in flight keep the bodies alive until they're done
+  if (entry->refcnt == 0)
+    free_entry(entry);
+}
+
+static cacheEntry *find_entry(fileCache *cache, const char *path, size_t len) {
+  uint64_t hash = hash_path(path, len);
+  cacheEntry *entry = cache->buckets[hash & (cache->bucket_count - 1)];
+
+  for (; entry; entry = entry->hash_next)
+    if (entry->hash == hash && h2o_memis(entry->path.base, entry->path.len,
+                                         path, len))
+      return entry;
+  return NULL;
+}
+
+static void invalidate(fileCache *cache, const char *path, size_t len) {
+  cacheEntry *entry = find_entry(cache, path, len);
+  if (entry)
+    remove_entry(cache, entry);
+}
+
+// everything under a directory that was moved or deleted
+static void invalidate_tree(fileCache *cache, const char *dir, size_t len) {
+  cacheEntry *entry = cache->lru.lru_next, *next;
+
+  for (; entry != &cache->lru; entry = next) {
+    next = entry->lru_next;
+    if (entry->path.len > len && entry->path.base[len] == '/' &&
+        memcmp(entry->path.base, dir, len) == 0)
+      remove_entry(cache, entry);
+  }
+}
+
+static void flush(fileCache *cache) {
+  ++cache->generation;
+  while (cache->lru.lru_next != &cache->lru)
+    remove_entry(cache, cache->lru.lru_next);
+  update_stats(cache);
+}
+
+static bool is_known_miss(fileCache *cache, const char *path, size_t len) {
+  uint64_t hash = hash_path(path, len);
+  knownMiss *miss = &cache->known_misses[hash & (MISS_SLOTS - 1)];
+
+  return miss->path && miss->generation == cache->generation &&
+         miss->hash == hash && h2o_memis(miss->path, miss->len, path, len);
+}
+
+// takes the entry's path, the entry is freed right after
+static void remember_miss(fileCache *cache, cacheEntry *entry,
+                          uint64_t generation) {
+  knownMiss *miss = &cache->known_misses[entry->hash & (MISS_SLOTS - 1)];
+
+  free(miss->path);
+  miss->hash = entry->hash;
+  miss->generation = generation;
+  miss->path = entry->path.base;
+  miss->len = entry->path.len;
+  entry->path.base = NULL;
+}
+
+static void forget_misses(fileCache *cache) {
+  for (size_t i = 0; i < MISS_SLOTS; ++i) {
+    free(cache->known_misses[i].path);
+    cache->known_misses[i].path = NULL;
+  }
+}
+
+static void grow_buckets(fileCache *cache) {
+  size_t bucket_count = cache->bucket_count * 2;
+  cacheEntry **buckets = calloc(bucket_count, sizeof(*buckets));
+
+  if (!buckets)
+    return;
+
+  for (size_t i = 0; i < cache->bucket_count; ++i) {
+    cacheEntry *entry = cache->buckets[i], *next;
+    for (; entry; entry = next) {
+      next = entry->hash_next;
+      entry->hash_next = buckets[entry->hash & (bucket_count - 1)];
+      buckets[entry->hash & (bucket_count - 1)] = entry;
+    }
+  }
+
+  free(cache->buckets);
+  cache->buckets = buckets;
+  cache->bucket_count = bucket_count;
+}
+
+static void insert_entry(fileCache *cache, cacheEntry *entry) {
+  while (cache->bytes + entry->bytes > cache->budget &&
+         cache->lru.lru_prev != &cache->lru) {
+    remove_entry(cache, cache->lru.lru_prev);
+    atomic_fetch_add_explicit(&cache->evictions, 1, memory_order_relaxed);
+  }
+
+  if (cache->count >= cache->bucket_count)
+    grow_buckets(cache);
+
+  cacheEntry **bucket =
+      &cache->buckets[entry->hash & (cache->bucket_count - 1)];
+  entry->hash_next = *bucket;
+  *bucket = entry;
+  lru_push_front(cache, entry);
+  entry->linked = true;
+  cache->bytes += entry->bytes;
+  ++cache->count;
+  update_stats(cache);
+}
+
+// the body's hash when the fallback file handler sends content ETags too
+static void format_etag(char *buf, const Config *config, h2o_iovec_t body,
+                        const struct stat *st) {
+  if (config->http_cache.content_etags)
+    format_content_etag(buf, hash_content(body.base, body.len));
+  else
+    snprintf(buf, 32, "\"%08x-%zx\"", (unsigned int)st->st_mtime,
+             (size_t)st->st_size);
+}
+
+static void send_entry(h2o_req_t *req, cacheEntry *entry) {
+  static h2o_generator_t generator = {NULL, NULL};
+  bool is_head = h2o_memis(req->method.base, req->method.len,
+                           H2O_STRLIT("HEAD"));
+  int chosen = IDENTITY;
+
+  cacheEntry **ref =
+      h2o_mem_alloc_shared(&req->pool, sizeof(*ref), on_response_dispose);
+  *ref = entry;
+  ++entry->refcnt;
+
+  if (entry->variants) {
+    unsigned int usable = accepted_encodings(req) & entry->variants;
+    for (int i = 0; i < PRECOMPRESS_ENCODINGS; ++i) {
+      if (usable & precompress_variants[i].encoding) {
+        chosen = i;
+        break;
+      }
+    }
+    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_VARY, NULL,
+                   H2O_STRLIT("Accept-Encoding"));
+  }
+
+  const char *etag = entry->etags[chosen];
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_ETAG, NULL, etag,
+                 strlen(etag));
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_LAST_MODIFIED, NULL,
+                 entry->last_modified, H2O_TIMESTR_RFC1123_LEN);
+  if (entry->cache_control.len != 0)
+    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CACHE_CONTROL,
+                   NULL, entry->cache_control.base, entry->cache_control.len);
+
+  if (header_contains(req, H2O_TOKEN_IF_NONE_MATCH, etag) ||
+      (h2o_find_header(&req->headers, H2O_TOKEN_IF_NONE_MATCH, -1) == -1 &&
+       header_contains(req, H2O_TOKEN_IF_MODIFIED_SINCE,
+                       entry->last_modified))) {
+    req->res.status = 304;
+    req->res.reason = "Not Modified";
+    h2o_start_response(req, &generator);
+    h2o_send(req, NULL, 0, H2O_SEND_STATE_FINAL);
+    return;
+  }
+
+  if (chosen != IDENTITY)
+    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_ENCODING,
+                   NULL, precompress_variants[chosen].name,
+                   strlen(precompress_variants[chosen].name));
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
+                 entry->mime.base, entry->mime.len);
+
+  h2o_iovec_t body = entry->bodies[chosen];
+  req->res.status = 200;
+  req->res.reason = "OK";
+  req->res.content_length = body.len;
+  h2o_start_response(req, &generator);
+  h2o_send(req, &body, is_head ? 0 : 1, H2O_SEND_STATE_FINAL);
+}
+
+static void finish_load(h2o_req_t *req, entryLoad *load) {
+  fileCache *cache = load->cache;
+  cacheEntry *entry = load->entry, *existing;
+
+  // another request for the same path may have loaded it meanwhile
+  if ((existing = find_entry(cache, entry->path.base, entry->path.len)) !=
+      NULL) {
+    free_entry(entry);
+    entry = existing;
+    lru_unlink(entry);
+    lru_push_front(cache, entry);
+  } else if (load->generation == cache->generation &&
+             entry->bytes <= cache->budget) {
+    insert_entry(cache, entry);
+  }
+  // otherwise it's served once and freed with the response
+
+  free(load);
+  send_entry(req, entry);
+}
+
+static void on_loaded(h2o_req_t *req, int err, h2o_iovec_t body,
+                      const struct stat *st, void *data) {
+  entryLoad *load = data;
+  cacheEntry *entry = load->entry;
+  const Config *config;
+  int next;
+
+  if (!req) {
+    free(body.base);
+    free_entry(entry);
+    free(load);
+    return;
+  }
+
+  if (load->step == IDENTITY) {
+    if (err != 0) {
+      /* not ours to serve, the file handler after us has the last word.
+       * missing, a directory or too big stays that way until something in
+       * the site changes, so later requests go straight to it */
+      if ((err == ENOENT || err == ENOTDIR || err == EINVAL || err == EFBIG) &&
+          load->generation == load->cache->generation)
+        remember_miss(load->cache, entry, load->generation);
+      free_entry(entry);
+      free(load);
+      h2o_delegate_request(req);
+      return;
+    }
+
+    config = &get_snapshot(req)->config;
+    entry->bodies[IDENTITY] = body;
+    format_etag(entry->etags[IDENTITY], config, body, st);
+    h2o_time2str_rfc1123(entry->last_modified, st->st_mtime);
+    entry->mime = mime_for_path(config, load->fs_path, strlen(load->fs_path));
+    entry->cache_control =
+        cache_control_for(config, entry->path.base, entry->path.len);
+    entry->bytes = body.len;
+    load->mtime = st->st_mtime;
+  } else if (err == 0 && st->st_mtime >= load->mtime) {
+    // precompressed siblings older than the file itself are stale
+    entry->bodies[load->step] = body;
+    entry->variants |= precompress_variants[load->step].encoding;
+    format_etag(entry->etags[load->step], &get_snapshot(req)->config, body,
+                st);
+    entry->bytes += body.len;
+  } else {
+    free(body.base);
+  }
+
+  for (next = load->step == IDENTITY ? 0 : load->step + 1;
+       next < PRECOMPRESS_ENCODINGS; ++next) {
+    char variant_path[1024];
+
+    snprintf(variant_path, 1024, "%s%s", load->fs_path,
+             precompress_variants[next].extension);
+    load->step = next;
+    if (read_file_async(req, variant_path, load->cache->max_file_size,
+                        on_loaded, load) == 0)
+      return;
+  }
+
+  finish_load(req, load);
+}
+
+// reads the file and its variants off the loop, on_loaded picks it up
+static int start_load(fileCache *cache, h2o_req_t *req) {
+  h2o_iovec_t path = req->path_normalized;
+  entryLoad *load = calloc(1, sizeof(*load));
+  cacheEntry *entry = calloc(1, sizeof(*entry));
+
+  if (!load || !entry)
+    goto Error;
+
+  snprintf(load->fs_path, 1024, "%s%.*s%s", cache->site_root, (int)path.len,
+           path.base, path.base[path.len - 1] == '/' ? "index.html" : "");
+  entry->path = h2o_strdup(NULL, path.base, path.len);
+  entry->hash = hash_path(path.base, path.len);
+  load->cache = cache;
+  load->entry = entry;
+  load->generation = cache->generation;
+  load->step = IDENTITY;
+
+  if (read_file_async(req, load->fs_path, cache->max_file_size, on_loaded,
+                      load) != 0) {
+    free_entry(entry);
+    free(load);
+    return -1;
+  }
+  return 0;
+Error:
+  free(entry);
+  free(load);
+  return -1;
+}
+
+static void on_change(const char *changed, size_t len, uint32_t mask,
+                      void *data) {
+  fileCache *cache = data;
+
+  if (!changed) {
+    flush(cache);
+    return;
+  }
+
+  // a new or rewritten variant changes what its original serves
+  for (int i = 0; i < PRECOMPRESS_ENCODINGS; ++i) {
+    size_t ext_len = strlen(precompress_variants[i].extension);
+    if (len > ext_len && memcmp(changed + len - ext_len,
+                                precompress_variants[i].extension,
+                                ext_len) == 0)
+      len -= ext_len;
+  }
+
+  // loads already reading may have seen the old contents
+  ++cache->generation;
+  invalidate(cache, changed, len);
+  if (len >= 11 && memcmp(changed + len - 11, "/index.html", 11) == 0)
+    invalidate(cache, changed, len - 10);
+
+  if ((mask & IN_ISDIR) && (mask & (IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)))
+    invalidate_tree(cache, changed, len);
+  update_stats(cache);
+}
+
+static int on_req(h2o_handler_t *_self, h2o_req_t *req) {
+  fileCache *cache = h2o_context_get_handler_context(req->conn->ctx, _self);
+  cacheEntry *entry;
+
+  if (cache->budget == 0)
+    return -1;
+
+  if (!h2o_memis(req->method.base, req->method.len, H2O_STRLIT("GET")) &&
+      !h2o_memis(req->method.base, req->method.len, H2O_STRLIT("HEAD")))
+    return -1;
+
+  if (h2o_find_header(&req->headers, H2O_TOKEN_RANGE, -1) != -1)
+    return -1;
+
+  // until the root is watched again, nothing could be invalidated
+  if (!is_site_watched(cache->watch))
+    return -1;
+
+  if ((entry = find_entry(cache, req->path_normalized.base,
+                          req->path_normalized.len)) == NULL) {
+    atomic_fetch_add_explicit(&cache->misses, 1, memory_order_relaxed);
+    if (is_known_miss(cache, req->path_normalized.base,
+                      req->path_normalized.len))
+      return -1;
+    return start_load(cache, req);
+  }
+
+  atomic_fetch_add_explicit(&cache->hits, 1, memory_order_relaxed);
+  lru_unlink(entry);
+  lru_push_front(cache, entry);
+  send_entry(req, entry);
+  return 0;
+}
+
+static void on_context_init(h2o_handler_t *_self, h2o_context_t *ctx) {
+  fileCacheHandler *self = (fileCacheHandler *)_self;
+  fileCache *cache = calloc(1, sizeof(*cache));
+
+  cache->bucket_count = 256;
+  cache->buckets = calloc(cache->bucket_count, sizeof(*cache->buckets));
+  cache->lru.lru_next = cache->lru.lru_prev = &cache->lru;
+  cache->budget = self->budget;
+  cache->max_file_size = self->max_file_size;
+  cache->site_root = self->site_root;
+
+  cache->watch = watch_site(ctx->loop, cache->site_root, on_change, cache);
+  if (!cache->watch) {
+    // without invalidation the cache could serve stale files forever
+    fprintf(stderr, "filecache: inotify unavailable, caching disabled: %s\n",
+            strerror(errno));
+    cache->budget = 0;
+  }
+
+  pthread_mutex_lock(&registry_mutex);
+  if (registry_count == registry_capacity) {
+    size_t capacity = registry_capacity ? registry_capacity * 2 : 16;
+    fileCache **caches = realloc(registry, capacity * sizeof(*caches));
+    if (caches) {
+      registry = caches;
+      registry_capacity = capacity;
+    }
+  }
+  if (registry_count < registry_capacity)
+    registry[registry_count++] = cache;
+  else
+    fprintf(stderr, "filecache: out of memory, cache left out of stats\n");
+  pthread_mutex_unlock(&registry_mutex);
+
+  h2o_context_set_handler_context(ctx, _self, cache);
+}
+
+static void on_context_dispose(h2o_handler_t *_self, h2o_context_t *ctx) {
+  fileCache *cache = h2o_context_get_handler_context(ctx, _self);
+
+  pthread_mutex_lock(&registry_mutex);
+  for (size_t i = 0; i < registry_count; ++i) {
+    if (registry[i] == cache) {
+      registry[i] = registry[--registry_count];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&registry_mutex);
+
+  flush(cache);
+  forget_misses(cache);
+  if (cache->watch)
+    unwatch_site(cache->watch);
+  free(cache->buckets);
+  free(cache);
+}
+
+static void on_dispose(h2o_handler_t *_self) {
+  free(((fileCacheHandler *)_self)->site_root);
+}
+
+void register_filecache(h2o_pathconf_t *pathconf, const char *site_root,
+                        size_t budget, size_t max_file_size) {
+  fileCacheHandler *self =
+      (fileCacheHandler *)h2o_create_handler(pathconf, sizeof(*self));
+  size_t root_len = strlen(site_root);
+
+  // request paths start with a slash, so keep the root without one
+  self->site_root = h2o_strdup(NULL, site_root, root_len).base;
+  while (root_len > 1 && self->site_root[root_len - 1] == '/')
+    self->site_root[--root_len] = '\0';
+
+  self->budget = budget;
+  self->max_file_size = max_file_size;
+  self->super.on_context_init = on_context_init;
+  self->super.on_context_dispose = on_context_dispose;
+  self->super.dispose = on_dispose;
+  self->super.on_req = on_req;
+}
+
+size_t filecache_stats(h2o_mem_pool_t *pool, fileCacheStats **_stats) {
+  fileCacheStats *stats;
+  size_t count;
+
+  pthread_mutex_lock(&registry_mutex);
+  count = registry_count;
+  stats = h2o_mem_alloc_pool(pool, fileCacheStats, count);
+  for (size_t i = 0; i < count; ++i) {
+    fileCache *cache = registry[i];
+
+    stats[i].entries =
+        atomic_load_explicit(&cache->stat_entries, memory_order_relaxed);
+    stats[i].bytes =
+        atomic_load_explicit(&cache->stat_bytes, memory_order_relaxed);
+    stats[i].hits = atomic_load_explicit(&cache->hits, memory_order_relaxed);
+    stats[i].misses =
+        atomic_load_explicit(&cache->misses, memory_order_relaxed);
+    stats[i].evictions =
+        atomic_load_explicit(&cache->evictions, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&registry_mutex);
+
+  *_stats = stats;
+  return count;
+}
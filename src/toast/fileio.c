@@ -0,0 +1,330 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <h2o.h>
+
+#include <async.h>
+#include <fileio.h>
+
+#ifdef TOAST_USE_IO_URING
+#include <liburing.h>
+#include <sys/eventfd.h>
+
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH 0x1000
+#endif
+
+#define RING_ENTRIES 256
+#define MAX_READ (1u << 30) // a single read sqe takes an unsigned length
+#endif
+
+typedef struct fileOp fileOp;
+
+// lives in the request's pool, so it learns when the request goes away
+typedef struct {
+  fileOp *op;
+} opLink;
+
+struct fileOp {
+  h2o_req_t *req;
+  opLink *link;
+  fileReadDone done;
+  void *data;
+  size_t max_size;
+  int err;
+  struct stat st;
+  h2o_iovec_t body;
+#ifdef TOAST_USE_IO_URING
+  int step;
+  int fd;
+  struct statx stx;
+#endif
+  char path[];
+};
+
+static void finish_op(h2o_req_t *req, fileOp *op) {
+  if (op->err != 0) {
+    free(op->body.base);
+    op->body = h2o_iovec_init(NULL, 0);
+  }
+
+  op->done(req, op->err, op->body, &op->st, op->data);
+  free(op);
+}
+
+// on a pool thread, for workers without a ring
+static void read_blocking(void *data) {
+  fileOp *op = data;
+  int fd = open(op->path, O_RDONLY | O_CLOEXEC);
+
+  if (fd == -1) {
+    op->err = errno;
+    return;
+  }
+
+  if (fstat(fd, &op->st) != 0)
+    op->err = errno;
+  else if (!S_ISREG(op->st.st_mode))
+    op->err = EINVAL;
+  else if ((size_t)op->st.st_size > op->max_size)
+    op->err = EFBIG;
+  else if ((op->body.base = malloc(op->st.st_size ? op->st.st_size : 1)) ==
+           NULL)
+    op->err = ENOMEM;
+
+  while (op->err == 0 && op->body.len < (size_t)op->st.st_size) {
+    ssize_t r = read(fd, op->body.base + op->body.len,
+                     op->st.st_size - op->body.len);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      op->err = r == 0 ? EIO : errno; // shrank while we read it
+    else
+      op->body.len += r;
+  }
+
+  close(fd);
+}
+
+static void after_blocking(h2o_req_t *req, void *data) {
+  finish_op(req, data);
+}
+
+#ifdef TOAST_USE_IO_URING
+
+enum { STEP_OPEN, STEP_STAT, STEP_READ, STEP_CLOSE };
+
+typedef struct {
+  struct io_uring ring;
+  int event_fd; // signalled by the kernel when completions are posted
+  uv_poll_t poll;
+  uv_prepare_t submit;
+  size_t queued; // prepared, waiting for the next submit
+} fileRing;
+
+static _Thread_local fileRing *this_ring = NULL;
+
+static void on_req_dispose(void *_link) {
+  opLink *link = _link;
+
+  if (link->op)
+    link->op->req = NULL;
+}
+
+static void finish_ring_op(fileOp *op) {
+  h2o_req_t *req = op->req;
+
+  if (req)
+    op->link->op = NULL;
+  finish_op(req, op);
+}
+
+// one io_uring_submit per loop iteration, however many ops were queued
+static void on_submit(uv_prepare_t *prepare) {
+  fileRing *ring = prepare->data;
+  int r;
+
+  if ((r = io_uring_submit(&ring->ring)) < 0)
+    fprintf(stderr, "fileio: io_uring_submit: %s\n", strerror(-r));
+  ring->queued = 0;
+  uv_prepare_stop(prepare);
+}
+
+static int queue_step(fileRing *ring, fileOp *op) {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&ring->ring);
+
+  // a full submission queue goes out now rather than at the next iteration
+  if (!sqe) {
+    io_uring_submit(&ring->ring);
+    ring->queued = 0;
+    if ((sqe = io_uring_get_sqe(&ring->ring)) == NULL)
+      return -1;
+  }
+
+  switch (op->step) {
+  case STEP_OPEN:
+    io_uring_prep_openat(sqe, AT_FDCWD, op->path, O_RDONLY | O_CLOEXEC, 0);
+    break;
+  case STEP_STAT:
+    io_uring_prep_statx(sqe, op->fd, "", AT_EMPTY_PATH,
+                        STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME,
+                        &op->stx);
+    break;
+  case STEP_READ: {
+    size_t left = op->st.st_size - op->body.len;
+    io_uring_prep_read(sqe, op->fd, op->body.base + op->body.len,
+                       left > MAX_READ ? MAX_READ : left, op->body.len);
+    break;
+  }
+  case STEP_CLOSE:
+    io_uring_prep_close(sqe, op->fd);
+    break;
+  }
+  io_uring_sqe_set_data(sqe, op);
+
+  if (ring->queued++ == 0)
+    uv_prepare_start(&ring->submit, on_submit);
+  return 0;
+}
+
+static void on_stat(fileOp *op) {
+  op->st.st_mode = op->stx.stx_mode;
+  op->st.st_size = op->stx.stx_size;
+  op->st.st_mtime = op->stx.stx_mtime.tv_sec;
+
+  if (!S_ISREG(op->st.st_mode))
+    op->err = EINVAL;
+  else if ((size_t)op->st.st_size > op->max_size)
+    op->err = EFBIG;
+  else if ((op->body.base = malloc(op->st.st_size ? op->st.st_size : 1)) ==
+           NULL)
+    op->err = ENOMEM;
+}
+
+static void on_complete(fileRing *ring, fileOp *op, int res) {
+  switch (op->step) {
+  case STEP_OPEN:
+    if (res < 0) {
+      op->err = -res;
+      finish_ring_op(op);
+      return;
+    }
+    op->fd = res;
+    op->step = STEP_STAT;
+    break;
+  case STEP_STAT:
+    if (res < 0)
+      op->err = -res;
+    else
+      on_stat(op);
+    op->step = op->err == 0 && op->st.st_size > 0 ? STEP_READ : STEP_CLOSE;
+    break;
+  case STEP_READ:
+    if (res == 0)
+      op->err = EIO; // shrank while we read it
+    else if (res < 0 && res != -EINTR && res != -EAGAIN)
+      op->err = -res;
+    else if (res > 0)
+      op->body.len += res;
+    if (op->err != 0 || op->body.len == (size_t)op->st.st_size)
+      op->step = STEP_CLOSE;
+    break;
+  case STEP_CLOSE:
+    finish_ring_op(op);
+    return;
+  }
+
+  if (queue_step(ring, op) != 0) {
+    close(op->fd);
+    if (op->err == 0 && op->step != STEP_CLOSE)
+      op->err = EBUSY;
+    finish_ring_op(op);
+  }
+}
+
+static void on_completions(uv_poll_t *poll, int status, int events) {
+  fileRing *ring = poll->data;
+  struct io_uring_cqe *cqe;
+  uint64_t count;
+
+  while (read(ring->event_fd, &count, sizeof(count)) == -1 && errno == EINTR)
+    ;
+
+  while (io_uring_peek_cqe(&ring->ring, &cqe) == 0) {
+    fileOp *op = io_uring_cqe_get_data(cqe);
+    int res = cqe->res;
+
+    io_uring_cqe_seen(&ring->ring, cqe);
+    on_complete(ring, op, res);
+  }
+}
+
+void start_file_io(uv_loop_t *loop) {
+  static atomic_flag warned = ATOMIC_FLAG_INIT;
+  fileRing *ring = calloc(1, sizeof(*ring));
+  int r;
+
+  if (!ring)
+    return;
+
+  if ((r = io_uring_queue_init(RING_ENTRIES, &ring->ring, 0)) < 0) {
+    // every worker fails the same way, once is enough
+    if (!atomic_flag_test_and_set(&warned))
+      fprintf(stderr,
+              "fileio: io_uring unavailable, reading files on the thread "
+              "pool: %s\n",
+              strerror(-r));
+    free(ring);
+    return;
+  }
+
+  if ((ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1 ||
+      (r = io_uring_register_eventfd(&ring->ring, ring->event_fd)) != 0) {
+    fprintf(stderr, "fileio: can't watch the ring, using the thread pool\n");
+    if (ring->event_fd != -1)
+      close(ring->event_fd);
+    io_uring_queue_exit(&ring->ring);
+    free(ring);
+    return;
+  }
+
+  uv_poll_init(loop, &ring->poll, ring->event_fd);
+  ring->poll.data = ring;
+  uv_poll_start(&ring->poll, UV_READABLE, on_completions);
+  uv_unref((uv_handle_t *)&ring->poll);
+
+  uv_prepare_init(loop, &ring->submit);
+  ring->submit.data = ring;
+  uv_unref((uv_handle_t *)&ring->submit);
+
+  this_ring = ring;
+}
+
+#else
+
+void start_file_io(uv_loop_t *loop) {}
+
+#endif
+
+int read_file_async(h2o_req_t *req, const char *path, size_t max_size,
+                    fileReadDone done, void *data) {
+  size_t path_len = strlen(path);
+  fileOp *op = calloc(1, sizeof(*op) + path_len + 1);
+
+  if (!op)
+    return -1;
+
+  memcpy(op->path, path, path_len + 1);
+  op->req = req;
+  op->done = done;
+  op->data = data;
+  op->max_size = max_size;
+
+#ifdef TOAST_USE_IO_URING
+  if (this_ring) {
+    op->step = STEP_OPEN;
+    op->fd = -1;
+    if (queue_step(this_ring, op) != 0) {
+      free(op);
+      return -1;
+    }
+    op->link =
+        h2o_mem_alloc_shared(&req->pool, sizeof(*op->link), on_req_dispose);
+    op->link->op = op;
+    return 0;
+  }
+#endif
+
+  if (queue_work(req, read_blocking, after_blocking, op) != 0) {
+    free(op);
+    return -1;
+  }
+  return 0;
+}
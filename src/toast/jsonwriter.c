@@ -0,0 +1,174 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <h2o.h>
+
+#include <jsonwriter.h>
+
+#define INDENT 2
+
+// outgrown buffers stay in the pool until the request is done
+static char *reserve(jsonWriter *writer, size_t size) {
+  if (writer->len + size > writer->capacity) {
+    size_t capacity = writer->capacity * 2;
+    char *buf;
+
+    while (capacity < writer->len + size)
+      capacity *= 2;
+
+    buf = h2o_mem_alloc_pool(writer->pool, char, capacity);
+    memcpy(buf, writer->buf, writer->len);
+    writer->buf = buf;
+    writer->capacity = capacity;
+  }
+
+  return writer->buf + writer->len;
+}
+
+static void append(jsonWriter *writer, const char *data, size_t len) {
+  memcpy(reserve(writer, len), data, len);
+  writer->len += len;
+}
+
+static void newline(jsonWriter *writer) {
+  size_t len = 1 + writer->depth * INDENT;
+  char *out = reserve(writer, len);
+
+  out[0] = '\n';
+  memset(out + 1, ' ', len - 1);
+  writer->len += len;
+}
+
+// separators and indentation owed before any value or key
+static void begin_value(jsonWriter *writer) {
+  uint64_t bit;
+
+  if (writer->after_key) {
+    writer->after_key = false;
+    return;
+  }
+
+  if (writer->depth == 0)
+    return;
+
+  bit = 1ull << (writer->depth - 1);
+  if (writer->has_members & bit)
+    append(writer, ",", 1);
+  writer->has_members |= bit;
+  newline(writer);
+}
+
+static void open_container(jsonWriter *writer, char c) {
+  begin_value(writer);
+  append(writer, &c, 1);
+  ++writer->depth;
+  writer->has_members &= ~(1ull << (writer->depth - 1));
+}
+
+static void close_container(jsonWriter *writer, char c) {
+  uint64_t bit = 1ull << (writer->depth - 1);
+  bool has_members = writer->has_members & bit;
+
+  --writer->depth;
+  if (has_members)
+    newline(writer);
+  append(writer, &c, 1);
+}
+
+void jw_init(jsonWriter *writer, h2o_mem_pool_t *pool, size_t capacity) {
+  *writer = (jsonWriter){.pool = pool, .capacity = capacity ? capacity : 64};
+  writer->buf = h2o_mem_alloc_pool(pool, char, writer->capacity);
+}
+
+void jw_object_begin(jsonWriter *writer) { open_container(writer, '{'); }
+
+void jw_object_end(jsonWriter *writer) { close_container(writer, '}'); }
+
+void jw_array_begin(jsonWriter *writer) { open_container(writer, '['); }
+
+void jw_array_end(jsonWriter *writer) { close_container(writer, ']'); }
+
+static void write_escaped(jsonWriter *writer, const char *value, size_t len) {
+  static const char hex[] = "0123456789ABCDEF";
+  // worst case every byte becomes \u00XX
+  char *out = reserve(writer, len * 6 + 2), *start = out;
+
+  *out++ = '"';
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = value[i];
+
+    switch (c) {
+    case '"':
+    case '\\':
+      *out++ = '\\';
+      *out++ = c;
+      break;
+    case '\b':
+      *out++ = '\\';
+      *out++ = 'b';
+      break;
+    case '\f':
+      *out++ = '\\';
+      *out++ = 'f';
+      break;
+    case '\n':
+      *out++ = '\\';
+      *out++ = 'n';
+      break;
+    case '\r':
+      *out++ = '\\';
+      *out++ = 'r';
+      break;
+    case '\t':
+      *out++ = '\\';
+      *out++ = 't';
+      break;
+    default:
+      if (c < 0x20) {
+        memcpy(out, "\\u00", 4);
+        out[4] = hex[c >> 4];
+        out[5] = hex[c & 0xf];
+        out += 6;
+      } else {
+        *out++ = c;
+      }
+    }
+  }
+  *out++ = '"';
+
+  writer->len += out - start;
+}
+
+void jw_key(jsonWriter *writer, const char *key) {
+  begin_value(writer);
+  write_escaped(writer, key, strlen(key));
+  append(writer, ": ", 2);
+  writer->after_key = true;
+}
+
+void jw_string(jsonWriter *writer, const char *value) {
+  jw_string_n(writer, value, strlen(value));
+}
+
+void jw_string_n(jsonWriter *writer, const char *value, size_t len) {
+  begin_value(writer);
+  write_escaped(writer, value, len);
+}
+
+void jw_integer(jsonWriter *writer, long long value) {
+  begin_value(writer);
+  writer->len += snprintf(reserve(writer, 21), 21, "%lld", value);
+}
+
+void jw_bool(jsonWriter *writer, bool value) {
+  begin_value(writer);
+  if (value)
+    append(writer, "true", 4);
+  else
+    append(writer, "false", 5);
+}
+
+h2o_iovec_t jw_finish(jsonWriter *writer) {
+  return h2o_iovec_init(writer->buf, writer->len);
+}
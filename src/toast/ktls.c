@@ -0,0 +1,66 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <h2o.h>
+
+#include <ktls.h>
+
+#if H2O_USE_KTLS
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+/* the tls ULP can only be attached to an established connection, so the
+ * probe makes one over loopback */
+static bool kernel_supports_tls(void) {
+  struct sockaddr_in addr = {.sin_family = AF_INET,
+                             .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+  socklen_t addr_len = sizeof(addr);
+  int listener = -1, client = -1, server = -1;
+  bool supported = false;
+
+  if ((listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1 ||
+      bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listener, 1) != 0 ||
+      getsockname(listener, (struct sockaddr *)&addr, &addr_len) != 0)
+    goto Exit;
+
+  if ((client = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1 ||
+      connect(client, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      (server = accept(listener, NULL, NULL)) == -1)
+    goto Exit;
+
+  supported = setsockopt(server, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0;
+
+Exit:
+  if (server != -1)
+    close(server);
+  if (client != -1)
+    close(client);
+  if (listener != -1)
+    close(listener);
+  return supported;
+}
+#endif
+
+bool enable_ktls(void) {
+#if H2O_USE_KTLS
+  if (!kernel_supports_tls()) {
+    fprintf(stderr, "toast: kernel has no TLS support (modprobe tls), "
+                    "encrypting in userspace\n");
+    return false;
+  }
+
+  h2o_socket_use_ktls = 1;
+  return true;
+#else
+  fprintf(stderr, "toast: libh2o was built without kTLS, encrypting in "
+                  "userspace\n");
+  return false;
+#endif
+}
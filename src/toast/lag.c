@@ -0,0 +1,197 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <h2o.h>
+
+#include <clock.h>
+#include <lag.h>
+#include <metrics.h>
+
+#define PROBE_INTERVAL_MS 100
+
+// counters written by the owning thread only, the slow ring is shared
+typedef struct threadLag {
+  struct threadLag *next;
+  unsigned int worker;
+  uv_timer_t probe;
+  uint64_t probe_due; // uv_hrtime
+
+  atomic_size_t samples;
+  atomic_size_t lag_sum_usec;
+  atomic_size_t max_usec;
+  atomic_size_t lag[LATENCY_BUCKETS];
+  atomic_size_t slow_count;
+
+  pthread_mutex_t slow_mutex;
+  slowRequest slow[SLOW_REQUESTS];
+  size_t next_slow;
+} threadLag;
+
+typedef struct {
+  h2o_filter_t super;
+  metricsRoute route;
+  int64_t threshold_usec;
+} slowTrace;
+
+// one block per worker, only ever prepended
+static _Atomic(threadLag *) threads = NULL;
+static _Thread_local threadLag *this_thread = NULL;
+
+static inline void bump(atomic_size_t *counter, size_t n) {
+  atomic_store_explicit(
+      counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+      memory_order_relaxed);
+}
+
+static void on_probe(uv_timer_t *timer) {
+  threadLag *lag = timer->data;
+  uint64_t now = uv_hrtime();
+  uint64_t usec = now > lag->probe_due ? (now - lag->probe_due) / 1000 : 0;
+
+  lag->probe_due = now + PROBE_INTERVAL_MS * 1000000ull;
+
+  bump(&lag->samples, 1);
+  bump(&lag->lag_sum_usec, usec);
+  bump(&lag->lag[latency_bucket(usec)], 1);
+  if (usec > atomic_load_explicit(&lag->max_usec, memory_order_relaxed))
+    atomic_store_explicit(&lag->max_usec, usec, memory_order_relaxed);
+}
+
+void start_lag_probe(uv_loop_t *loop, unsigned int worker) {
+  threadLag *lag = calloc(1, sizeof(*lag));
+
+  if (!lag)
+    return;
+
+  lag->worker = worker;
+  pthread_mutex_init(&lag->slow_mutex, NULL);
+
+  uv_timer_init(loop, &lag->probe);
+  lag->probe.data = lag;
+  lag->probe_due = uv_hrtime() + PROBE_INTERVAL_MS * 1000000ull;
+  uv_timer_start(&lag->probe, on_probe, PROBE_INTERVAL_MS, PROBE_INTERVAL_MS);
+  // the probe alone shouldn't keep the loop running
+  uv_unref((uv_handle_t *)&lag->probe);
+
+  lag->next = atomic_load(&threads);
+  while (!atomic_compare_exchange_weak(&threads, &lag->next, lag))
+    ;
+
+  this_thread = lag;
+}
+
+static void record_slow(metricsRoute route, const char *path, size_t path_len,
+                        uint64_t usec) {
+  threadLag *lag = this_thread;
+  slowRequest *slow;
+
+  if (!lag)
+    return;
+
+  pthread_mutex_lock(&lag->slow_mutex);
+  slow = &lag->slow[lag->next_slow];
+  lag->next_slow = (lag->next_slow + 1) % SLOW_REQUESTS;
+
+  slow->worker = lag->worker;
+  slow->route = route;
+  slow->at = clock_now()->wall;
+  slow->usec = usec;
+  memcpy(slow->path, path, path_len);
+  slow->path[path_len] = '\0';
+  pthread_mutex_unlock(&lag->slow_mutex);
+
+  bump(&lag->slow_count, 1);
+}
+
+/* the handlers had the request from dispatch until they started the
+ * response. processed_at is the loop's clock when the request was handed to
+ * them, so a handler blocking the loop shows up in full */
+static void on_setup_ostream(h2o_filter_t *_self, h2o_req_t *req,
+                             h2o_ostream_t **slot) {
+  slowTrace *self = (slowTrace *)_self;
+  struct timeval now;
+  int64_t usec;
+
+  gettimeofday(&now, NULL);
+  usec = h2o_timeval_subtract(&req->processed_at.at, &now);
+  if (usec >= self->threshold_usec) {
+    size_t path_len = req->path_normalized.len;
+    if (path_len >= sizeof(((slowRequest *)0)->path))
+      path_len = sizeof(((slowRequest *)0)->path) - 1;
+    record_slow(self->route, req->path_normalized.base, path_len, usec);
+  }
+
+  h2o_setup_next_ostream(req, slot);
+}
+
+void register_slow_trace(h2o_pathconf_t *pathconf, metricsRoute route,
+                         unsigned int threshold_ms) {
+  slowTrace *self;
+
+  if (threshold_ms == 0)
+    return;
+
+  self = (slowTrace *)h2o_create_filter(pathconf, sizeof(*self));
+  self->super.on_setup_ostream = on_setup_ostream;
+  self->route = route;
+  self->threshold_usec = threshold_ms * 1000ll;
+}
+
+size_t collect_lag(loopLag *lags, size_t max) {
+  size_t count = 0;
+
+  for (threadLag *lag = atomic_load(&threads); lag && count < max;
+       lag = lag->next, ++count) {
+    loopLag *out = &lags[count];
+
+    out->worker = lag->worker;
+#define COLLECT(field)                                                         \
+  out->field = atomic_load_explicit(&lag->field, memory_order_relaxed)
+    COLLECT(samples);
+    COLLECT(lag_sum_usec);
+    COLLECT(max_usec);
+    for (int j = 0; j < LATENCY_BUCKETS; ++j)
+      COLLECT(lag[j]);
+#undef COLLECT
+    out->slow_requests =
+        atomic_load_explicit(&lag->slow_count, memory_order_relaxed);
+  }
+
+  return count;
+}
+
+static int newest_first(const void *a, const void *b) {
+  const slowRequest *x = a, *y = b;
+  return (x->at < y->at) - (x->at > y->at);
+}
+
+size_t recent_slow_requests(slowRequest *requests, size_t max) {
+  threadLag *head = atomic_load(&threads);
+  size_t count = 0, kept;
+  slowRequest *all;
+
+  for (threadLag *lag = head; lag; lag = lag->next)
+    ++count;
+  if ((all = malloc(count * SLOW_REQUESTS * sizeof(*all))) == NULL)
+    return 0;
+
+  count = 0;
+  for (threadLag *lag = head; lag; lag = lag->next) {
+    pthread_mutex_lock(&lag->slow_mutex);
+    for (size_t i = 0; i < SLOW_REQUESTS; ++i)
+      if (lag->slow[i].at != 0)
+        all[count++] = lag->slow[i];
+    pthread_mutex_unlock(&lag->slow_mutex);
+  }
+
+  qsort(all, count, sizeof(*all), newest_first);
+  kept = count < max ? count : max;
+  memcpy(requests, all, kept * sizeof(*requests));
+  free(all);
+
+  return kept;
+}
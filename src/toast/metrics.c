@@ -0,0 +1,227 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <h2o.h>
+
+#include <metrics.h>
+
+// written by the owning thread only, so no locked instructions needed
+typedef struct {
+  _Alignas(64) atomic_size_t requests;
+  atomic_size_t status[5];
+  atomic_size_t bytes_in;
+  atomic_size_t bytes_out;
+  atomic_size_t latency_sum_usec;
+  atomic_size_t latency[LATENCY_BUCKETS];
+  atomic_size_t identity_bytes;
+  atomic_size_t encoded_bytes;
+} routeCounters;
+
+typedef struct threadMetrics {
+  routeCounters routes[ROUTE_COUNT];
+  struct threadMetrics *next;
+} threadMetrics;
+
+typedef struct {
+  h2o_logger_t super;
+  metricsRoute route;
+} metricsLogger;
+
+typedef struct {
+  h2o_filter_t super;
+  metricsRoute route;
+} metricsFilter;
+
+typedef struct {
+  size_t identity;
+  size_t encoded;
+} responseSizes;
+
+typedef struct {
+  h2o_ostream_t super;
+  responseSizes *sizes;
+  metricsRoute route;
+  bool tail;
+} sizeOstream;
+
+const char *metrics_route_names[ROUTE_COUNT] = {"static", "api", "notfound"};
+
+// one block per thread, only ever prepended
+static _Atomic(threadMetrics *) threads = NULL;
+static _Thread_local threadMetrics *this_thread = NULL;
+
+static threadMetrics *get_thread_metrics(void) {
+  threadMetrics *metrics;
+
+  if (this_thread)
+    return this_thread;
+
+  metrics = aligned_alloc(_Alignof(threadMetrics), sizeof(*metrics));
+  if (!metrics)
+    return NULL;
+  memset(metrics, 0, sizeof(*metrics));
+
+  metrics->next = atomic_load(&threads);
+  while (!atomic_compare_exchange_weak(&threads, &metrics->next, metrics))
+    ;
+
+  return this_thread = metrics;
+}
+
+static inline void bump(atomic_size_t *counter, size_t n) {
+  atomic_store_explicit(
+      counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+      memory_order_relaxed);
+}
+
+size_t latency_bucket(uint64_t usec) {
+  size_t magnitude, bucket;
+
+  if (usec < LATENCY_SUB_BUCKETS)
+    return usec;
+
+  magnitude = 63 - __builtin_clzll(usec);
+  bucket = (magnitude - 1) * LATENCY_SUB_BUCKETS +
+           ((usec >> (magnitude - 2)) & (LATENCY_SUB_BUCKETS - 1));
+  return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+uint64_t latency_bucket_bound(size_t bucket) {
+  size_t magnitude = bucket / LATENCY_SUB_BUCKETS + 1;
+  uint64_t sub = bucket % LATENCY_SUB_BUCKETS;
+
+  if (bucket < LATENCY_SUB_BUCKETS)
+    return bucket;
+  return ((LATENCY_SUB_BUCKETS + sub + 1) << (magnitude - 2)) - 1;
+}
+
+static metricsRoute route_of(metricsRoute route, h2o_req_t *req) {
+  return req->res.status == 404 ? RouteNotFound : route;
+}
+
+static void log_access(h2o_logger_t *_self, h2o_req_t *req) {
+  metricsLogger *self = (metricsLogger *)_self;
+  threadMetrics *metrics = get_thread_metrics();
+  routeCounters *counters;
+  int64_t usec = 0;
+
+  if (!metrics)
+    return;
+
+  counters = &metrics->routes[route_of(self->route, req)];
+  bump(&counters->requests, 1);
+  if (req->res.status >= 100 && req->res.status < 600)
+    bump(&counters->status[req->res.status / 100 - 1], 1);
+  bump(&counters->bytes_in, req->req_body_bytes_received);
+  bump(&counters->bytes_out, req->bytes_sent);
+
+  if (!h2o_timeval_is_null(&req->timestamps.response_end_at))
+    usec = h2o_timeval_subtract(&req->timestamps.request_begin_at,
+                                &req->timestamps.response_end_at);
+  if (usec < 0)
+    usec = 0;
+  bump(&counters->latency_sum_usec, usec);
+  bump(&counters->latency[latency_bucket(usec)], 1);
+}
+
+static void on_send(h2o_ostream_t *_self, h2o_req_t *req, h2o_sendvec_t *bufs,
+                    size_t bufcnt, h2o_send_state_t state) {
+  sizeOstream *self = (sizeOstream *)_self;
+  size_t *bytes = self->tail ? &self->sizes->encoded : &self->sizes->identity;
+  threadMetrics *metrics;
+
+  for (size_t i = 0; i < bufcnt; ++i)
+    *bytes += bufs[i].len;
+
+  if (self->tail && !h2o_send_state_is_in_progress(state) &&
+      (metrics = get_thread_metrics()) != NULL) {
+    routeCounters *counters = &metrics->routes[route_of(self->route, req)];
+    bump(&counters->identity_bytes, self->sizes->identity);
+    bump(&counters->encoded_bytes, self->sizes->encoded);
+  }
+
+  h2o_ostream_send_next(&self->super, req, bufs, bufcnt, state);
+}
+
+/* measures bodies on both sides of the compress filter: one ostream right
+ * after the handler, one right before the connection */
+static void on_setup_ostream(h2o_filter_t *_self, h2o_req_t *req,
+                             h2o_ostream_t **slot) {
+  metricsFilter *self = (metricsFilter *)_self;
+  responseSizes *sizes;
+  sizeOstream *head, *tail;
+
+  // precompressed files never had an identity body going through here
+  if (h2o_find_header(&req->res.headers, H2O_TOKEN_CONTENT_ENCODING, -1) !=
+      -1) {
+    h2o_setup_next_ostream(req, slot);
+    return;
+  }
+
+  sizes = h2o_mem_alloc_pool(&req->pool, *sizes, 1);
+  *sizes = (responseSizes){0};
+
+  head = (sizeOstream *)h2o_add_ostream(req, H2O_ALIGNOF(*head), sizeof(*head),
+                                        slot);
+  head->super.do_send = on_send;
+  head->sizes = sizes;
+  head->route = self->route;
+  head->tail = false;
+
+  h2o_setup_next_ostream(req, &head->super.next);
+
+  if (h2o_find_header(&req->res.headers, H2O_TOKEN_CONTENT_ENCODING, -1) ==
+      -1)
+    return;
+
+  while ((*slot)->next != NULL)
+    slot = &(*slot)->next;
+
+  tail = (sizeOstream *)h2o_add_ostream(req, H2O_ALIGNOF(*tail), sizeof(*tail),
+                                        slot);
+  tail->super.do_send = on_send;
+  tail->sizes = sizes;
+  tail->route = self->route;
+  tail->tail = true;
+}
+
+void register_metrics(h2o_pathconf_t *pathconf, metricsRoute route) {
+  metricsLogger *logger =
+      (metricsLogger *)h2o_create_logger(pathconf, sizeof(*logger));
+  metricsFilter *filter =
+      (metricsFilter *)h2o_create_filter(pathconf, sizeof(*filter));
+
+  logger->super.log_access = log_access;
+  logger->route = route;
+  filter->super.on_setup_ostream = on_setup_ostream;
+  filter->route = route;
+}
+
+void collect_metrics(routeMetrics totals[ROUTE_COUNT]) {
+  memset(totals, 0, sizeof(routeMetrics) * ROUTE_COUNT);
+
+  for (threadMetrics *metrics = atomic_load(&threads); metrics;
+       metrics = metrics->next) {
+    for (int i = 0; i < ROUTE_COUNT; ++i) {
+      routeCounters *counters = &metrics->routes[i];
+      routeMetrics *total = &totals[i];
+
+#define COLLECT(field)                                                         \
+  total->field += atomic_load_explicit(&counters->field, memory_order_relaxed)
+      COLLECT(requests);
+      COLLECT(bytes_in);
+      COLLECT(bytes_out);
+      COLLECT(latency_sum_usec);
+      COLLECT(identity_bytes);
+      COLLECT(encoded_bytes);
+      for (int j = 0; j < 5; ++j)
+        COLLECT(status[j]);
+      for (int j = 0; j < LATENCY_BUCKETS; ++j)
+        COLLECT(latency[j]);
+#undef COLLECT
+    }
+  }
+}
@@ -0,0 +1,70 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <h2o.h>
+
+#include <config.h>
+#include <mime.h>
+#include <mimetable.h>
+
+static const h2o_iovec_t default_type = {
+    H2O_STRLIT("application/octet-stream")};
+
+static int compare_override(const void *_key, const void *_override) {
+  const h2o_iovec_t *key = _key;
+  const mimeOverride *override = _override;
+  size_t len = strlen(override->extension);
+  size_t shorter = key->len < len ? key->len : len;
+
+  for (size_t i = 0; i < shorter; ++i) {
+    int c = h2o_tolower(key->base[i]) - (unsigned char)override->extension[i];
+    if (c != 0)
+      return c;
+  }
+  return (key->len > len) - (key->len < len);
+}
+
+h2o_iovec_t mime_for_extension(const Config *config, const char *ext,
+                               size_t len) {
+  const mimeEntry *entry;
+  uint32_t seed;
+
+  if (config && config->mime_type_count > 0) {
+    h2o_iovec_t key = h2o_iovec_init(ext, len);
+    const mimeOverride *override =
+        bsearch(&key, config->mime_types, config->mime_type_count,
+                sizeof(*config->mime_types), compare_override);
+    if (override)
+      return h2o_iovec_init(override->type, override->type_len);
+  }
+
+  seed = mime_seeds[mime_hash(0, ext, len) % MIME_BUCKETS];
+  if (seed == 0)
+    return default_type;
+
+  // anything else lands on some slot too, the compare sorts that out
+  entry = &mime_table[mime_hash(seed, ext, len) % MIME_TABLE_SIZE];
+  if (h2o_lcstris(ext, len, entry->extension, entry->extension_len))
+    return entry->type;
+  return default_type;
+}
+
+h2o_iovec_t mime_for_path(const Config *config, const char *path,
+                          size_t len) {
+  h2o_iovec_t ext = h2o_get_filext(path, len);
+  return mime_for_extension(config, ext.base, ext.len);
+}
+
+h2o_mimemap_t *create_mimemap(const Config *config) {
+  h2o_mimemap_t *mimemap = h2o_mimemap_create();
+
+  for (size_t i = 0; i < MIME_TABLE_SIZE; ++i)
+    h2o_mimemap_define_mimetype(mimemap, mime_table[i].extension,
+                                mime_table[i].type.base, NULL);
+  for (size_t i = 0; config && i < config->mime_type_count; ++i)
+    h2o_mimemap_define_mimetype(mimemap, config->mime_types[i].extension,
+                                config->mime_types[i].type, NULL);
+  return mimemap;
+}
@@ -0,0 +1,293 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <h2o.h>
+
+#include <notfound.h>
+#include <pages.h>
+#include <sitewatch.h>
+
+#define MAX_PATH_LEN 512 // longer paths are answered but never remembered
+
+typedef struct missEntry {
+  struct missEntry *hash_next;
+  uint64_t hash;
+  size_t len;
+  char path[];
+} missEntry;
+
+/* a fixed number of slots filled in insertion order, once they're all used
+ * the oldest path makes room for the newest */
+typedef struct {
+  missEntry **buckets;
+  size_t bucket_count;
+  missEntry **slots;
+  size_t slot_count;
+  size_t next_slot;
+  size_t count;
+  const char *site_root;
+
+  siteWatch *watch;
+
+  atomic_size_t hits;
+  atomic_size_t flushes;
+  atomic_size_t stat_entries;
+} missCache;
+
+struct notFoundLookup {
+  h2o_handler_t super;
+  char *site_root;
+  size_t max_entries;
+  pageSet *pages;
+};
+
+typedef struct {
+  h2o_handler_t super;
+  notFoundLookup *lookup;
+} notFoundHandler;
+
+// one cache per worker context, across every generation still running
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static missCache **registry;
+static size_t registry_count, registry_capacity;
+
+static uint64_t hash_path(const char *path, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= (unsigned char)path[i];
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+static missEntry *find_entry(missCache *cache, const char *path, size_t len) {
+  uint64_t hash = hash_path(path, len);
+  missEntry *entry = cache->buckets[hash & (cache->bucket_count - 1)];
+
+  for (; entry; entry = entry->hash_next)
+    if (entry->hash == hash && h2o_memis(entry->path, entry->len, path, len))
+      return entry;
+  return NULL;
+}
+
+static void remove_entry(missCache *cache, missEntry *entry) {
+  missEntry **slot = &cache->buckets[entry->hash & (cache->bucket_count - 1)];
+
+  while (*slot != entry)
+    slot = &(*slot)->hash_next;
+  *slot = entry->hash_next;
+
+  free(entry);
+  --cache->count;
+}
+
+static void insert_entry(missCache *cache, const char *path, size_t len) {
+  missEntry *entry, **bucket;
+
+  if (len > MAX_PATH_LEN || find_entry(cache, path, len))
+    return;
+
+  if ((entry = malloc(sizeof(*entry) + len)) == NULL)
+    return;
+
+  if (cache->slots[cache->next_slot])
+    remove_entry(cache, cache->slots[cache->next_slot]);
+  cache->slots[cache->next_slot] = entry;
+  cache->next_slot = (cache->next_slot + 1) % cache->slot_count;
+
+  entry->hash = hash_path(path, len);
+  entry->len = len;
+  memcpy(entry->path, path, len);
+
+  bucket = &cache->buckets[entry->hash & (cache->bucket_count - 1)];
+  entry->hash_next = *bucket;
+  *bucket = entry;
+  ++cache->count;
+
+  atomic_store_explicit(&cache->stat_entries, cache->count,
+                        memory_order_relaxed);
+}
+
+static void flush(missCache *cache) {
+  for (size_t i = 0; i < cache->slot_count; ++i) {
+    if (cache->slots[i]) {
+      remove_entry(cache, cache->slots[i]);
+      cache->slots[i] = NULL;
+    }
+  }
+  cache->next_slot = 0;
+
+  atomic_store_explicit(&cache->stat_entries, 0, memory_order_relaxed);
+  atomic_fetch_add_explicit(&cache->flushes, 1, memory_order_relaxed);
+}
+
+static bool is_get_or_head(h2o_req_t *req) {
+  return h2o_memis(req->method.base, req->method.len, H2O_STRLIT("GET")) ||
+         h2o_memis(req->method.base, req->method.len, H2O_STRLIT("HEAD"));
+}
+
+static int on_lookup(h2o_handler_t *_self, h2o_req_t *req) {
+  notFoundLookup *self = (notFoundLookup *)_self;
+  missCache *cache = h2o_context_get_handler_context(req->conn->ctx, _self);
+
+  // while site_root is gone, anything could appear unnoticed
+  if (!cache || !is_get_or_head(req) || !is_site_watched(cache->watch) ||
+      !find_entry(cache, req->path_normalized.base,
+                  req->path_normalized.len))
+    return -1;
+
+  atomic_fetch_add_explicit(&cache->hits, 1, memory_order_relaxed);
+  send_page(req, self->pages, 404);
+  return 0;
+}
+
+static int on_not_found(h2o_handler_t *_self, h2o_req_t *req) {
+  notFoundLookup *lookup = ((notFoundHandler *)_self)->lookup;
+  missCache *cache =
+      h2o_context_get_handler_context(req->conn->ctx, &lookup->super);
+
+  // other methods may mean something else on the next request
+  if (cache && is_get_or_head(req) && is_site_watched(cache->watch))
+    insert_entry(cache, req->path_normalized.base, req->path_normalized.len);
+
+  send_page(req, lookup->pages, 404);
+  return 0;
+}
+
+// anything that appears could be a path the cache says is missing
+static void on_change(const char *path, size_t len, uint32_t mask,
+                      void *data) {
+  missCache *cache = data;
+
+  if ((!path || (mask & (IN_CREATE | IN_MOVED_TO))) && cache->count > 0)
+    flush(cache);
+}
+
+static void free_cache(missCache *cache) {
+  free(cache->slots);
+  free(cache->buckets);
+  free(cache);
+}
+
+static void on_context_init(h2o_handler_t *_self, h2o_context_t *ctx) {
+  notFoundLookup *self = (notFoundLookup *)_self;
+  missCache *cache;
+
+  if (self->max_entries == 0 || (cache = calloc(1, sizeof(*cache))) == NULL)
+    return;
+
+  cache->slot_count = self->max_entries;
+  cache->bucket_count = 64;
+  while (cache->bucket_count < cache->slot_count)
+    cache->bucket_count *= 2;
+  cache->slots = calloc(cache->slot_count, sizeof(*cache->slots));
+  cache->buckets = calloc(cache->bucket_count, sizeof(*cache->buckets));
+  cache->site_root = self->site_root;
+
+  // without invalidation a new file could stay a 404 until the next reload
+  if (!cache->slots || !cache->buckets ||
+      (cache->watch = watch_site(ctx->loop, cache->site_root, on_change,
+                                 cache)) == NULL) {
+    fprintf(stderr, "notfound: inotify unavailable, not caching 404s: %s\n",
+            strerror(errno));
+    free_cache(cache);
+    return;
+  }
+
+  pthread_mutex_lock(&registry_mutex);
+  if (registry_count == registry_capacity) {
+    size_t capacity = registry_capacity ? registry_capacity * 2 : 16;
+    missCache **caches = realloc(registry, capacity * sizeof(*caches));
+    if (caches) {
+      registry = caches;
+      registry_capacity = capacity;
+    }
+  }
+  if (registry_count < registry_capacity)
+    registry[registry_count++] = cache;
+  else
+    fprintf(stderr, "notfound: out of memory, cache left out of stats\n");
+  pthread_mutex_unlock(&registry_mutex);
+
+  h2o_context_set_handler_context(ctx, _self, cache);
+}
+
+static void on_context_dispose(h2o_handler_t *_self, h2o_context_t *ctx) {
+  missCache *cache = h2o_context_get_handler_context(ctx, _self);
+
+  if (!cache)
+    return;
+
+  pthread_mutex_lock(&registry_mutex);
+  for (size_t i = 0; i < registry_count; ++i) {
+    if (registry[i] == cache) {
+      registry[i] = registry[--registry_count];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&registry_mutex);
+
+  flush(cache);
+  unwatch_site(cache->watch);
+  free_cache(cache);
+}
+
+static void on_dispose(h2o_handler_t *_self) {
+  notFoundLookup *self = (notFoundLookup *)_self;
+
+  free(self->site_root);
+}
+
+notFoundLookup *register_missing_lookup(h2o_pathconf_t *pathconf,
+                                        const char *site_root,
+                                        size_t max_entries, pageSet *pages) {
+  notFoundLookup *self =
+      (notFoundLookup *)h2o_create_handler(pathconf, sizeof(*self));
+  size_t root_len = strlen(site_root);
+
+  // request paths start with a slash, so keep the root without one
+  self->site_root = h2o_strdup(NULL, site_root, root_len).base;
+  while (root_len > 1 && self->site_root[root_len - 1] == '/')
+    self->site_root[--root_len] = '\0';
+
+  self->max_entries = max_entries;
+  self->pages = pages;
+  self->super.on_context_init = on_context_init;
+  self->super.on_context_dispose = on_context_dispose;
+  self->super.dispose = on_dispose;
+  self->super.on_req = on_lookup;
+  return self;
+}
+
+void register_not_found(h2o_pathconf_t *pathconf, notFoundLookup *lookup) {
+  notFoundHandler *self =
+      (notFoundHandler *)h2o_create_handler(pathconf, sizeof(*self));
+
+  self->lookup = lookup;
+  self->super.on_req = on_not_found;
+}
+
+void not_found_stats(notFoundStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+
+  pthread_mutex_lock(&registry_mutex);
+  for (size_t i = 0; i < registry_count; ++i) {
+    missCache *cache = registry[i];
+
+    stats->entries +=
+        atomic_load_explicit(&cache->stat_entries, memory_order_relaxed);
+    stats->hits += atomic_load_explicit(&cache->hits, memory_order_relaxed);
+    stats->flushes +=
+        atomic_load_explicit(&cache->flushes, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&registry_mutex);
+}
@@ -0,0 +1,629 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <h2o.h>
+
+#include <cachepolicy.h>
+#include <etag.h>
+#include <file.h>
+#include <mime.h>
+#include <pack.h>
+#include <precompress.h>
+#include <snapshot.h>
+
+#define IDENTITY PRECOMPRESS_ENCODINGS
+#define PACK_MAGIC "toastpk1"
+#define PACK_ALIGN 4096
+#define MAX_SEED (1u << 24)
+#define ALIGN(n, a) (((n) + (a)-1) / (a) * (a))
+
+/* written and read by the same build on the same machine, so everything is
+ * in native byte order */
+typedef struct {
+  char magic[8];
+  uint32_t entry_count;
+  uint32_t bucket_count;
+  uint64_t seeds_off;   // a uint32_t per bucket, 0 for an empty one
+  uint64_t entries_off; // a packEntry per slot
+  uint64_t size;        // of the whole file
+} packHeader;
+
+typedef struct {
+  uint64_t path_off;
+  uint64_t mime_off;
+  uint32_t path_len;
+  uint32_t mime_len;
+  uint32_t variants;
+  uint32_t reserved;
+  uint64_t body_off[PRECOMPRESS_ENCODINGS + 1]; // page aligned
+  uint64_t body_len[PRECOMPRESS_ENCODINGS + 1];
+  char etags[PRECOMPRESS_ENCODINGS + 1][32];
+  char last_modified[32];
+} packEntry;
+
+typedef struct {
+  h2o_iovec_t path;
+  h2o_iovec_t mime;
+  char *fs_path; // NULL for a directory, which shares its index.html
+  struct stat st;
+  size_t slot;
+  packEntry entry;
+} packKey;
+
+typedef struct {
+  packKey *keys;
+  size_t count;
+  size_t capacity;
+  const Config *config; // for mime_types
+} packList;
+
+typedef struct {
+  h2o_handler_t super;
+  char *map;
+  size_t size;
+  const packHeader *header;
+  const uint32_t *seeds;
+  const packEntry *entries;
+} packHandler;
+
+static uint64_t hash_path(uint32_t seed, const char *path, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325 ^ (seed * 0x9e3779b97f4a7c15);
+
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= (unsigned char)path[i];
+    hash *= 0x100000001b3;
+  }
+
+  // fnv alone barely changes between neighbouring seeds
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccd;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// the body's hash when the server runs with content ETags
+static void format_etag(char *buf, const Config *config, const char *body,
+                        size_t len, time_t mtime) {
+  if (config->http_cache.content_etags)
+    format_content_etag(buf, hash_content(body, len));
+  else
+    snprintf(buf, 32, "\"%08x-%zx\"", (unsigned int)mtime, len);
+}
+
+static int append_key(packList *list, const char *path, size_t len,
+                      const char *fs_path, struct stat *st) {
+  packKey *key;
+
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 64;
+    packKey *keys = realloc(list->keys, capacity * sizeof(*keys));
+    if (!keys)
+      return -1;
+    list->keys = keys;
+    list->capacity = capacity;
+  }
+
+  key = &list->keys[list->count++];
+  memset(key, 0, sizeof(*key));
+  key->path = h2o_strdup(NULL, path, len);
+  key->fs_path = fs_path ? strdup(fs_path) : NULL;
+  key->st = *st;
+  if (fs_path)
+    key->mime = mime_for_path(list->config, fs_path, strlen(fs_path));
+  else
+    key->mime = key[-1].mime;
+  return 0;
+}
+
+static int collect_file(const char *path, const char *rel_path,
+                        struct stat *st, void *data) {
+  packList *list = data;
+  const char *slash = strrchr(rel_path, '/');
+
+  if (S_ISDIR(st->st_mode) || is_variant(path))
+    return 0;
+
+  if (append_key(list, rel_path, strlen(rel_path), path, st) != 0)
+    return -1;
+
+  // right after its file, so it can borrow the bodies
+  if (strcmp(slash + 1, "index.html") == 0 &&
+      append_key(list, rel_path, slash + 1 - rel_path, NULL, st) != 0)
+    return -1;
+  return 0;
+}
+
+static void free_list(packList *list) {
+  for (size_t i = 0; i < list->count; ++i) {
+    free(list->keys[i].path.base);
+    free(list->keys[i].fs_path);
+  }
+  free(list->keys);
+}
+
+typedef struct {
+  uint32_t bucket;
+  uint32_t size;
+} bucketSize;
+
+static int compare_buckets(const void *_a, const void *_b) {
+  const bucketSize *a = _a, *b = _b;
+  return (a->size < b->size) - (a->size > b->size);
+}
+
+/* hash and displace: biggest buckets first, each gets the first seed that
+ * sends all of its keys to free slots */
+static uint32_t *build_index(packList *list, uint32_t bucket_count) {
+  size_t n = list->count;
+  uint32_t *seeds = calloc(bucket_count, sizeof(*seeds));
+  bucketSize *order = calloc(bucket_count, sizeof(*order));
+  size_t *starts = calloc(bucket_count + 1, sizeof(*starts));
+  size_t *fill = calloc(bucket_count, sizeof(*fill));
+  size_t *members = malloc((n ? n : 1) * sizeof(*members));
+  size_t *slots = malloc((n ? n : 1) * sizeof(*slots));
+  bool *taken = calloc(n ? n : 1, sizeof(*taken));
+  uint32_t *buckets = malloc((n ? n : 1) * sizeof(*buckets));
+
+  if (!seeds || !order || !starts || !fill || !members || !slots || !taken ||
+      !buckets)
+    goto Error;
+
+  for (uint32_t b = 0; b < bucket_count; ++b)
+    order[b].bucket = b;
+  for (size_t i = 0; i < n; ++i) {
+    buckets[i] =
+        hash_path(0, list->keys[i].path.base, list->keys[i].path.len) %
+        bucket_count;
+    ++order[buckets[i]].size;
+  }
+  for (uint32_t b = 0; b < bucket_count; ++b)
+    starts[b + 1] = starts[b] + order[b].size;
+  for (size_t i = 0; i < n; ++i)
+    members[starts[buckets[i]] + fill[buckets[i]]++] = i;
+
+  qsort(order, bucket_count, sizeof(*order), compare_buckets);
+
+  for (uint32_t o = 0; o < bucket_count && order[o].size > 0; ++o) {
+    size_t *bucket = &members[starts[order[o].bucket]];
+    size_t count = order[o].size;
+    uint32_t seed;
+
+    for (seed = 1; seed < MAX_SEED; ++seed) {
+      size_t k;
+
+      for (k = 0; k < count; ++k) {
+        packKey *key = &list->keys[bucket[k]];
+        size_t slot = hash_path(seed, key->path.base, key->path.len) % n;
+        size_t j;
+
+        for (j = 0; j < k && slots[j] != slot; ++j)
+          ;
+        if (taken[slot] || j < k)
+          break;
+        slots[k] = slot;
+      }
+      if (k == count)
+        break;
+    }
+
+    if (seed == MAX_SEED) {
+      fprintf(stderr, "pack: no perfect hash for %zu paths\n", n);
+      goto Error;
+    }
+
+    seeds[order[o].bucket] = seed;
+    for (size_t k = 0; k < count; ++k) {
+      taken[slots[k]] = true;
+      list->keys[bucket[k]].slot = slots[k];
+    }
+  }
+
+  free(order);
+  free(starts);
+  free(fill);
+  free(members);
+  free(slots);
+  free(taken);
+  free(buckets);
+  return seeds;
+Error:
+  free(seeds);
+  free(order);
+  free(starts);
+  free(fill);
+  free(members);
+  free(slots);
+  free(taken);
+  free(buckets);
+  return NULL;
+}
+
+static int write_at(int fd, const void *buf, size_t len, uint64_t off) {
+  const char *p = buf;
+
+  while (len > 0) {
+    ssize_t r = pwrite(fd, p, len, off);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return -1;
+    p += r;
+    len -= r;
+    off += r;
+  }
+  return 0;
+}
+
+static char *read_body(const char *path, size_t size) {
+  FILE *fp = fopen(path, "rb");
+  char *buf;
+
+  if (!fp)
+    return NULL;
+
+  if ((buf = malloc(size ? size : 1)) != NULL &&
+      fread(buf, 1, size, fp) != size) {
+    free(buf);
+    buf = NULL;
+  }
+
+  fclose(fp);
+  return buf;
+}
+
+static int add_body(int fd, uint64_t *off, packEntry *entry, int index,
+                    const char *body, size_t len) {
+  if (write_at(fd, body, len, *off) != 0)
+    return -1;
+  entry->body_off[index] = *off;
+  entry->body_len[index] = len;
+  *off = ALIGN(*off + len, PACK_ALIGN);
+  return 0;
+}
+
+/* an up to date sibling is taken as is, otherwise the variant is made here
+ * the way --precompress would */
+static int add_variant(int fd, uint64_t *off, packKey *key, int index,
+                       const char *body, unsigned int min_size,
+                       const Config *config) {
+  const precompressVariant *variant = &precompress_variants[index];
+  char variant_path[1024];
+  struct stat variant_st;
+  char *encoded;
+  size_t encoded_len;
+  int r;
+
+  snprintf(variant_path, 1024, "%s%s", key->fs_path, variant->extension);
+  if (stat(variant_path, &variant_st) == 0 &&
+      variant_st.st_mtime >= key->st.st_mtime) {
+    if ((encoded = read_body(variant_path, variant_st.st_size)) == NULL)
+      return -1;
+    encoded_len = variant_st.st_size;
+  } else if (!is_compressible(key->fs_path) ||
+             (size_t)key->st.st_size < min_size ||
+             precompress_buffer(variant->encoding, body, key->st.st_size,
+                                &encoded, &encoded_len) != 0) {
+    return 0;
+  } else if (encoded_len >= (size_t)key->st.st_size) {
+    // a variant that doesn't save anything is never worth sending
+    free(encoded);
+    return 0;
+  }
+
+  if ((r = add_body(fd, off, &key->entry, index, encoded, encoded_len)) == 0) {
+    key->entry.variants |= variant->encoding;
+    format_etag(key->entry.etags[index], config, encoded, encoded_len,
+                key->st.st_mtime);
+  }
+  free(encoded);
+  return r;
+}
+
+static int add_file(int fd, uint64_t *off, packKey *key,
+                    unsigned int min_size, const Config *config) {
+  packEntry *entry = &key->entry;
+  char *body = read_body(key->fs_path, key->st.st_size);
+
+  if (!body) {
+    fprintf(stderr, "pack: failed to read %s\n", key->fs_path);
+    return -1;
+  }
+
+  format_etag(entry->etags[IDENTITY], config, body, key->st.st_size,
+              key->st.st_mtime);
+  h2o_time2str_rfc1123(entry->last_modified, key->st.st_mtime);
+
+  if (add_body(fd, off, entry, IDENTITY, body, key->st.st_size) != 0)
+    goto Error;
+  for (int i = 0; i < PRECOMPRESS_ENCODINGS; ++i)
+    if (add_variant(fd, off, key, i, body, min_size, config) != 0)
+      goto Error;
+
+  free(body);
+  return 0;
+Error:
+  fprintf(stderr, "pack: failed to add %s: %s\n", key->fs_path,
+          strerror(errno));
+  free(body);
+  return -1;
+}
+
+static int write_pack(int fd, packList *list, unsigned int min_size) {
+  size_t n = list->count;
+  uint32_t bucket_count = n / 2 + 1;
+  uint32_t *seeds = NULL;
+  packEntry *entries = NULL;
+  packHeader header = {.magic = PACK_MAGIC};
+  uint64_t strings_off, string, off;
+  int r = -1;
+
+  if ((seeds = build_index(list, bucket_count)) == NULL ||
+      (entries = calloc(n ? n : 1, sizeof(*entries))) == NULL)
+    goto Done;
+
+  header.entry_count = n;
+  header.bucket_count = bucket_count;
+  header.seeds_off = sizeof(header);
+  header.entries_off = ALIGN(header.seeds_off + bucket_count * sizeof(*seeds),
+                             sizeof(uint64_t));
+  strings_off = header.entries_off + n * sizeof(*entries);
+
+  string = strings_off;
+  for (size_t i = 0; i < n; ++i)
+    string += list->keys[i].path.len + list->keys[i].mime.len;
+  off = ALIGN(string, PACK_ALIGN);
+
+  string = strings_off;
+  for (size_t i = 0; i < n; ++i) {
+    packKey *key = &list->keys[i];
+
+    if (key->fs_path == NULL)
+      key->entry = key[-1].entry;
+    else if (add_file(fd, &off, key, min_size, list->config) != 0)
+      goto Done;
+
+    key->entry.path_off = string;
+    key->entry.path_len = key->path.len;
+    string += key->path.len;
+    key->entry.mime_off = string;
+    key->entry.mime_len = key->mime.len;
+    string += key->mime.len;
+
+    if (write_at(fd, key->path.base, key->path.len, key->entry.path_off) !=
+            0 ||
+        write_at(fd, key->mime.base, key->mime.len, key->entry.mime_off) != 0)
+      goto Done;
+    entries[key->slot] = key->entry;
+  }
+
+  header.size = off;
+  if (write_at(fd, &header, sizeof(header), 0) != 0 ||
+      write_at(fd, seeds, bucket_count * sizeof(*seeds), header.seeds_off) !=
+          0 ||
+      write_at(fd, entries, n * sizeof(*entries), header.entries_off) != 0 ||
+      ftruncate(fd, off) != 0 || fsync(fd) != 0)
+    goto Done;
+
+  r = 0;
+Done:
+  free(seeds);
+  free(entries);
+  return r;
+}
+
+int build_pack(const char *site_root, const char *pack_path,
+               unsigned int min_size, const Config *config) {
+  packList list = {.config = config};
+  char tmp_path[1024];
+  int fd, r;
+
+  if (walk_dir(site_root, "", collect_file, &list) != 0) {
+    fprintf(stderr, "pack: failed to walk %s: %s\n", site_root,
+            strerror(errno));
+    free_list(&list);
+    return -1;
+  }
+
+  snprintf(tmp_path, 1024, "%s.tmp", pack_path);
+  if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) ==
+      -1) {
+    fprintf(stderr, "pack: can't create %s: %s\n", tmp_path, strerror(errno));
+    free_list(&list);
+    return -1;
+  }
+
+  r = write_pack(fd, &list, min_size);
+  if (close(fd) != 0 || r != 0 || rename(tmp_path, pack_path) != 0) {
+    fprintf(stderr, "pack: failed to write %s\n", pack_path);
+    unlink(tmp_path);
+    free_list(&list);
+    return -1;
+  }
+
+  printf("pack: %zu paths from %s in %s\n", list.count, site_root, pack_path);
+  free_list(&list);
+  return 0;
+}
+
+static bool in_map(size_t size, uint64_t off, uint64_t len) {
+  return off <= size && len <= size - off;
+}
+
+static bool valid_pack(const char *map, size_t size) {
+  const packHeader *header = (const packHeader *)map;
+  const packEntry *entries;
+
+  if (size < sizeof(*header) ||
+      memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)) != 0 ||
+      header->size != size || header->bucket_count == 0 ||
+      header->entries_off % sizeof(uint64_t) != 0 ||
+      !in_map(size, header->seeds_off,
+              (uint64_t)header->bucket_count * sizeof(uint32_t)) ||
+      !in_map(size, header->entries_off,
+              (uint64_t)header->entry_count * sizeof(packEntry)))
+    return false;
+
+  // checked once here, requests then trust every offset
+  entries = (const packEntry *)(map + header->entries_off);
+  for (uint32_t i = 0; i < header->entry_count; ++i) {
+    if (!in_map(size, entries[i].path_off, entries[i].path_len) ||
+        !in_map(size, entries[i].mime_off, entries[i].mime_len))
+      return false;
+    for (int j = 0; j <= IDENTITY; ++j)
+      if (!in_map(size, entries[i].body_off[j], entries[i].body_len[j]))
+        return false;
+  }
+  return true;
+}
+
+static const packEntry *find_entry(packHandler *self, const char *path,
+                                   size_t len) {
+  const packHeader *header = self->header;
+  const packEntry *entry;
+  uint32_t seed;
+
+  if (header->entry_count == 0)
+    return NULL;
+
+  // a path that isn't in the pack still lands on some slot
+  seed = self->seeds[hash_path(0, path, len) % header->bucket_count];
+  if (seed == 0)
+    return NULL;
+  entry = &self->entries[hash_path(seed, path, len) % header->entry_count];
+  return h2o_memis(self->map + entry->path_off, entry->path_len, path, len)
+             ? entry
+             : NULL;
+}
+
+static int on_req(h2o_handler_t *_self, h2o_req_t *req) {
+  static h2o_generator_t generator = {NULL, NULL};
+  packHandler *self = (packHandler *)_self;
+  const packEntry *entry;
+  int chosen = IDENTITY;
+
+  bool is_head = h2o_memis(req->method.base, req->method.len,
+                           H2O_STRLIT("HEAD"));
+  if (!is_head &&
+      !h2o_memis(req->method.base, req->method.len, H2O_STRLIT("GET")))
+    return -1;
+
+  // ranges are left to the file handler
+  if (h2o_find_header(&req->headers, H2O_TOKEN_RANGE, -1) != -1)
+    return -1;
+
+  if ((entry = find_entry(self, req->path_normalized.base,
+                          req->path_normalized.len)) == NULL)
+    return -1;
+
+  if (entry->variants) {
+    unsigned int usable = accepted_encodings(req) & entry->variants;
+    for (int i = 0; i < PRECOMPRESS_ENCODINGS; ++i) {
+      if (usable & precompress_variants[i].encoding) {
+        chosen = i;
+        break;
+      }
+    }
+    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_VARY, NULL,
+                   H2O_STRLIT("Accept-Encoding"));
+  }
+
+  const char *etag = entry->etags[chosen];
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_ETAG, NULL, etag,
+                 strlen(etag));
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_LAST_MODIFIED, NULL,
+                 entry->last_modified, H2O_TIMESTR_RFC1123_LEN);
+
+  h2o_iovec_t cache_control =
+      cache_control_for(&get_snapshot(req)->config, req->path_normalized.base,
+                        req->path_normalized.len);
+  if (cache_control.len != 0)
+    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CACHE_CONTROL,
+                   NULL, cache_control.base, cache_control.len);
+
+  if (header_contains(req, H2O_TOKEN_IF_NONE_MATCH, etag) ||
+      (h2o_find_header(&req->headers, H2O_TOKEN_IF_NONE_MATCH, -1) == -1 &&
+       header_contains(req, H2O_TOKEN_IF_MODIFIED_SINCE,
+                       entry->last_modified))) {
+    req->res.status = 304;
+    req->res.reason = "Not Modified";
+    h2o_start_response(req, &generator);
+    h2o_send(req, NULL, 0, H2O_SEND_STATE_FINAL);
+    return 0;
+  }
+
+  if (chosen != IDENTITY)
+    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_ENCODING,
+                   NULL, precompress_variants[chosen].name,
+                   strlen(precompress_variants[chosen].name));
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
+                 self->map + entry->mime_off, entry->mime_len);
+
+  // straight out of the mapping, the snapshot keeps it alive until sent
+  h2o_iovec_t body = h2o_iovec_init(self->map + entry->body_off[chosen],
+                                    entry->body_len[chosen]);
+  req->res.status = 200;
+  req->res.reason = "OK";
+  req->res.content_length = body.len;
+  h2o_start_response(req, &generator);
+  h2o_send(req, &body, is_head ? 0 : 1, H2O_SEND_STATE_FINAL);
+
+  return 0;
+}
+
+static void on_dispose(h2o_handler_t *_self) {
+  packHandler *self = (packHandler *)_self;
+  munmap(self->map, self->size);
+}
+
+int register_pack(h2o_pathconf_t *pathconf, const char *pack_path) {
+  int fd = open(pack_path, O_RDONLY | O_CLOEXEC);
+  packHandler *self;
+  struct stat st;
+  char *map;
+
+  if (fd == -1) {
+    fprintf(stderr, "pack: can't open %s, build it with toast --pack: %s\n",
+            pack_path, strerror(errno));
+    return -1;
+  }
+
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    fprintf(stderr, "pack: %s is empty\n", pack_path);
+    close(fd);
+    return -1;
+  }
+
+  /* rebuilds rename a new file over the path, so this inode never changes
+   * under the mapping */
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "pack: can't map %s: %s\n", pack_path, strerror(errno));
+    return -1;
+  }
+
+  if (!valid_pack(map, st.st_size)) {
+    fprintf(stderr, "pack: %s is damaged or from another build\n", pack_path);
+    munmap(map, st.st_size);
+    return -1;
+  }
+  madvise(map, st.st_size, MADV_WILLNEED);
+
+  self = (packHandler *)h2o_create_handler(pathconf, sizeof(*self));
+  self->map = map;
+  self->size = st.st_size;
+  self->header = (const packHeader *)map;
+  self->seeds = (const uint32_t *)(map + self->header->seeds_off);
+  self->entries = (const packEntry *)(map + self->header->entries_off);
+  self->super.dispose = on_dispose;
+  self->super.on_req = on_req;
+  return 0;
+}
@@ -0,0 +1,356 @@
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <h2o.h>
+
+#include <clock.h>
+#include <pages.h>
+#include <precompress.h>
+
+#define MAX_TEMPLATE_SIZE (64 * 1024)
+#define PAGE_STYLE                                                             \
+  "<style>"                                                                    \
+  "body{font-family: sans-serif;}"                                             \
+  "h1{font-size: 1.5em;}"                                                      \
+  "p{font-size: 1em; margin-bottom: 0.5em;}"                                   \
+  "sub{font-size: 0.7em;}"                                                     \
+  "</style>"
+#define PAGE_FOOTER                                                            \
+  "<sub><a href=\"https://git.enstore.cloud/enstore.cloud/toast\" "            \
+  "target=\"_blank\">toast</a>, {year}</sub>"
+
+static const char *error_template =
+    "<title>Error {status}</title>" PAGE_STYLE "<h1>Error {status}</h1>"
+    "<p>{reason}</p>" PAGE_FOOTER;
+
+static const char *welcome_template =
+    "<title>Welcome to toast!</title>" PAGE_STYLE "<h1>Welcome to toast!</h1>"
+    "<p>If you are seeing this, it means that toast is working "
+    "but might be missing files in site root!</p>" PAGE_FOOTER;
+
+static const struct {
+  int status;
+  const char *reason;
+} page_statuses[] = {
+    {200, "OK"},
+    {400, "Bad Request"},
+    {403, "Forbidden"},
+    {404, "Not Found"},
+    {405, "Method Not Allowed"},
+    {408, "Request Timeout"},
+    {413, "Payload Too Large"},
+    {429, "Too Many Requests"},
+    {500, "Internal Server Error"},
+    {502, "Bad Gateway"},
+    {503, "Service Unavailable"},
+    {504, "Gateway Timeout"},
+};
+
+#define PAGE_COUNT (sizeof(page_statuses) / sizeof(page_statuses[0]))
+
+// a NULL base segment is a placeholder, its len says which one
+enum { SEGMENT_PATH = 1, SEGMENT_YEAR };
+
+/* literal segments with the request path and year spliced in between
+ * them, sent with a single h2o_send so they go out together */
+typedef struct {
+  int status;
+  const char *reason;
+  char *text;
+  h2o_iovec_t *segments;
+  size_t segment_count;
+  bool has_path;
+  int year; // the variants are only sent while it's still this year
+  h2o_iovec_t variants[PRECOMPRESS_ENCODINGS];
+  unsigned int encodings;
+} compiledPage;
+
+struct pageSet {
+  compiledPage pages[PAGE_COUNT];
+};
+
+typedef struct {
+  char *buf;
+  size_t len;
+  size_t capacity;
+} textBuffer;
+
+static int append(textBuffer *text, const char *src, size_t len) {
+  if (text->len + len > text->capacity) {
+    size_t capacity = (text->len + len) * 2;
+    char *buf = realloc(text->buf, capacity);
+    if (!buf)
+      return -1;
+    text->buf = buf;
+    text->capacity = capacity;
+  }
+
+  memcpy(text->buf + text->len, src, len);
+  text->len += len;
+  return 0;
+}
+
+static char *read_template(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  char *buf = NULL;
+  ssize_t r;
+
+  if (fd == -1)
+    return NULL;
+
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_size > MAX_TEMPLATE_SIZE ||
+      (buf = malloc(st.st_size + 1)) == NULL)
+    goto Exit;
+
+  if ((r = read(fd, buf, st.st_size)) != st.st_size) {
+    free(buf);
+    buf = NULL;
+    goto Exit;
+  }
+  buf[r] = '\0';
+
+Exit:
+  close(fd);
+  return buf;
+}
+
+/* segment offsets are kept in base until text stops moving, one past the
+ * offset so the first one isn't mistaken for a placeholder */
+static int add_segment(compiledPage *page, size_t *capacity, size_t start,
+                       size_t end, int placeholder) {
+  if (page->segment_count == *capacity) {
+    size_t count = *capacity ? *capacity * 2 : 8;
+    h2o_iovec_t *segments =
+        realloc(page->segments, count * sizeof(*segments));
+    if (!segments)
+      return -1;
+    page->segments = segments;
+    *capacity = count;
+  }
+
+  if (placeholder)
+    page->segments[page->segment_count++] = h2o_iovec_init(NULL, placeholder);
+  else if (end > start)
+    page->segments[page->segment_count++] =
+        h2o_iovec_init((char *)start + 1, end - start);
+  return 0;
+}
+
+static int compile_page(compiledPage *page, const char *template) {
+  textBuffer text = {0};
+  size_t capacity = 0, literal_start = 0;
+  char status[8];
+
+  snprintf(status, sizeof(status), "%d", page->status);
+
+  for (const char *p = template; *p;) {
+    const char *value = NULL;
+    size_t skip = 0;
+    int placeholder = 0;
+
+    if (strncmp(p, "{status}", 8) == 0)
+      value = status, skip = 8;
+    else if (strncmp(p, "{reason}", 8) == 0)
+      value = page->reason, skip = 8;
+    else if (strncmp(p, "{year}", 6) == 0)
+      placeholder = SEGMENT_YEAR, skip = 6;
+    else if (strncmp(p, "{path}", 6) == 0)
+      placeholder = SEGMENT_PATH, skip = 6;
+
+    if (skip == 0) {
+      if (append(&text, p++, 1) != 0)
+        goto Error;
+      continue;
+    }
+
+    p += skip;
+    if (value) {
+      if (append(&text, value, strlen(value)) != 0)
+        goto Error;
+      continue;
+    }
+
+    if (add_segment(page, &capacity, literal_start, text.len, 0) != 0 ||
+        add_segment(page, &capacity, 0, 0, placeholder) != 0)
+      goto Error;
+    literal_start = text.len;
+    page->has_path |= placeholder == SEGMENT_PATH;
+  }
+
+  if (add_segment(page, &capacity, literal_start, text.len, 0) != 0)
+    goto Error;
+
+  page->text = text.buf;
+  for (size_t i = 0; i < page->segment_count; ++i)
+    if (page->segments[i].base)
+      page->segments[i].base =
+          page->text + (size_t)page->segments[i].base - 1;
+  return 0;
+
+Error:
+  free(text.buf);
+  return -1;
+}
+
+// only a page without {path} is the same for every request of the year
+static void encode_page(compiledPage *page) {
+  textBuffer text = {0};
+  char year[8];
+  h2o_iovec_t body;
+
+  if (page->has_path || page->segment_count == 0)
+    return;
+
+  page->year = clock_now()->year;
+  snprintf(year, sizeof(year), "%d", page->year);
+  for (size_t i = 0; i < page->segment_count; ++i) {
+    h2o_iovec_t segment = page->segments[i];
+
+    if (!segment.base)
+      segment = h2o_iovec_init(year, strlen(year));
+    if (append(&text, segment.base, segment.len) != 0) {
+      free(text.buf);
+      return;
+    }
+  }
+  body = h2o_iovec_init(text.buf, text.len);
+
+  for (int i = 0; i < PRECOMPRESS_ENCODINGS; ++i) {
+    char *encoded;
+    size_t encoded_len;
+
+    if (precompress_buffer(precompress_variants[i].encoding, body.base,
+                           body.len, &encoded, &encoded_len) != 0)
+      continue;
+
+    // a variant that doesn't save anything is never worth sending
+    if (encoded_len >= body.len) {
+      free(encoded);
+      continue;
+    }
+
+    page->variants[i] = h2o_iovec_init(encoded, encoded_len);
+    page->encodings |= precompress_variants[i].encoding;
+  }
+  free(text.buf);
+}
+
+pageSet *load_pages(const char *site_root) {
+  pageSet *pages = calloc(1, sizeof(*pages));
+
+  if (!pages)
+    return NULL;
+
+  for (size_t i = 0; i < PAGE_COUNT; ++i) {
+    compiledPage *page = &pages->pages[i];
+    char path[1024];
+    char *template = NULL;
+
+    page->status = page_statuses[i].status;
+    page->reason = page_statuses[i].reason;
+
+    if (page->status != 200) {
+      snprintf(path, 1024, "%s/%d.html", site_root, page->status);
+      template = read_template(path);
+    }
+
+    if (compile_page(page, template ? template
+                     : page->status == 200 ? welcome_template
+                                           : error_template) != 0) {
+      fprintf(stderr, "pages: failed to compile the %d page\n", page->status);
+      free(template);
+      free_pages(pages);
+      return NULL;
+    }
+
+    free(template);
+    encode_page(page);
+  }
+
+  return pages;
+}
+
+void free_pages(pageSet *pages) {
+  for (size_t i = 0; i < PAGE_COUNT; ++i) {
+    compiledPage *page = &pages->pages[i];
+
+    for (int j = 0; j < PRECOMPRESS_ENCODINGS; ++j)
+      free(page->variants[j].base);
+    free(page->segments);
+    free(page->text);
+  }
+  free(pages);
+}
+
+static compiledPage *find_page(pageSet *pages, int status) {
+  for (size_t i = 0; i < PAGE_COUNT; ++i)
+    if (pages->pages[i].status == status)
+      return &pages->pages[i];
+  return NULL;
+}
+
+void send_page(h2o_req_t *req, pageSet *pages, int status) {
+  static h2o_generator_t generator = {NULL, NULL};
+  compiledPage *page = find_page(pages, status);
+  bool is_head =
+      h2o_memis(req->method.base, req->method.len, H2O_STRLIT("HEAD"));
+  int year = clock_now()->year;
+  h2o_iovec_t *bufs, year_buf = {NULL, 0};
+  size_t content_length = 0;
+
+  if (!page)
+    page = find_page(pages, status < 500 ? 400 : 500);
+
+  req->res.status = status;
+  req->res.reason = page->status == status ? page->reason : "Error";
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_TYPE, NULL,
+                 H2O_STRLIT("text/html; charset=utf-8"));
+
+  if (page->encodings && page->year == year) {
+    unsigned int usable = accepted_encodings(req) & page->encodings;
+
+    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_VARY, NULL,
+                   H2O_STRLIT("Accept-Encoding"));
+    for (int i = 0; i < PRECOMPRESS_ENCODINGS; ++i) {
+      if (usable & precompress_variants[i].encoding) {
+        h2o_add_header(&req->pool, &req->res.headers,
+                       H2O_TOKEN_CONTENT_ENCODING, NULL,
+                       precompress_variants[i].name,
+                       strlen(precompress_variants[i].name));
+        req->res.content_length = page->variants[i].len;
+        h2o_start_response(req, &generator);
+        h2o_send(req, &page->variants[i], is_head ? 0 : 1,
+                 H2O_SEND_STATE_FINAL);
+        return;
+      }
+    }
+  }
+
+  bufs = h2o_mem_alloc_pool(&req->pool, h2o_iovec_t, page->segment_count);
+  for (size_t i = 0; i < page->segment_count; ++i) {
+    if (page->segments[i].base) {
+      bufs[i] = page->segments[i];
+    } else if (page->segments[i].len == SEGMENT_PATH) {
+      bufs[i] = h2o_htmlescape(&req->pool, req->path_normalized.base,
+                               req->path_normalized.len);
+    } else {
+      if (!year_buf.base) {
+        year_buf.base = h2o_mem_alloc_pool(&req->pool, char, 8);
+        year_buf.len = snprintf(year_buf.base, 8, "%d", year);
+      }
+      bufs[i] = year_buf;
+    }
+    content_length += bufs[i].len;
+  }
+
+  req->res.content_length = content_length;
+  h2o_start_response(req, &generator);
+  h2o_send(req, bufs, is_head ? 0 : page->segment_count, H2O_SEND_STATE_FINAL);
+}
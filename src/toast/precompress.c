@@ -0,0 +1,535 @@
+#include <brotli/encode.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <zstd.h>
+
+#include <h2o.h>
+
+#include <cachepolicy.h>
+#include <etag.h>
+#include <file.h>
+#include <mime.h>
+#include <precompress.h>
+
+#define IDENTITY PRECOMPRESS_ENCODINGS
+
+const precompressVariant precompress_variants[PRECOMPRESS_ENCODINGS] = {
+    {Brotli, "br", ".br"},
+    {Zstd, "zstd", ".zst"},
+    {Gzip, "gzip", ".gz"},
+};
+
+static const char *compressible_extensions[] = {
+    "html", "htm", "css", "js",  "mjs", "json", "map",  "svg",         "xml",
+    "txt",  "md",  "csv", "ico", "wasm", "ttf", "otf", "webmanifest", NULL};
+
+// a file as it was indexed, its etag only holds while these do
+typedef struct {
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+} fileStamp;
+
+typedef struct {
+  h2o_iovec_t path; // request path, directories map to their index.html
+  h2o_iovec_t mime;
+  h2o_iovec_t cache_control;
+  unsigned int variants;
+  char *files[PRECOMPRESS_ENCODINGS + 1];
+  char etags[PRECOMPRESS_ENCODINGS + 1][32];
+  fileStamp stamps[PRECOMPRESS_ENCODINGS + 1];
+} indexEntry;
+
+typedef struct {
+  indexEntry *entries;
+  size_t size;
+  size_t capacity;
+  const Config *config; // for mime_types and cache policies
+  siteHashes *hashes;   // only while indexing
+  bool content_etags;   // otherwise in h2o_file_send's shape
+} precompressIndex;
+
+typedef struct {
+  h2o_handler_t super;
+  precompressIndex *index;
+} precompressHandler;
+
+static bool has_suffix(const char *path, const char *suffix) {
+  size_t path_len = strlen(path), suffix_len = strlen(suffix);
+  return path_len >= suffix_len &&
+         strcmp(path + path_len - suffix_len, suffix) == 0;
+}
+
+bool is_variant(const char *path) {
+  for (int i = 0; i < PRECOMPRESS_ENCODINGS; ++i)
+    if (has_suffix(path, precompress_variants[i].extension))
+      return true;
+  return false;
+}
+
+bool is_compressible(const char *path) {
+  const char *ext = strrchr(path, '.');
+  if (!ext || strchr(ext, '/'))
+    return false;
+
+  for (const char **known = compressible_extensions; *known; ++known)
+    if (strcasecmp(ext + 1, *known) == 0)
+      return true;
+  return false;
+}
+
+static int encode_gzip(const char *in, size_t in_len, char **out,
+                       size_t *out_len) {
+  z_stream zs = {0};
+
+  // windowBits 15 + 16 writes a gzip header instead of a zlib one
+  if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    return -1;
+
+  size_t bound = deflateBound(&zs, in_len);
+  if ((*out = malloc(bound)) == NULL) {
+    deflateEnd(&zs);
+    return -1;
+  }
+
+  zs.next_in = (Bytef *)in;
+  zs.avail_in = in_len;
+  zs.next_out = (Bytef *)*out;
+  zs.avail_out = bound;
+
+  int r = deflate(&zs, Z_FINISH);
+  *out_len = zs.total_out;
+  deflateEnd(&zs);
+
+  if (r != Z_STREAM_END) {
+    free(*out);
+    return -1;
+  }
+  return 0;
+}
+
+static int encode_brotli(const char *in, size_t in_len, char **out,
+                         size_t *out_len) {
+  size_t bound = BrotliEncoderMaxCompressedSize(in_len);
+  if (bound == 0 || (*out = malloc(bound)) == NULL)
+    return -1;
+
+  *out_len = bound;
+  if (BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_MAX_WINDOW_BITS,
+                            BROTLI_MODE_GENERIC, in_len, (const uint8_t *)in,
+                            out_len, (uint8_t *)*out) != BROTLI_TRUE) {
+    free(*out);
+    return -1;
+  }
+  return 0;
+}
+
+static int encode_zstd(const char *in, size_t in_len, char **out,
+                       size_t *out_len) {
+  size_t bound = ZSTD_compressBound(in_len);
+  if ((*out = malloc(bound)) == NULL)
+    return -1;
+
+  *out_len = ZSTD_compress(*out, bound, in, in_len, ZSTD_maxCLevel());
+  if (ZSTD_isError(*out_len)) {
+    free(*out);
+    return -1;
+  }
+  return 0;
+}
+
+int precompress_buffer(precompressEncoding encoding, const char *in,
+                       size_t in_len, char **out, size_t *out_len) {
+  switch (encoding) {
+  case Brotli:
+    return encode_brotli(in, in_len, out, out_len);
+  case Zstd:
+    return encode_zstd(in, in_len, out, out_len);
+  case Gzip:
+    return encode_gzip(in, in_len, out, out_len);
+  }
+  return -1;
+}
+
+static char *slurp(const char *path, size_t size) {
+  FILE *fp = fopen(path, "rb");
+  char *buf;
+
+  if (!fp)
+    return NULL;
+
+  if ((buf = malloc(size ? size : 1)) != NULL &&
+      fread(buf, 1, size, fp) != size) {
+    free(buf);
+    buf = NULL;
+  }
+
+  fclose(fp);
+  return buf;
+}
+
+static int write_atomically(const char *path, const char *buf, size_t len) {
+  char tmp_path[1024];
+  FILE *fp;
+
+  snprintf(tmp_path, 1024, "%s.tmp", path);
+  if ((fp = fopen(tmp_path, "wb")) == NULL)
+    return -1;
+
+  if (fwrite(buf, 1, len, fp) != len) {
+    fclose(fp);
+    unlink(tmp_path);
+    return -1;
+  }
+
+  if (fclose(fp) != 0 || rename(tmp_path, path) != 0) {
+    unlink(tmp_path);
+    return -1;
+  }
+  return 0;
+}
+
+static int precompress_file(const char *path, const char *rel_path,
+                            struct stat *st, void *data) {
+  unsigned int min_size = *(unsigned int *)data;
+  char *body = NULL;
+
+  if (S_ISDIR(st->st_mode) || is_variant(path) || !is_compressible(path) ||
+      (size_t)st->st_size < min_size)
+    return 0;
+
+  for (int i = 0; i < PRECOMPRESS_ENCODINGS; ++i) {
+    const precompressVariant *variant = &precompress_variants[i];
+    char variant_path[1024];
+    struct stat variant_st;
+    char *encoded;
+    size_t encoded_len;
+
+    snprintf(variant_path, 1024, "%s%s", path, variant->extension);
+    if (stat(variant_path, &variant_st) == 0 &&
+        variant_st.st_mtime >= st->st_mtime)
+      continue;
+
+    if (!body && (body = slurp(path, st->st_size)) == NULL) {
+      fprintf(stderr, "precompress: failed to read %s\n", path);
+      return 0;
+    }
+
+    if (precompress_buffer(variant->encoding, body, st->st_size, &encoded,
+                           &encoded_len) != 0) {
+      fprintf(stderr, "precompress: %s failed for %s\n", variant->name, path);
+      continue;
+    }
+
+    // a variant that doesn't save anything is never worth sending
+    if (encoded_len >= (size_t)st->st_size)
+      unlink(variant_path);
+    else if (write_atomically(variant_path, encoded, encoded_len) != 0)
+      fprintf(stderr, "precompress: failed to write %s\n", variant_path);
+
+    free(encoded);
+  }
+
+  free(body);
+  return 0;
+}
+
+int precompress_site(const char *site_root, unsigned int min_size) {
+  if (walk_dir(site_root, "", precompress_file, &min_size) != 0) {
+    fprintf(stderr, "precompress: failed to walk %s: %s\n", site_root,
+            strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static int format_etag(char *buf, precompressIndex *index,
+                       const char *rel_path, struct stat *st) {
+  uint64_t hash;
+
+  if (!index->hashes) {
+    // same shape as the validators h2o_file_send emits for the file
+    snprintf(buf, 32, "\"%08x-%zx\"", (unsigned int)st->st_mtime,
+             (size_t)st->st_size);
+    return 0;
+  }
+
+  if (!find_site_hash(index->hashes, rel_path, strlen(rel_path), &hash))
+    return -1;
+  format_content_etag(buf, hash);
+  return 0;
+}
+
+static void stamp(fileStamp *stamp, const struct stat *st) {
+  stamp->ino = st->st_ino;
+  stamp->size = st->st_size;
+  stamp->mtime = st->st_mtim;
+}
+
+static bool unchanged(const char *path, const fileStamp *stamp) {
+  struct stat st;
+
+  return stat(path, &st) == 0 && st.st_ino == stamp->ino &&
+         st.st_size == stamp->size &&
+         st.st_mtim.tv_sec == stamp->mtime.tv_sec &&
+         st.st_mtim.tv_nsec == stamp->mtime.tv_nsec;
+}
+
+static indexEntry *append_entry(precompressIndex *index) {
+  if (index->size == index->capacity) {
+    size_t capacity = index->capacity ? index->capacity * 2 : 64;
+    indexEntry *entries = realloc(index->entries, capacity * sizeof(*entries));
+    if (!entries)
+      return NULL;
+    index->entries = entries;
+    index->capacity = capacity;
+  }
+  return &index->entries[index->size++];
+}
+
+static int index_file(const char *path, const char *rel_path, struct stat *st,
+                      void *data) {
+  precompressIndex *index = data;
+  indexEntry entry = {0};
+
+  if (S_ISDIR(st->st_mode) || is_variant(path))
+    return 0;
+
+  // without an identity hash the file handler after us sends it
+  if (format_etag(entry.etags[IDENTITY], index, rel_path, st) != 0)
+    return 0;
+  stamp(&entry.stamps[IDENTITY], st);
+
+  for (int i = 0; i < PRECOMPRESS_ENCODINGS; ++i) {
+    char variant_path[1024], variant_rel[1024];
+    struct stat variant_st;
+
+    snprintf(variant_path, 1024, "%s%s", path,
+             precompress_variants[i].extension);
+    snprintf(variant_rel, 1024, "%s%s", rel_path,
+             precompress_variants[i].extension);
+    if (stat(variant_path, &variant_st) != 0 ||
+        variant_st.st_mtime < st->st_mtime ||
+        format_etag(entry.etags[i], index, variant_rel, &variant_st) != 0)
+      continue;
+
+    entry.variants |= precompress_variants[i].encoding;
+    entry.files[i] = strdup(variant_path);
+    stamp(&entry.stamps[i], &variant_st);
+  }
+
+  if (entry.variants == 0)
+    return 0;
+
+  entry.files[IDENTITY] = strdup(path);
+  entry.mime = mime_for_path(index->config, path, strlen(path));
+  entry.cache_control =
+      cache_control_for(index->config, rel_path, strlen(rel_path));
+
+  // register index.html under its directory path as well
+  const char *slash = strrchr(rel_path, '/');
+  for (int pass = 0; pass < 2; ++pass) {
+    size_t len = strlen(rel_path);
+    indexEntry *slot;
+
+    if (pass == 1) {
+      if (strcmp(slash + 1, "index.html") != 0)
+        break;
+      len = slash + 1 - rel_path;
+    }
+
+    if ((slot = append_entry(index)) == NULL)
+      return -1;
+    *slot = entry;
+    slot->path = h2o_strdup(NULL, rel_path, len);
+  }
+
+  return 0;
+}
+
+static int compare_entries(const void *_a, const void *_b) {
+  const indexEntry *a = _a, *b = _b;
+  size_t len = a->path.len < b->path.len ? a->path.len : b->path.len;
+  int r = memcmp(a->path.base, b->path.base, len);
+  return r != 0 ? r : (a->path.len > b->path.len) - (a->path.len < b->path.len);
+}
+
+static indexEntry *find_entry(precompressIndex *index, const char *path,
+                              size_t path_len) {
+  indexEntry key = {.path = h2o_iovec_init(path, path_len)};
+  return bsearch(&key, index->entries, index->size, sizeof(key),
+                 compare_entries);
+}
+
+static bool rejects(const char *params, const char *end) {
+  const char *q = params;
+
+  // "q=0", "q=0.", "q=0.000" all mean the coding is not acceptable
+  while (q < end && (q = memchr(q, 'q', end - q)) != NULL) {
+    const char *p = q + 1;
+    q = p;
+    if (p >= end || *p++ != '=' || p >= end || *p++ != '0')
+      continue;
+    if (p < end && *p == '.')
+      ++p;
+    while (p < end && *p == '0')
+      ++p;
+    return p == end || *p == ' ' || *p == ';';
+  }
+  return false;
+}
+
+unsigned int accepted_encodings(h2o_req_t *req) {
+  unsigned int accepted = 0;
+  ssize_t cursor = -1;
+
+  while ((cursor = h2o_find_header(&req->headers, H2O_TOKEN_ACCEPT_ENCODING,
+                                   cursor)) != -1) {
+    const char *p = req->headers.entries[cursor].value.base;
+    const char *end = p + req->headers.entries[cursor].value.len;
+
+    while (p < end) {
+      const char *token, *token_end, *next;
+
+      while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+        ++p;
+      token = p;
+      while (p < end && *p != ',' && *p != ';' && *p != ' ')
+        ++p;
+      token_end = p;
+      if ((next = memchr(p, ',', end - p)) == NULL)
+        next = end;
+
+      if (token != token_end && !rejects(p, next)) {
+        size_t len = token_end - token;
+        if (h2o_memis(token, len, H2O_STRLIT("*")))
+          accepted |= Brotli | Zstd | Gzip;
+        for (int i = 0; i < PRECOMPRESS_ENCODINGS; ++i)
+          if (h2o_lcstris(token, len, precompress_variants[i].name,
+                          strlen(precompress_variants[i].name)))
+            accepted |= precompress_variants[i].encoding;
+      }
+      p = next;
+    }
+  }
+
+  return accepted;
+}
+
+static int on_req(h2o_handler_t *_self, h2o_req_t *req) {
+  static h2o_generator_t generator = {NULL, NULL};
+  precompressHandler *self = (precompressHandler *)_self;
+  indexEntry *entry;
+  int chosen = IDENTITY;
+
+  if (!h2o_memis(req->method.base, req->method.len, H2O_STRLIT("GET")) &&
+      !h2o_memis(req->method.base, req->method.len, H2O_STRLIT("HEAD")))
+    return -1;
+
+  // ranges are only ever served from the identity file
+  if (h2o_find_header(&req->headers, H2O_TOKEN_RANGE, -1) != -1)
+    return -1;
+
+  entry = find_entry(self->index, req->path_normalized.base,
+                     req->path_normalized.len);
+  if (!entry)
+    return -1;
+
+  unsigned int usable = accepted_encodings(req) & entry->variants;
+  for (int i = 0; i < PRECOMPRESS_ENCODINGS; ++i) {
+    if (usable & precompress_variants[i].encoding) {
+      chosen = i;
+      break;
+    }
+  }
+
+  /* edited since startup: the etags and the variants are stale, the handlers
+   * after us hash and send the file as it is now */
+  if (!unchanged(entry->files[IDENTITY], &entry->stamps[IDENTITY]) ||
+      (chosen != IDENTITY &&
+       !unchanged(entry->files[chosen], &entry->stamps[chosen])))
+    return -1;
+
+  const char *etag = entry->etags[chosen];
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_VARY, NULL,
+                 H2O_STRLIT("Accept-Encoding"));
+  if (entry->cache_control.len != 0)
+    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CACHE_CONTROL,
+                   NULL, entry->cache_control.base, entry->cache_control.len);
+
+  if (header_contains(req, H2O_TOKEN_IF_NONE_MATCH, etag)) {
+    req->res.status = 304;
+    req->res.reason = "Not Modified";
+    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_ETAG, NULL, etag,
+                   strlen(etag));
+    h2o_start_response(req, &generator);
+    h2o_send(req, NULL, 0, H2O_SEND_STATE_FINAL);
+    return 0;
+  }
+
+  if (chosen != IDENTITY)
+    h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_ENCODING,
+                   NULL, precompress_variants[chosen].name,
+                   strlen(precompress_variants[chosen].name));
+
+  if (!self->index->content_etags) {
+    h2o_file_send(req, 200, "OK", entry->files[chosen], entry->mime, 0);
+    return 0;
+  }
+
+  h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_ETAG, NULL, etag,
+                 strlen(etag));
+  h2o_file_send(req, 200, "OK", entry->files[chosen], entry->mime,
+                H2O_FILE_FLAG_NO_ETAG);
+  return 0;
+}
+
+static void on_dispose(h2o_handler_t *_self) {
+  precompressHandler *self = (precompressHandler *)_self;
+  precompressIndex *index = self->index;
+
+  for (size_t i = 0; i < index->size; ++i) {
+    indexEntry *entry = &index->entries[i];
+    // index.html entries share their files with the directory entry
+    bool is_dir = entry->path.base[entry->path.len - 1] == '/';
+
+    free(entry->path.base);
+    if (is_dir)
+      continue;
+    for (int j = 0; j <= IDENTITY; ++j)
+      free(entry->files[j]);
+  }
+
+  free(index->entries);
+  free(index);
+}
+
+void register_precompressed(h2o_pathconf_t *pathconf, const char *site_root,
+                            const Config *config, siteHashes *hashes) {
+  precompressHandler *self;
+  precompressIndex *index = calloc(1, sizeof(*index));
+
+  index->config = config;
+  index->hashes = hashes;
+  index->content_etags = hashes != NULL;
+
+  if (walk_dir(site_root, "", index_file, index) != 0)
+    fprintf(stderr, "precompress: failed to index %s\n", site_root);
+
+  qsort(index->entries, index->size, sizeof(indexEntry), compare_entries);
+  index->hashes = NULL;
+
+  self = (precompressHandler *)h2o_create_handler(pathconf, sizeof(*self));
+  self->super.on_req = on_req;
+  self->super.dispose = on_dispose;
+  self->index = index;
+}
@@ -0,0 +1,264 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <h2o.h>
+
+#include <file.h>
+#include <sitewatch.h>
+
+#define WATCH_EVENTS                                                           \
+  (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE |            \
+   IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct siteWatcher siteWatcher;
+
+struct siteWatch {
+  siteWatch *next;
+  siteWatcher *watcher;
+  siteChangeCb cb;
+  void *data;
+};
+
+// one per loop and site_root, lives as long as someone's subscribed
+struct siteWatcher {
+  siteWatcher *next;
+  uv_loop_t *loop;
+  char *site_root; // without a trailing slash
+  int inotify_fd;
+  uv_poll_t poll;
+  char **watches; // indexed by watch descriptor, relative dir path
+  size_t watch_count;
+  bool root_gone; // site_root was moved or deleted, watch it again once back
+  siteWatch *subscribers;
+};
+
+// the first generation's contexts are set up on the main thread
+static pthread_mutex_t watchers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static siteWatcher *watchers = NULL;
+
+static void notify(siteWatcher *watcher, const char *path, size_t len,
+                   uint32_t mask) {
+  for (siteWatch *watch = watcher->subscribers; watch; watch = watch->next)
+    watch->cb(path, len, mask, watch->data);
+}
+
+static int add_watch(siteWatcher *watcher, const char *path, const char *rel) {
+  int wd = inotify_add_watch(watcher->inotify_fd, path, WATCH_EVENTS);
+
+  if (wd < 0) {
+    fprintf(stderr, "sitewatch: can't watch %s, changes there go unseen: %s\n",
+            path, strerror(errno));
+    return 0;
+  }
+
+  if ((size_t)wd >= watcher->watch_count) {
+    size_t count = wd + 64;
+    char **watches = realloc(watcher->watches, count * sizeof(*watches));
+    if (!watches)
+      return -1;
+    memset(watches + watcher->watch_count, 0,
+           (count - watcher->watch_count) * sizeof(*watches));
+    watcher->watches = watches;
+    watcher->watch_count = count;
+  }
+
+  free(watcher->watches[wd]);
+  watcher->watches[wd] = strdup(rel);
+  return 0;
+}
+
+static int watch_dir(const char *path, const char *rel_path, struct stat *st,
+                     void *data) {
+  return S_ISDIR(st->st_mode) ? add_watch(data, path, rel_path) : 0;
+}
+
+static void watch_tree(siteWatcher *watcher, const char *rel) {
+  char path[1024];
+
+  snprintf(path, 1024, "%s%s", watcher->site_root, rel);
+  add_watch(watcher, path, rel);
+  walk_dir(path, rel, watch_dir, watcher);
+}
+
+static void lose_root(siteWatcher *watcher, uint32_t mask) {
+  fprintf(stderr, "sitewatch: %s was moved or deleted\n", watcher->site_root);
+  for (size_t wd = 0; wd < watcher->watch_count; ++wd) {
+    if (!watcher->watches[wd])
+      continue;
+    inotify_rm_watch(watcher->inotify_fd, wd);
+    free(watcher->watches[wd]);
+    watcher->watches[wd] = NULL;
+  }
+  watcher->root_gone = true;
+  notify(watcher, NULL, 0, mask);
+}
+
+static void on_inotify(uv_poll_t *poll, int status, int events) {
+  siteWatcher *watcher = poll->data;
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+
+  while ((len = read(watcher->inotify_fd, buf, sizeof(buf))) > 0) {
+    for (char *p = buf; p < buf + len;) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      char rel[1024];
+      int rel_len;
+
+      p += sizeof(*event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        notify(watcher, NULL, 0, event->mask);
+        continue;
+      }
+
+      if (event->wd < 0 || (size_t)event->wd >= watcher->watch_count ||
+          watcher->watches[event->wd] == NULL)
+        continue;
+
+      if ((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) &&
+          watcher->watches[event->wd][0] == '\0') {
+        lose_root(watcher, event->mask);
+        continue;
+      }
+
+      if (event->mask & (IN_DELETE_SELF | IN_IGNORED)) {
+        free(watcher->watches[event->wd]);
+        watcher->watches[event->wd] = NULL;
+        continue;
+      }
+
+      if (event->len == 0)
+        continue;
+      rel_len = snprintf(rel, 1024, "%s/%s", watcher->watches[event->wd],
+                         event->name);
+      if (rel_len <= 0 || rel_len >= 1024)
+        continue;
+
+      // watched first, so nothing created inside it in the meantime is missed
+      if ((event->mask & (IN_CREATE | IN_MOVED_TO)) &&
+          (event->mask & IN_ISDIR))
+        watch_tree(watcher, rel);
+      notify(watcher, rel, rel_len, event->mask);
+    }
+  }
+}
+
+static void on_poll_close(uv_handle_t *handle) {
+  siteWatcher *watcher = handle->data;
+
+  for (size_t i = 0; i < watcher->watch_count; ++i)
+    free(watcher->watches[i]);
+  free(watcher->watches);
+  free(watcher->site_root);
+  free(watcher);
+}
+
+static siteWatcher *create_watcher(uv_loop_t *loop, const char *site_root,
+                                   size_t root_len) {
+  siteWatcher *watcher = calloc(1, sizeof(*watcher));
+
+  if (!watcher)
+    return NULL;
+
+  if ((watcher->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+    free(watcher);
+    return NULL;
+  }
+
+  watcher->site_root = h2o_strdup(NULL, site_root, root_len).base;
+  watcher->loop = loop;
+
+  watch_tree(watcher, "");
+  uv_poll_init(loop, &watcher->poll, watcher->inotify_fd);
+  watcher->poll.data = watcher;
+  uv_poll_start(&watcher->poll, UV_READABLE, on_inotify);
+  return watcher;
+}
+
+siteWatch *watch_site(uv_loop_t *loop, const char *site_root, siteChangeCb cb,
+                      void *data) {
+  siteWatch *watch = calloc(1, sizeof(*watch));
+  size_t root_len = strlen(site_root);
+  siteWatcher *watcher;
+
+  if (!watch)
+    return NULL;
+
+  // relative paths start with a slash, so keep the root without one
+  while (root_len > 1 && site_root[root_len - 1] == '/')
+    --root_len;
+
+  pthread_mutex_lock(&watchers_mutex);
+  for (watcher = watchers; watcher; watcher = watcher->next)
+    if (watcher->loop == loop &&
+        h2o_memis(watcher->site_root, strlen(watcher->site_root), site_root,
+                  root_len))
+      break;
+
+  if (!watcher) {
+    if ((watcher = create_watcher(loop, site_root, root_len)) == NULL) {
+      pthread_mutex_unlock(&watchers_mutex);
+      free(watch);
+      return NULL;
+    }
+    watcher->next = watchers;
+    watchers = watcher;
+  }
+
+  watch->watcher = watcher;
+  watch->cb = cb;
+  watch->data = data;
+  watch->next = watcher->subscribers;
+  watcher->subscribers = watch;
+  pthread_mutex_unlock(&watchers_mutex);
+
+  return watch;
+}
+
+void unwatch_site(siteWatch *watch) {
+  siteWatcher *watcher = watch->watcher;
+  siteWatch **slot = &watcher->subscribers;
+
+  pthread_mutex_lock(&watchers_mutex);
+  while (*slot != watch)
+    slot = &(*slot)->next;
+  *slot = watch->next;
+
+  if (watcher->subscribers == NULL) {
+    siteWatcher **owner = &watchers;
+
+    while (*owner != watcher)
+      owner = &(*owner)->next;
+    *owner = watcher->next;
+
+    uv_poll_stop(&watcher->poll);
+    close(watcher->inotify_fd);
+    uv_close((uv_handle_t *)&watcher->poll, on_poll_close);
+  }
+  pthread_mutex_unlock(&watchers_mutex);
+
+  free(watch);
+}
+
+bool is_site_watched(siteWatch *watch) {
+  siteWatcher *watcher = watch->watcher;
+  struct stat st;
+
+  if (!watcher->root_gone)
+    return true;
+  if (stat(watcher->site_root, &st) != 0 || !S_ISDIR(st.st_mode))
+    return false;
+
+  watcher->root_gone = false;
+  watch_tree(watcher, "");
+  notify(watcher, NULL, 0, 0);
+  return true;
+}
@@ -0,0 +1,78 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <h2o.h>
+
+#include <config.h>
+#include <snapshot.h>
+
+static pthread_mutex_t current_mutex = PTHREAD_MUTEX_INITIALIZER;
+static configSnapshot *current = NULL;
+static unsigned int generations = 0;
+
+configSnapshot *create_snapshot(Config *config, snapshot_setup_cb setup) {
+  configSnapshot *snapshot = calloc(1, sizeof(*snapshot));
+
+  if (!snapshot) {
+    free_config(config);
+    return NULL;
+  }
+
+  atomic_init(&snapshot->refcnt, 1);
+  snapshot->generation = ++generations;
+  snapshot->config = *config;
+
+  h2o_config_init(&snapshot->globalconf);
+  snapshot->globalconf.server_name = h2o_iovec_init(H2O_STRLIT("toast"));
+
+  if (setup(snapshot) != 0) {
+    release_snapshot(snapshot);
+    return NULL;
+  }
+
+  return snapshot;
+}
+
+void publish_snapshot(configSnapshot *snapshot) {
+  configSnapshot *old;
+
+  pthread_mutex_lock(&current_mutex);
+  old = current;
+  current = snapshot;
+  pthread_mutex_unlock(&current_mutex);
+
+  if (old)
+    release_snapshot(old);
+}
+
+configSnapshot *acquire_snapshot(void) {
+  configSnapshot *snapshot;
+
+  pthread_mutex_lock(&current_mutex);
+  snapshot = current;
+  if (snapshot)
+    atomic_fetch_add_explicit(&snapshot->refcnt, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&current_mutex);
+
+  return snapshot;
+}
+
+void release_snapshot(configSnapshot *snapshot) {
+  if (atomic_fetch_sub_explicit(&snapshot->refcnt, 1, memory_order_acq_rel) !=
+      1)
+    return;
+
+  h2o_config_dispose(&snapshot->globalconf);
+  if (snapshot->ssl_ctx)
+    SSL_CTX_free(snapshot->ssl_ctx);
+  if (snapshot->pages)
+    free_pages(snapshot->pages);
+  free_config(&snapshot->config);
+  free(snapshot);
+}
+
+configSnapshot *get_snapshot(h2o_req_t *req) {
+  return H2O_STRUCT_FROM_MEMBER(configSnapshot, globalconf,
+                                req->conn->ctx->globalconf);
+}
@@ -0,0 +1,281 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <h2o.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+
+#include <clock.h>
+#include <tickets.h>
+
+#define TICKET_KEYS 3 // the newest encrypts, the rest only decrypt
+#define ROTATION_SECONDS 3600
+#define KEY_NAME_LEN 16
+#define KEY_SECRET_LEN 32
+
+typedef struct {
+  unsigned char name[KEY_NAME_LEN];
+  unsigned char cipher_key[KEY_SECRET_LEN];
+  unsigned char hmac_key[KEY_SECRET_LEN];
+  time_t created;
+} ticketKey;
+
+// only the main loop writes keys, workers take the read lock
+static pthread_rwlock_t keys_lock = PTHREAD_RWLOCK_INITIALIZER;
+static ticketKey keys[TICKET_KEYS];
+static size_t key_count = 0;
+
+static char *keyfile_path = NULL;
+static uv_timer_t rotation_timer;
+
+static atomic_size_t full_handshakes = 0;
+static atomic_size_t resumed_handshakes = 0;
+static atomic_size_t rotations = 0;
+static int counted_index = -1;
+
+static int write_keyfile(void) {
+  static const char hex[] = "0123456789abcdef";
+  char tmp_path[1024];
+  FILE *file;
+  int fd;
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", keyfile_path);
+  if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1 ||
+      (file = fdopen(fd, "w")) == NULL) {
+    if (fd != -1)
+      close(fd);
+    fprintf(stderr, "failed to write session ticket keys to %s\n", tmp_path);
+    return -1;
+  }
+
+  // one key per line, newest first: creation time, then name and secrets
+  for (size_t i = 0; i < key_count; ++i) {
+    const unsigned char *raw = keys[i].name;
+
+    fprintf(file, "%lld ", (long long)keys[i].created);
+    for (size_t j = 0; j < KEY_NAME_LEN + 2 * KEY_SECRET_LEN; ++j)
+      fprintf(file, "%c%c", hex[raw[j] >> 4], hex[raw[j] & 0xf]);
+    fputc('\n', file);
+  }
+
+  if (fclose(file) != 0 || rename(tmp_path, keyfile_path) != 0) {
+    fprintf(stderr, "failed to write session ticket keys to %s\n",
+            keyfile_path);
+    unlink(tmp_path);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int parse_hex(unsigned char *out, const char *hex, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    unsigned int byte;
+    if (sscanf(hex + i * 2, "%2x", &byte) != 1)
+      return -1;
+    out[i] = byte;
+  }
+  return 0;
+}
+
+// keys too old to decrypt anything are left out
+static void read_keyfile(time_t now) {
+  char hex[2 * (KEY_NAME_LEN + 2 * KEY_SECRET_LEN) + 1];
+  FILE *file = fopen(keyfile_path, "r");
+  long long created;
+
+  if (!file)
+    return;
+
+  while (key_count < TICKET_KEYS &&
+         fscanf(file, "%lld %160s", &created, hex) == 2) {
+    ticketKey *key = &keys[key_count];
+
+    if (strlen(hex) != sizeof(hex) - 1 ||
+        parse_hex(key->name, hex, sizeof(hex) / 2) != 0) {
+      fprintf(stderr, "ignoring malformed session ticket key in %s\n",
+              keyfile_path);
+      continue;
+    }
+
+    if (created + TICKET_KEYS * ROTATION_SECONDS <= now)
+      continue;
+
+    key->created = created;
+    ++key_count;
+  }
+
+  fclose(file);
+}
+
+static int rotate_keys(time_t now) {
+  ticketKey key = {.created = now};
+
+  if (RAND_bytes(key.name, KEY_NAME_LEN) != 1 ||
+      RAND_bytes(key.cipher_key, KEY_SECRET_LEN) != 1 ||
+      RAND_bytes(key.hmac_key, KEY_SECRET_LEN) != 1) {
+    fprintf(stderr, "failed to generate a session ticket key\n");
+    return -1;
+  }
+
+  pthread_rwlock_wrlock(&keys_lock);
+  if (key_count == TICKET_KEYS)
+    OPENSSL_cleanse(&keys[TICKET_KEYS - 1], sizeof(ticketKey));
+  else
+    ++key_count;
+  memmove(&keys[1], &keys[0], (key_count - 1) * sizeof(ticketKey));
+  keys[0] = key;
+  pthread_rwlock_unlock(&keys_lock);
+
+  OPENSSL_cleanse(&key, sizeof(key));
+  atomic_fetch_add_explicit(&rotations, 1, memory_order_relaxed);
+
+  if (keyfile_path)
+    write_keyfile();
+
+  return 0;
+}
+
+static void on_rotation(uv_timer_t *timer) {
+  rotate_keys(clock_now()->wall);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX ticketMacCtx;
+
+static int init_mac(ticketMacCtx *mac_ctx, const unsigned char *key) {
+  OSSL_PARAM params[] = {
+      OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0),
+      OSSL_PARAM_construct_end(),
+  };
+  return EVP_MAC_init(mac_ctx, key, KEY_SECRET_LEN, params);
+}
+#else
+typedef HMAC_CTX ticketMacCtx;
+
+static int init_mac(ticketMacCtx *mac_ctx, const unsigned char *key) {
+  return HMAC_Init_ex(mac_ctx, key, KEY_SECRET_LEN, EVP_sha256(), NULL);
+}
+#endif
+
+/* returns 1 to use the ticket, 2 to use it and issue a fresh one under the
+ * current key, 0 to fall back to a full handshake and -1 on errors */
+static int on_ticket_key(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                         EVP_CIPHER_CTX *cipher_ctx, ticketMacCtx *mac_ctx,
+                         int enc) {
+  ticketKey key;
+  size_t index = 0;
+
+  pthread_rwlock_rdlock(&keys_lock);
+  if (enc) {
+    key = keys[0];
+  } else {
+    while (index < key_count &&
+           memcmp(keys[index].name, key_name, KEY_NAME_LEN) != 0)
+      ++index;
+    if (index < key_count)
+      key = keys[index];
+  }
+  pthread_rwlock_unlock(&keys_lock);
+
+  if (!enc && index == key_count)
+    return 0;
+
+  if (enc) {
+    if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1 ||
+        EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL,
+                           key.cipher_key, iv) != 1) {
+      OPENSSL_cleanse(&key, sizeof(key));
+      return -1;
+    }
+    memcpy(key_name, key.name, KEY_NAME_LEN);
+  } else if (EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL,
+                                key.cipher_key, iv) != 1) {
+    OPENSSL_cleanse(&key, sizeof(key));
+    return -1;
+  }
+
+  if (init_mac(mac_ctx, key.hmac_key) != 1) {
+    OPENSSL_cleanse(&key, sizeof(key));
+    return -1;
+  }
+
+  OPENSSL_cleanse(&key, sizeof(key));
+  return enc || index == 0 ? 1 : 2;
+}
+
+static void on_ssl_info(const SSL *ssl, int where, int ret) {
+  if (!(where & SSL_CB_HANDSHAKE_DONE))
+    return;
+
+  // TLS 1.3 can report done again after post-handshake messages
+  if (SSL_get_ex_data(ssl, counted_index) != NULL)
+    return;
+  SSL_set_ex_data((SSL *)ssl, counted_index, &counted_index);
+
+  if (SSL_session_reused((SSL *)ssl))
+    atomic_fetch_add_explicit(&resumed_handshakes, 1, memory_order_relaxed);
+  else
+    atomic_fetch_add_explicit(&full_handshakes, 1, memory_order_relaxed);
+}
+
+int start_session_tickets(uv_loop_t *loop, const char *keyfile) {
+  time_t now = time(NULL);
+  uint64_t next_rotation;
+
+  if (keyfile && keyfile[0] != '\0') {
+    keyfile_path = strdup(keyfile);
+    read_keyfile(now);
+  }
+
+  if ((key_count == 0 || keys[0].created + ROTATION_SECONDS <= now) &&
+      rotate_keys(now) != 0)
+    return -1;
+
+  next_rotation = (keys[0].created + ROTATION_SECONDS - now) * 1000;
+  uv_timer_init(loop, &rotation_timer);
+  uv_timer_start(&rotation_timer, on_rotation, next_rotation,
+                 ROTATION_SECONDS * 1000);
+  uv_unref((uv_handle_t *)&rotation_timer);
+
+  return 0;
+}
+
+void setup_session_tickets(SSL_CTX *ssl_ctx) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  SSL_CTX_set_tlsext_ticket_key_evp_cb(ssl_ctx, on_ticket_key);
+#else
+  SSL_CTX_set_tlsext_ticket_key_cb(ssl_ctx, on_ticket_key);
+#endif
+  // the lifetime hint matches how long a ticket's key stays around
+  SSL_CTX_set_timeout(ssl_ctx, (TICKET_KEYS - 1) * ROTATION_SECONDS);
+}
+
+void count_handshakes(SSL_CTX *ssl_ctx) {
+  if (counted_index == -1)
+    counted_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+
+  SSL_CTX_set_info_callback(ssl_ctx, on_ssl_info);
+}
+
+void session_ticket_stats(ticketStats *stats) {
+  stats->full = atomic_load_explicit(&full_handshakes, memory_order_relaxed);
+  stats->resumed =
+      atomic_load_explicit(&resumed_handshakes, memory_order_relaxed);
+  stats->rotations = atomic_load_explicit(&rotations, memory_order_relaxed);
+}
@@ -0,0 +1,314 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <h2o.h>
+
+#include <accesslog.h>
+#include <config.h>
+#include <upgrade.h>
+#include <worker.h>
+
+#define LISTEN_FDS_ENV "TOAST_LISTEN_FDS"
+#define READY_FD_ENV "TOAST_UPGRADE_FD"
+#define DRAIN_CHECK_MS 100
+
+extern char **environ;
+
+typedef struct {
+  uv_poll_t ready;
+  uv_timer_t drain;
+  int ready_fd;
+  pid_t child;
+  unsigned int drain_timeout; // seconds
+  uint64_t deadline;
+} upgradeState;
+
+static upgradeState *upgrade = NULL;
+
+static int *inherited_fds = NULL;
+static size_t inherited_count = 0;
+
+static void on_drain_check(uv_timer_t *timer) {
+  size_t open = open_connections();
+
+  if (open != 0 && uv_now(timer->loop) < upgrade->deadline)
+    return;
+
+  if (open != 0)
+    fprintf(stderr, "toast: drain timed out with %zu connections open\n",
+            open);
+  printf("toast: handed over to %d, exiting\n", (int)upgrade->child);
+  fflush(stdout);
+  stop_access_log();
+  exit(0);
+}
+
+static void on_ready_close(uv_handle_t *handle) {
+  close(upgrade->ready_fd);
+  free(upgrade);
+  upgrade = NULL;
+}
+
+// a byte means the new process is accepting, EOF that it died before
+static void on_ready(uv_poll_t *poll, int status, int events) {
+  char byte;
+  ssize_t r;
+
+  while ((r = read(upgrade->ready_fd, &byte, 1)) == -1 && errno == EINTR)
+    ;
+  if (r == -1 && errno == EAGAIN)
+    return;
+
+  uv_poll_stop(poll);
+
+  if (r != 1) {
+    fprintf(stderr, "toast: new process %d exited before accepting, "
+                    "still serving\n",
+            (int)upgrade->child);
+    waitpid(upgrade->child, NULL, WNOHANG);
+    uv_close((uv_handle_t *)poll, on_ready_close);
+    return;
+  }
+
+  printf("toast: new process %d is accepting, draining connections\n",
+         (int)upgrade->child);
+  stop_accepting();
+  uv_timer_init(poll->loop, &upgrade->drain);
+  upgrade->deadline = uv_now(poll->loop) + upgrade->drain_timeout * 1000ull;
+  uv_timer_start(&upgrade->drain, on_drain_check, 0, DRAIN_CHECK_MS);
+}
+
+static char *listen_fds_env(const int *fds, size_t count) {
+  size_t len = sizeof(LISTEN_FDS_ENV "=") + count * 12;
+  char *env = malloc(len);
+  size_t used;
+
+  if (!env)
+    return NULL;
+
+  used = snprintf(env, len, LISTEN_FDS_ENV "=");
+  for (size_t i = 0; i < count; ++i)
+    used += snprintf(env + used, len - used, i ? ",%d" : "%d", fds[i]);
+  return env;
+}
+
+/* the child of a threaded process may only make async-signal-safe calls,
+ * so the environment is built up front */
+static char **upgrade_environ(char *listen_env, char *ready_env) {
+  size_t count = 0, used = 0;
+  char **envp;
+
+  while (environ[count])
+    ++count;
+  if ((envp = malloc((count + 3) * sizeof(*envp))) == NULL)
+    return NULL;
+
+  // left over from our own upgrade, if this process came from one
+  for (size_t i = 0; i < count; ++i)
+    if (strncmp(environ[i], LISTEN_FDS_ENV "=", sizeof(LISTEN_FDS_ENV)) != 0 &&
+        strncmp(environ[i], READY_FD_ENV "=", sizeof(READY_FD_ENV)) != 0)
+      envp[used++] = environ[i];
+  envp[used++] = listen_env;
+  envp[used++] = ready_env;
+  envp[used] = NULL;
+  return envp;
+}
+
+int start_upgrade(uv_loop_t *loop, char **argv, unsigned int drain_timeout) {
+  unsigned int worker_count;
+  workerCtx *workers = get_workers(&worker_count);
+  size_t max = worker_count * workers[0].listener_count + 1, count;
+  int *fds = malloc(max * sizeof(*fds));
+  int ready[2] = {-1, -1};
+  char ready_env[sizeof(READY_FD_ENV "=") + 12];
+  char *listen_env = NULL;
+  char **envp = NULL;
+  pid_t pid;
+
+  if (upgrade) {
+    fprintf(stderr, "toast: an upgrade is already in progress\n");
+    free(fds);
+    return -1;
+  }
+
+  if (!fds || (upgrade = calloc(1, sizeof(*upgrade))) == NULL)
+    goto Error;
+
+  count = listener_fds(fds, max);
+
+  if (pipe(ready) != 0 || fcntl(ready[0], F_SETFD, FD_CLOEXEC) != 0 ||
+      fcntl(ready[1], F_SETFD, FD_CLOEXEC) != 0 ||
+      snprintf(ready_env, sizeof(ready_env), READY_FD_ENV "=%d", ready[1]) <
+          0 ||
+      (listen_env = listen_fds_env(fds, count)) == NULL ||
+      (envp = upgrade_environ(listen_env, ready_env)) == NULL) {
+    fprintf(stderr, "toast: upgrade failed: %s\n", strerror(errno));
+    goto Error;
+  }
+
+  if ((pid = fork()) == -1) {
+    fprintf(stderr, "toast: upgrade failed, fork: %s\n", strerror(errno));
+    goto Error;
+  }
+
+  if (pid == 0) {
+    for (size_t i = 0; i < count; ++i)
+      fcntl(fds[i], F_SETFD, 0);
+    fcntl(ready[1], F_SETFD, 0);
+    environ = envp;
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+
+  close(ready[1]);
+  free(envp);
+  free(listen_env);
+  free(fds);
+
+  upgrade->child = pid;
+  upgrade->ready_fd = ready[0];
+  upgrade->drain_timeout = drain_timeout;
+  fcntl(ready[0], F_SETFL, O_NONBLOCK);
+  uv_poll_init(loop, &upgrade->ready, ready[0]);
+  uv_poll_start(&upgrade->ready, UV_READABLE, on_ready);
+
+  printf("toast: started %s as %d, handing over %zu sockets\n", argv[0],
+         (int)pid, count);
+  return 0;
+
+Error:
+  if (ready[0] != -1) {
+    close(ready[0]);
+    close(ready[1]);
+  }
+  free(envp);
+  free(listen_env);
+  free(fds);
+  free(upgrade);
+  upgrade = NULL;
+  return -1;
+}
+
+void read_inherited_fds(void) {
+  const char *env = getenv(LISTEN_FDS_ENV);
+  size_t capacity = 0;
+
+  if (!env)
+    return;
+
+  for (const char *p = env; *p;) {
+    char *end;
+    long fd = strtol(p, &end, 10);
+
+    if (end == p || fd < 0)
+      break;
+
+    if (inherited_count == capacity) {
+      size_t count = capacity ? capacity * 2 : 16;
+      int *fds = realloc(inherited_fds, count * sizeof(*fds));
+      if (!fds)
+        break;
+      inherited_fds = fds;
+      capacity = count;
+    }
+
+    // ours again, so a later upgrade or exec doesn't leak it
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    inherited_fds[inherited_count++] = fd;
+    p = *end == ',' ? end + 1 : end;
+  }
+
+  unsetenv(LISTEN_FDS_ENV);
+}
+
+static bool same_address(const struct sockaddr_storage *a,
+                         const struct sockaddr_storage *b) {
+  if (a->ss_family != b->ss_family)
+    return false;
+
+  switch (a->ss_family) {
+  case AF_INET: {
+    const struct sockaddr_in *x = (const void *)a, *y = (const void *)b;
+    return x->sin_port == y->sin_port &&
+           x->sin_addr.s_addr == y->sin_addr.s_addr;
+  }
+  case AF_INET6: {
+    const struct sockaddr_in6 *x = (const void *)a, *y = (const void *)b;
+    return x->sin6_port == y->sin6_port &&
+           memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0;
+  }
+  case AF_UNIX:
+    return strcmp(((const struct sockaddr_un *)a)->sun_path,
+                  ((const struct sockaddr_un *)b)->sun_path) == 0;
+  default:
+    return false;
+  }
+}
+
+int take_inherited_fd(const listenerConfig *listener, int type) {
+  struct sockaddr_storage want = {0};
+
+  if (inherited_count == 0)
+    return -1;
+
+  if (listener->path) {
+    struct sockaddr_un *addr = (struct sockaddr_un *)&want;
+    addr->sun_family = AF_UNIX;
+    strlcpy(addr->sun_path, listener->path, sizeof(addr->sun_path));
+  } else if (listener_sockaddr(listener, &want) != 0) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < inherited_count; ++i) {
+    struct sockaddr_storage have = {0};
+    socklen_t len = sizeof(have);
+    int fd = inherited_fds[i], have_type;
+    socklen_t type_len = sizeof(have_type);
+
+    if (fd == -1 || getsockname(fd, (struct sockaddr *)&have, &len) != 0 ||
+        getsockopt(fd, SOL_SOCKET, SO_TYPE, &have_type, &type_len) != 0 ||
+        have_type != type || !same_address(&want, &have))
+      continue;
+
+    inherited_fds[i] = -1;
+    return fd;
+  }
+
+  return -1;
+}
+
+void finish_upgrade(void) {
+  const char *env = getenv(READY_FD_ENV);
+  int fd;
+
+  /* with fewer workers or listeners than before, connections already
+   * queued on the leftovers are reset */
+  for (size_t i = 0; i < inherited_count; ++i) {
+    if (inherited_fds[i] != -1) {
+      fprintf(stderr, "toast: closing inherited socket %d, nothing uses it\n",
+              inherited_fds[i]);
+      close(inherited_fds[i]);
+    }
+  }
+  free(inherited_fds);
+  inherited_fds = NULL;
+  inherited_count = 0;
+
+  if (!env)
+    return;
+
+  fd = atoi(env);
+  if (write(fd, "", 1) != 1)
+    fprintf(stderr, "toast: failed to tell the old process we're ready: %s\n",
+            strerror(errno));
+  close(fd);
+  unsetenv(READY_FD_ENV);
+}
@@ -0,0 +1,634 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <grp.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <h2o.h>
+#include <h2o/memcached.h>
+
+#include <clock.h>
+#include <config.h>
+#include <fileio.h>
+#include <lag.h>
+#include <snapshot.h>
+#include <upgrade.h>
+#include <worker.h>
+
+static workerCtx *workers = NULL;
+static unsigned int worker_count = 0;
+static _Thread_local workerCtx *this_worker = NULL;
+
+unsigned int default_worker_count(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? (unsigned int)cpus : 1;
+}
+
+workerCtx *get_workers(unsigned int *count) {
+  *count = worker_count;
+  return workers;
+}
+
+workerCtx *current_worker(void) { return this_worker; }
+
+typedef struct workerConn {
+  union {
+    uv_handle_t handle;
+    uv_stream_t stream;
+    uv_tcp_t tcp;
+    uv_pipe_t pipe;
+  };
+  union {
+    workerGeneration *generation;
+    struct workerConn *next; // while on the free list
+  };
+} workerConn;
+
+static void on_reaper_close(uv_handle_t *handle) {
+  workerGeneration *generation = handle->data;
+  workerGeneration **slot = &generation->worker->generations;
+
+  while (*slot != generation)
+    slot = &(*slot)->next;
+  *slot = generation->next;
+
+  release_snapshot(generation->snapshot);
+  free(generation);
+}
+
+static void reap_generation(uv_timer_t *timer) {
+  workerGeneration *generation = timer->data;
+
+  if (generation->accept_ctx.libmemcached_receiver)
+    h2o_multithread_unregister_receiver(generation->ctx.queue,
+                                        &generation->libmemcached_receiver);
+  h2o_context_dispose(&generation->ctx);
+  uv_close((uv_handle_t *)timer, on_reaper_close);
+}
+
+static workerGeneration *create_generation(workerCtx *worker,
+                                           configSnapshot *snapshot) {
+  workerGeneration *generation = calloc(1, sizeof(*generation));
+
+  if (!generation)
+    return NULL;
+
+  generation->worker = worker;
+  generation->snapshot = snapshot;
+  h2o_context_init(&generation->ctx, &worker->loop, &snapshot->globalconf);
+
+  if (snapshot->config.ssl.mem_cached == true) {
+    h2o_multithread_register_receiver(generation->ctx.queue,
+                                      &generation->libmemcached_receiver,
+                                      h2o_memcached_receiver);
+    generation->accept_ctx.libmemcached_receiver =
+        &generation->libmemcached_receiver;
+  }
+
+  generation->accept_ctx.ctx = &generation->ctx;
+  generation->accept_ctx.hosts = snapshot->globalconf.hosts;
+  generation->accept_ctx.ssl_ctx = snapshot->ssl_ctx;
+  generation->proxy_accept_ctx = generation->accept_ctx;
+  generation->proxy_accept_ctx.expect_proxy_line = 1;
+
+  uv_timer_init(&worker->loop, &generation->reaper);
+  generation->reaper.data = generation;
+  generation->next = worker->generations;
+  worker->generations = generation;
+  return generation;
+}
+
+// the context can only go once its last connection has closed
+static void retire_generation(workerGeneration *generation) {
+  generation->retired = true;
+  if (generation->connections == 0)
+    uv_timer_start(&generation->reaper, reap_generation, 0, 0);
+  else
+    h2o_context_request_shutdown(&generation->ctx);
+}
+
+void hold_generation(workerGeneration *generation) {
+  ++generation->connections;
+}
+
+void drop_generation(workerGeneration *generation) {
+  // deferred, h2o is still unwinding the connection that just closed
+  if (--generation->connections == 0 && generation->retired)
+    uv_timer_start(&generation->reaper, reap_generation, 0, 0);
+}
+
+static workerConn *alloc_conn(workerCtx *worker) {
+  workerConn *conn = worker->free_conns;
+  size_t live;
+
+  if (conn) {
+    worker->free_conns = conn->next;
+    atomic_fetch_sub_explicit(&worker->free_conn_count, 1,
+                              memory_order_relaxed);
+  } else {
+    conn = h2o_mem_alloc(sizeof(*conn));
+  }
+
+  live = atomic_fetch_add_explicit(&worker->live_conns, 1,
+                                   memory_order_relaxed) +
+         1;
+  if (live > atomic_load_explicit(&worker->peak_conns, memory_order_relaxed))
+    atomic_store_explicit(&worker->peak_conns, live, memory_order_relaxed);
+
+  return conn;
+}
+
+static bool at_capacity(workerCtx *worker) {
+  unsigned int max_connections =
+      worker->generation->snapshot->config.network.max_connections;
+
+  return max_connections != 0 &&
+         atomic_load_explicit(&worker->live_conns, memory_order_relaxed) >=
+             max_connections;
+}
+
+static void accept_conn(workerListener *listener);
+
+static void release_conn(uv_handle_t *handle) {
+  workerCtx *worker = handle->loop->data;
+  workerConn *conn = (workerConn *)handle;
+
+  conn->next = worker->free_conns;
+  worker->free_conns = conn;
+  atomic_fetch_add_explicit(&worker->free_conn_count, 1, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&worker->live_conns, 1, memory_order_relaxed);
+
+  for (size_t i = 0; i < worker->listener_count && worker->paused_listeners &&
+                     !at_capacity(worker);
+       ++i) {
+    if (worker->listeners[i].paused) {
+      worker->listeners[i].paused = false;
+      --worker->paused_listeners;
+      accept_conn(&worker->listeners[i]);
+    }
+  }
+}
+
+static void on_conn_close(uv_handle_t *handle) {
+  workerGeneration *generation = ((workerConn *)handle)->generation;
+
+  release_conn(handle);
+  drop_generation(generation);
+}
+
+static void on_reload(uv_async_t *handle) {
+  workerCtx *worker = handle->data;
+  workerGeneration *generation;
+  configSnapshot *snapshot = acquire_snapshot();
+
+  if (!snapshot)
+    return;
+
+  if (snapshot == worker->generation->snapshot) {
+    release_snapshot(snapshot);
+    return;
+  }
+
+  if ((generation = create_generation(worker, snapshot)) == NULL) {
+    fprintf(stderr, "worker %u: failed to switch to config generation %u\n",
+            worker->index, snapshot->generation);
+    release_snapshot(snapshot);
+    return;
+  }
+
+  retire_generation(worker->generation);
+  worker->generation = generation;
+}
+
+static void on_stop(uv_async_t *handle) {
+  workerCtx *worker = handle->data;
+
+  for (size_t i = 0; i < worker->listener_count; ++i)
+    uv_close(&worker->listeners[i].handle, NULL);
+  worker->listener_count = 0;
+  worker->paused_listeners = 0;
+
+  // keep-alive connections close after their current request, retired
+  // generations included so none of them hold the drain open
+  for (workerGeneration *generation = worker->generations; generation;
+       generation = generation->next)
+    h2o_context_request_shutdown(&generation->ctx);
+}
+
+static void accept_conn(workerListener *listener) {
+  workerCtx *worker = listener->worker;
+  workerGeneration *generation = worker->generation;
+  workerConn *conn = alloc_conn(worker);
+  h2o_socket_t *sock;
+
+  if (listener->is_unix)
+    uv_pipe_init(&worker->loop, &conn->pipe, 0);
+  else
+    uv_tcp_init(&worker->loop, &conn->tcp);
+
+  if (uv_accept(&listener->stream, &conn->stream) != 0) {
+    uv_close(&conn->handle, release_conn);
+    return;
+  }
+
+  conn->generation = generation;
+  hold_generation(generation);
+  atomic_fetch_add_explicit(&worker->accepted, 1, memory_order_relaxed);
+  sock = h2o_uv_socket_create(&conn->handle, on_conn_close);
+
+  /* h2o can only look up TCP peers. the socket path stands in until a PROXY
+   * line names the real client */
+  if (listener->is_unix)
+    h2o_socket_setpeername(sock, (struct sockaddr *)&listener->addr,
+                           listener->addr_len);
+
+  h2o_accept(listener->proxy_protocol ? &generation->proxy_accept_ctx
+                                      : &generation->accept_ctx,
+             sock);
+}
+
+static void on_accept(uv_stream_t *stream, int status) {
+  workerListener *listener = stream->data;
+  workerCtx *worker = listener->worker;
+
+  if (status != 0)
+    return;
+
+  /* libuv stops polling a listener whose pending connection wasn't taken,
+   * release_conn accepts it once a slot frees up */
+  if (at_capacity(worker)) {
+    listener->paused = true;
+    ++worker->paused_listeners;
+    atomic_fetch_add_explicit(&worker->accept_pauses, 1,
+                              memory_order_relaxed);
+    return;
+  }
+
+  accept_conn(listener);
+}
+
+int listener_sockaddr(const listenerConfig *listener,
+                      struct sockaddr_storage *addr) {
+  if (uv_ip4_addr(listener->address, listener->port,
+                  (struct sockaddr_in *)addr) == 0 ||
+      uv_ip6_addr(listener->address, listener->port,
+                  (struct sockaddr_in6 *)addr) == 0)
+    return 0;
+
+  errno = EINVAL;
+  return -1;
+}
+
+static int set_option(int fd, int level, int name, int value,
+                      const char *option) {
+  if (setsockopt(fd, level, name, &value, sizeof(value)) == 0)
+    return 0;
+
+  fprintf(stderr, "setsockopt %s:%s\n", option, strerror(errno));
+  return -1;
+}
+
+/* every worker binds its own socket, SO_REUSEPORT lets the kernel spread
+ * incoming connections across them. accepted sockets inherit the options
+ * set here */
+static int bind_reuseport(const listenerConfig *listener) {
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  int fd;
+
+  if (listener_sockaddr(listener, &addr) != 0) {
+    fprintf(stderr, "bind:invalid address %s\n", listener->address);
+    return -1;
+  }
+  addr_len = addr.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6)
+                                        : sizeof(struct sockaddr_in);
+
+  if ((fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+    fprintf(stderr, "socket:%s\n", strerror(errno));
+    return -1;
+  }
+
+  if (set_option(fd, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR") != 0 ||
+      set_option(fd, SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT") != 0 ||
+      (addr.ss_family == AF_INET6 &&
+       set_option(fd, IPPROTO_IPV6, IPV6_V6ONLY, listener->ipv6_only,
+                  "IPV6_V6ONLY") != 0) ||
+      (listener->nodelay &&
+       set_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY") != 0) ||
+      (listener->fastopen &&
+       set_option(fd, IPPROTO_TCP, TCP_FASTOPEN, listener->fastopen,
+                  "TCP_FASTOPEN") != 0) ||
+      (listener->defer_accept &&
+       set_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, listener->defer_accept,
+                  "TCP_DEFER_ACCEPT") != 0) ||
+      (listener->sndbuf &&
+       set_option(fd, SOL_SOCKET, SO_SNDBUF, listener->sndbuf, "SO_SNDBUF") !=
+           0) ||
+      (listener->notsent_lowat &&
+       set_option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, listener->notsent_lowat,
+                  "TCP_NOTSENT_LOWAT") != 0)) {
+    close(fd);
+    return -1;
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, addr_len) != 0 ||
+      listen(fd, listener->backlog) != 0) {
+    fprintf(stderr, "bind %s:%u:%s\n", listener->address, listener->port,
+            strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int lookup_owner(const char *owner, uid_t *uid, gid_t *gid) {
+  char user[256];
+  const char *group = strchr(owner, ':');
+  size_t user_len = group ? (size_t)(group - owner) : strlen(owner);
+  struct passwd *pw;
+  struct group *gr;
+
+  if (user_len >= sizeof(user)) {
+    fprintf(stderr, "unknown user %s\n", owner);
+    return -1;
+  }
+  memcpy(user, owner, user_len);
+  user[user_len] = '\0';
+
+  if ((pw = getpwnam(user)) == NULL) {
+    fprintf(stderr, "unknown user %s\n", user);
+    return -1;
+  }
+  *uid = pw->pw_uid;
+  *gid = pw->pw_gid;
+
+  if (group) {
+    if ((gr = getgrnam(group + 1)) == NULL) {
+      fprintf(stderr, "unknown group %s\n", group + 1);
+      return -1;
+    }
+    *gid = gr->gr_gid;
+  }
+
+  return 0;
+}
+
+static bool is_stale_unix(const struct sockaddr_un *addr) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  bool stale;
+
+  if (fd == -1)
+    return false;
+  stale = connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) != 0 &&
+          errno == ECONNREFUSED;
+  close(fd);
+  return stale;
+}
+
+/* a path can only be bound once, so unlike TCP the socket is made up front
+ * and every worker listens on a copy of it */
+static int bind_unix(const listenerConfig *listener) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  struct stat st;
+  uid_t uid = -1;
+  gid_t gid = -1;
+  int fd;
+
+  if (strlen(listener->path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "bind:socket path too long %s\n", listener->path);
+    return -1;
+  }
+  strlcpy(addr.sun_path, listener->path, sizeof(addr.sun_path));
+
+  if (listener->owner && lookup_owner(listener->owner, &uid, &gid) != 0)
+    return -1;
+
+  /* left behind by an earlier run, binding would fail with EADDRINUSE. only
+   * a socket nobody answers on is stale, a live server keeps its path */
+  if (lstat(listener->path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    if (!is_stale_unix(&addr)) {
+      fprintf(stderr, "bind:%s is in use by a running server\n",
+              listener->path);
+      return -1;
+    }
+    unlink(listener->path);
+  }
+
+  if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+    fprintf(stderr, "socket:%s\n", strerror(errno));
+    return -1;
+  }
+
+  if (listener->sndbuf &&
+      set_option(fd, SOL_SOCKET, SO_SNDBUF, listener->sndbuf, "SO_SNDBUF") !=
+          0) {
+    close(fd);
+    return -1;
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      chmod(listener->path, listener->mode) != 0 ||
+      (listener->owner && chown(listener->path, uid, gid) != 0) ||
+      listen(fd, listener->backlog) != 0) {
+    fprintf(stderr, "bind %s:%s\n", listener->path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// unix_fd is the shared socket of a Unix domain listener, -1 for TCP
+static int create_listener(workerCtx *worker, workerListener *listener,
+                           const listenerConfig *config, int unix_fd) {
+  int fd, r;
+
+  listener->worker = worker;
+  listener->is_unix = config->path != NULL;
+  listener->proxy_protocol = config->proxy_protocol;
+
+  if (listener->is_unix) {
+    struct sockaddr_un *addr = (struct sockaddr_un *)&listener->addr;
+
+    addr->sun_family = AF_UNIX;
+    strlcpy(addr->sun_path, config->path, sizeof(addr->sun_path));
+    listener->addr_len = sizeof(*addr);
+
+    if ((fd = dup(unix_fd)) == -1) {
+      fprintf(stderr, "dup:%s\n", strerror(errno));
+      return -1;
+    }
+    uv_pipe_init(&worker->loop, &listener->pipe, 0);
+    r = uv_pipe_open(&listener->pipe, fd);
+  } else {
+    if ((fd = take_inherited_fd(config, SOCK_STREAM)) == -1 &&
+        (fd = bind_reuseport(config)) == -1)
+      return -1;
+    uv_tcp_init(&worker->loop, &listener->tcp);
+    r = uv_tcp_open(&listener->tcp, fd);
+  }
+
+  listener->handle.data = listener;
+  if (r != 0) {
+    fprintf(stderr, "uv_open:%s\n", uv_strerror(r));
+    close(fd);
+    goto Error;
+  }
+  if ((r = uv_listen(&listener->stream, config->backlog, on_accept)) != 0) {
+    fprintf(stderr, "uv_listen:%s\n", uv_strerror(r));
+    goto Error;
+  }
+
+  return 0;
+Error:
+  uv_close(&listener->handle, NULL);
+  return r;
+}
+
+static void *run_worker(void *arg) {
+  workerCtx *worker = arg;
+
+  this_worker = worker;
+  start_clock(&worker->loop);
+  start_lag_probe(&worker->loop, worker->index);
+  start_file_io(&worker->loop);
+  uv_run(&worker->loop, UV_RUN_DEFAULT);
+  return NULL;
+}
+
+int start_workers(Config *config) {
+  unsigned int count = config->workers;
+  unsigned int i;
+  int unix_fds[config->network.listener_count];
+  int r = -1;
+
+  if (count == 0)
+    count = default_worker_count();
+
+  workers = calloc(count, sizeof(*workers));
+  if (!workers)
+    return -1;
+
+  for (size_t j = 0; j < config->network.listener_count; ++j)
+    unix_fds[j] = -1;
+
+  for (size_t j = 0; j < config->network.listener_count; ++j) {
+    // an inherited socket is still bound, unlinking it would orphan it
+    if (config->network.listeners[j].path != NULL &&
+        (unix_fds[j] = take_inherited_fd(&config->network.listeners[j],
+                                         SOCK_STREAM)) == -1 &&
+        (unix_fds[j] = bind_unix(&config->network.listeners[j])) == -1)
+      goto Done;
+  }
+
+  for (i = 0; i < count; ++i) {
+    workerCtx *worker = &workers[i];
+    configSnapshot *snapshot = acquire_snapshot();
+
+    worker->index = i;
+    uv_loop_init(&worker->loop);
+    worker->loop.data = worker;
+
+    if (!snapshot ||
+        (worker->generation = create_generation(worker, snapshot)) == NULL) {
+      if (snapshot)
+        release_snapshot(snapshot);
+      goto Done;
+    }
+
+    uv_async_init(&worker->loop, &worker->reload, on_reload);
+    worker->reload.data = worker;
+    uv_async_init(&worker->loop, &worker->stop, on_stop);
+    worker->stop.data = worker;
+
+    worker->listeners =
+        calloc(config->network.listener_count, sizeof(workerListener));
+    if (!worker->listeners)
+      goto Done;
+
+    for (size_t j = 0; j < config->network.listener_count; ++j) {
+      if (create_listener(worker, &worker->listeners[j],
+                          &config->network.listeners[j], unix_fds[j]) != 0)
+        goto Done;
+      ++worker->listener_count;
+    }
+
+    ++worker_count;
+  }
+  r = 0;
+
+Done:
+  // every worker holds its own copy, and on failure nobody needs them
+  for (size_t j = 0; j < config->network.listener_count; ++j)
+    if (unix_fds[j] != -1)
+      close(unix_fds[j]);
+  if (r != 0)
+    return -1;
+
+  for (i = 0; i < worker_count; ++i) {
+    if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) !=
+        0) {
+      fprintf(stderr, "failed to start worker %u\n", i);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+void reload_workers(void) {
+  for (unsigned int i = 0; i < worker_count; ++i)
+    uv_async_send(&workers[i].reload);
+}
+
+void stop_accepting(void) {
+  for (unsigned int i = 0; i < worker_count; ++i)
+    uv_async_send(&workers[i].stop);
+}
+
+size_t open_connections(void) {
+  size_t open = 0;
+
+  for (unsigned int i = 0; i < worker_count; ++i)
+    open += atomic_load_explicit(&workers[i].live_conns, memory_order_relaxed);
+  return open;
+}
+
+size_t listener_fds(int *fds, size_t max) {
+  size_t count = 0;
+  uv_os_fd_t fd;
+
+  for (unsigned int i = 0; i < worker_count; ++i) {
+    for (size_t j = 0; j < workers[i].listener_count && count < max; ++j)
+      if (uv_fileno(&workers[i].listeners[j].handle, &fd) == 0)
+        fds[count++] = fd;
+  }
+
+  return count;
+}
+
+void join_workers(void) {
+  for (unsigned int i = 0; i < worker_count; ++i)
+    pthread_join(workers[i].thread, NULL);
+}
+
+static void count_request(h2o_logger_t *self, h2o_req_t *req) {
+  workerCtx *worker = current_worker();
+
+  if (worker)
+    atomic_fetch_add_explicit(&worker->requests, 1, memory_order_relaxed);
+}
+
+void register_worker_counter(h2o_pathconf_t *pathconf) {
+  h2o_logger_t *logger = h2o_create_logger(pathconf, sizeof(*logger));
+  logger->log_access = count_request;
+}
@@ -0,0 +1,184 @@
+/* writes include/mimetable.h, run through `just mime_table` after changing
+ * the list below. the seeds make mime_hash send every extension to its own
+ * slot, so a lookup at runtime is two hashes and one compare */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <mime.h>
+
+#define MAX_SEED 65536
+
+static const char *types[][2] = {
+    {"3gp", "video/3gpp"},
+    {"7z", "application/x-7z-compressed"},
+    {"aac", "audio/aac"},
+    {"apng", "image/apng"},
+    {"atom", "application/atom+xml"},
+    {"avi", "video/x-msvideo"},
+    {"avif", "image/avif"},
+    {"bin", "application/octet-stream"},
+    {"bmp", "image/bmp"},
+    {"bz2", "application/x-bzip2"},
+    {"css", "text/css"},
+    {"csv", "text/csv"},
+    {"doc", "application/msword"},
+    {"docx", "application/"
+             "vnd.openxmlformats-officedocument.wordprocessingml.document"},
+    {"eot", "application/vnd.ms-fontobject"},
+    {"epub", "application/epub+zip"},
+    {"flac", "audio/flac"},
+    {"gif", "image/gif"},
+    {"gz", "application/gzip"},
+    {"heic", "image/heic"},
+    {"htm", "text/html"},
+    {"html", "text/html"},
+    {"ico", "image/x-icon"},
+    {"ics", "text/calendar"},
+    {"jar", "application/java-archive"},
+    {"jpeg", "image/jpeg"},
+    {"jpg", "image/jpeg"},
+    {"js", "text/javascript"},
+    {"json", "application/json"},
+    {"jsonld", "application/ld+json"},
+    {"jxl", "image/jxl"},
+    {"m3u8", "application/vnd.apple.mpegurl"},
+    {"m4a", "audio/mp4"},
+    {"m4v", "video/mp4"},
+    {"map", "application/json"},
+    {"md", "text/markdown"},
+    {"mid", "audio/midi"},
+    {"mjs", "text/javascript"},
+    {"mkv", "video/x-matroska"},
+    {"mov", "video/quicktime"},
+    {"mp3", "audio/mpeg"},
+    {"mp4", "video/mp4"},
+    {"mpd", "application/dash+xml"},
+    {"mpeg", "video/mpeg"},
+    {"oga", "audio/ogg"},
+    {"ogg", "audio/ogg"},
+    {"ogv", "video/ogg"},
+    {"opus", "audio/opus"},
+    {"otf", "font/otf"},
+    {"pdf", "application/pdf"},
+    {"png", "image/png"},
+    {"ppt", "application/vnd.ms-powerpoint"},
+    {"pptx", "application/"
+             "vnd.openxmlformats-officedocument.presentationml.presentation"},
+    {"rar", "application/vnd.rar"},
+    {"rss", "application/rss+xml"},
+    {"rtf", "application/rtf"},
+    {"svg", "image/svg+xml"},
+    {"svgz", "image/svg+xml"},
+    {"tar", "application/x-tar"},
+    {"tif", "image/tiff"},
+    {"tiff", "image/tiff"},
+    {"toml", "application/toml"},
+    {"ts", "video/mp2t"},
+    {"ttf", "font/ttf"},
+    {"txt", "text/plain"},
+    {"wasm", "application/wasm"},
+    {"wav", "audio/wav"},
+    {"weba", "audio/webm"},
+    {"webm", "video/webm"},
+    {"webmanifest", "application/manifest+json"},
+    {"webp", "image/webp"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"xhtml", "application/xhtml+xml"},
+    {"xls", "application/vnd.ms-excel"},
+    {"xlsx",
+     "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet"},
+    {"xml", "application/xml"},
+    {"yaml", "application/yaml"},
+    {"zip", "application/zip"},
+    {"zst", "application/zstd"},
+};
+
+#define TYPE_COUNT (sizeof(types) / sizeof(types[0]))
+#define BUCKET_COUNT (TYPE_COUNT / 2 + 1)
+
+int main(void) {
+  uint32_t seeds[BUCKET_COUNT] = {0};
+  size_t slots[TYPE_COUNT];
+  size_t bucket_size[BUCKET_COUNT] = {0};
+  bool taken[TYPE_COUNT] = {false};
+  bool placed[BUCKET_COUNT] = {false};
+
+  for (size_t i = 0; i < TYPE_COUNT; ++i)
+    ++bucket_size[mime_hash(0, types[i][0], strlen(types[i][0])) %
+                  BUCKET_COUNT];
+
+  // biggest buckets first, they're the hardest to fit
+  for (size_t round = 0; round < BUCKET_COUNT; ++round) {
+    size_t bucket = BUCKET_COUNT, members[TYPE_COUNT], count = 0;
+
+    for (size_t b = 0; b < BUCKET_COUNT; ++b)
+      if (!placed[b] && (bucket == BUCKET_COUNT ||
+                         bucket_size[b] > bucket_size[bucket]))
+        bucket = b;
+    placed[bucket] = true;
+    if (bucket_size[bucket] == 0)
+      break;
+
+    for (size_t i = 0; i < TYPE_COUNT; ++i)
+      if (mime_hash(0, types[i][0], strlen(types[i][0])) % BUCKET_COUNT ==
+          bucket)
+        members[count++] = i;
+
+    uint32_t seed;
+    for (seed = 1; seed < MAX_SEED; ++seed) {
+      size_t k, tried[TYPE_COUNT];
+
+      for (k = 0; k < count; ++k) {
+        const char *ext = types[members[k]][0];
+        size_t slot = mime_hash(seed, ext, strlen(ext)) % TYPE_COUNT, j;
+
+        for (j = 0; j < k && tried[j] != slot; ++j)
+          ;
+        if (taken[slot] || j < k)
+          break;
+        tried[k] = slot;
+      }
+
+      if (k == count) {
+        for (k = 0; k < count; ++k) {
+          taken[tried[k]] = true;
+          slots[tried[k]] = members[k];
+        }
+        break;
+      }
+    }
+
+    if (seed == MAX_SEED) {
+      fprintf(stderr, "mime_table: no seed fits bucket %zu\n", bucket);
+      return 1;
+    }
+    seeds[bucket] = seed;
+  }
+
+  printf("/* generated by `just mime_table` from tools/mime_table.c, edit the "
+         "list\n * there instead */\n\n"
+         "#ifndef MIMETABLE_H_IMPLEMENTATION\n"
+         "#define MIMETABLE_H_IMPLEMENTATION\n\n"
+         "#include <stdint.h>\n\n"
+         "#include <mime.h>\n\n"
+         "#define MIME_TABLE_SIZE %zu\n"
+         "#define MIME_BUCKETS %zu\n\n"
+         "// 0 for a bucket no extension hashes to\n"
+         "static const uint32_t mime_seeds[MIME_BUCKETS] = {\n",
+         TYPE_COUNT, BUCKET_COUNT);
+  for (size_t b = 0; b < BUCKET_COUNT; ++b)
+    printf(b % 8 == 0 ? "    %u," : b % 8 == 7 ? " %u,\n" : " %u,", seeds[b]);
+  printf(BUCKET_COUNT % 8 ? "\n};\n\n" : "};\n\n");
+  printf("static const mimeEntry mime_table[MIME_TABLE_SIZE] = {\n");
+  for (size_t i = 0; i < TYPE_COUNT; ++i)
+    printf("    {H2O_STRLIT(\"%s\"), {H2O_STRLIT(\"%s\")}},\n",
+           types[slots[i]][0], types[slots[i]][1]);
+  printf("};\n\n"
+         "#endif // !MIMETABLE_H_IMPLEMENTATION\n");
+  return 0;
+}